@@ -0,0 +1,85 @@
+/**
+ * Benchmark of the operator container (operator_container_t) against boost::multi_index_container
+ *
+ * Usage: benchmark_operator_container [average number of operators] [number of steps]
+ *
+ * Each step mimics a local update in a sliding window:
+ *   a range query in a window, insertion of a pair of operators or removal of a pair of operators.
+ * As in the Monte Carlo simulation, the window is moved back and forth between 0 and beta.
+ */
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+
+#include <boost/lambda/lambda.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/identity.hpp>
+#include <boost/random.hpp>
+
+#include "../src/operator.hpp"
+
+typedef boost::multi_index::multi_index_container<psi> multi_index_container_t;
+
+template<typename Container>
+double run(int num_ops, int num_steps, long &checksum) {
+  namespace bll = boost::lambda;
+  typedef typename Container::iterator it_t;
+
+  boost::mt19937 gen(1234);
+  boost::uniform_01<> unidist;
+  const double beta = 1.0;
+  const double window = beta * 10.0 / std::max(num_ops, 1);
+
+  Container ops;
+  for (int iop = 0; iop < num_ops; ++iop) {
+    ops.insert(psi(OperatorTime(unidist(gen) * beta), iop % 2 == 0 ? CREATION_OP : ANNIHILATION_OP, iop % 4));
+  }
+
+  const int num_windows = static_cast<int>(beta / window);
+  const std::clock_t start = std::clock();
+  for (int step = 0; step < num_steps; ++step) {
+    const int pos = step % (2 * num_windows);
+    const double tau_low = (pos < num_windows ? pos : 2 * num_windows - pos - 1) * (beta / num_windows);
+    const double tau_high = tau_low + window;
+    std::pair<it_t, it_t> ops_range = ops.range(tau_low <= bll::_1, bll::_1 <= tau_high);
+    const int num_ops_in_range = std::distance(ops_range.first, ops_range.second);
+    checksum += num_ops_in_range;
+
+    if (unidist(gen) < 0.5 || num_ops_in_range < 2) {
+      ops.insert(psi(OperatorTime(tau_low + unidist(gen) * window), CREATION_OP, 0));
+      ops.insert(psi(OperatorTime(tau_low + unidist(gen) * window), ANNIHILATION_OP, 0));
+    } else {
+      it_t it = ops_range.first;
+      std::advance(it, static_cast<int>(unidist(gen) * (num_ops_in_range - 1)));
+      const psi op1 = *it;
+      const psi op2 = *(++it);
+      ops.erase(op1);
+      ops.erase(op2);
+    }
+  }
+  checksum += ops.size();
+  return (1.0 * (std::clock() - start)) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv) {
+  const int num_ops = argc > 1 ? std::atoi(argv[1]) : 200;
+  const int num_steps = argc > 2 ? std::atoi(argv[2]) : 1000000;
+  if (num_ops < 20) {
+    std::cerr << "The number of operators must be at least 20." << std::endl;
+    return 1;
+  }
+
+  long checksum = 0, checksum_ref = 0;
+  const double time = run<operator_container_t>(num_ops, num_steps, checksum);
+  const double time_ref = run<multi_index_container_t>(num_ops, num_steps, checksum_ref);
+
+  std::cout << "number of operators " << num_ops << " , number of steps " << num_steps << std::endl;
+  std::cout << "operator_container_t: " << time << " sec" << std::endl;
+  std::cout << "multi_index_container: " << time_ref << " sec" << std::endl;
+  if (checksum != checksum_ref) {
+    std::cerr << "Checksums do not match! " << checksum << " " << checksum_ref << std::endl;
+    return 1;
+  }
+  return 0;
+}
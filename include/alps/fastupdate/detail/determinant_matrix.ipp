@@ -399,6 +399,109 @@ namespace alps {
       sanity_check();
     }
 
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    Scalar
+    DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp>::transform_operators(
+      const std::vector<CdaggerOp>& new_cdagg_ops,
+      const std::vector<COp>& new_c_ops,
+      const std::vector<int>& sign_cdagg,
+      const std::vector<int>& sign_c
+    ) {
+      check_state(waiting);
+
+      const int pert_order = cdagg_ops_.size();
+      assert(size()==pert_order);
+      assert(new_cdagg_ops.size()==pert_order && new_c_ops.size()==pert_order);
+      assert(sign_cdagg.size()==pert_order && sign_c.size()==pert_order);
+
+      //G'^{-1} = D_cdagg G^{-1} D_c, where cols of the inverse matrix correspond to annihilation operators
+      Scalar det_rat = 1.0;
+      for (int i=0; i<pert_order; ++i) {
+        det_rat *= 1.*sign_cdagg[i]*sign_c[i];
+        if (sign_c[i] < 0) {
+          for (int j=0; j<pert_order; ++j) {
+            inv_matrix_(j,i) *= -1.0;
+          }
+        }
+      }
+      for (int j=0; j<pert_order; ++j) {
+        if (sign_cdagg[j] < 0) {
+          for (int i=0; i<pert_order; ++i) {
+            inv_matrix_(j,i) *= -1.0;
+          }
+        }
+      }
+
+      const int perm_old = permutation_row_col_;
+      reset_operators(new_cdagg_ops, new_c_ops);
+
+      sanity_check();
+
+      return (1.*permutation_row_col_/perm_old)*det_rat;
+    }
+
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    void
+    DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp>::set_operators(
+      const std::vector<CdaggerOp>& new_cdagg_ops,
+      const std::vector<COp>& new_c_ops,
+      const eigen_matrix_t& inverse_matrix
+    ) {
+      check_state(waiting);
+      assert(new_cdagg_ops.size()==new_c_ops.size());
+      assert(inverse_matrix.rows()==new_cdagg_ops.size() && inverse_matrix.cols()==new_c_ops.size());
+
+      inv_matrix_ = inverse_matrix;
+      reset_operators(new_cdagg_ops, new_c_ops);
+
+      sanity_check();
+    }
+
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    void
+    DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp>::reset_operators(
+      const std::vector<CdaggerOp>& new_cdagg_ops,
+      const std::vector<COp>& new_c_ops
+    ) {
+      const int pert_order = new_cdagg_ops.size();
+
+      cdagg_ops_ = new_cdagg_ops;
+      c_ops_ = new_c_ops;
+      cdagg_op_pos_.clear();
+      cop_pos_.clear();
+      for (int iop=0; iop<pert_order; ++iop) {
+        cdagg_op_pos_.insert(std::make_pair(operator_time(cdagg_ops_[iop]), iop));
+        cop_pos_.insert(std::make_pair(operator_time(c_ops_[iop]), iop));
+      }
+      cdagg_ops_set_ = cdagg_set_t(cdagg_ops_.begin(), cdagg_ops_.end());
+      c_ops_set_ = c_set_t(c_ops_.begin(), c_ops_.end());
+
+      //detail::permutation() is O(N^2)
+      std::vector<itime_t> cdagg_times(pert_order), c_times(pert_order);
+      for (int iop=0; iop<pert_order; ++iop) {
+        cdagg_times[iop] = operator_time(cdagg_ops_[iop]);
+        c_times[iop] = operator_time(c_ops_[iop]);
+      }
+      permutation_row_col_ =
+        detail::comb_sort(c_times.begin(), c_times.end(), std::less<itime_t>())*
+        detail::comb_sort(cdagg_times.begin(), cdagg_times.end(), std::less<itime_t>());
+    }
+
     template<
       typename Scalar,
       typename GreensFunction,
@@ -267,6 +267,168 @@ namespace alps {
       clear_work();
     };
 
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    Scalar
+    DeterminantMatrixPartitioned<Scalar,GreensFunction,CdaggerOp,COp>::transform_operators(
+      const std::vector<CdaggerOp>& new_cdagg_ops,
+      const std::vector<COp>& new_c_ops,
+      const std::vector<int>& sign_cdagg,
+      const std::vector<int>& sign_c
+    ) {
+      check_state(waiting);
+      if (singular_) {
+        throw std::runtime_error("transform_operators: the matrix is singular!");
+      }
+      assert(new_cdagg_ops.size()==size() && new_c_ops.size()==size());
+
+      //find the block to which each block is mapped
+      std::vector<int> new_block(num_sectors_, -1);
+      std::vector<bool> occupied(num_sectors_, false);
+      int offset = 0;
+      for (int sector=0; sector<num_sectors_; ++sector) {
+        const int block_size = det_mat_[sector].size();
+        for (int iop=offset; iop<offset+block_size; ++iop) {
+          const int sector_cdagg = sector_belonging_to_[operator_flavor(new_cdagg_ops[iop])];
+          const int sector_c = sector_belonging_to_[operator_flavor(new_c_ops[iop])];
+          if (new_block[sector] < 0) {
+            new_block[sector] = sector_cdagg;
+          }
+          if (sector_cdagg != new_block[sector] || sector_c != new_block[sector]) {
+            throw std::runtime_error("transform_operators: operators in a block must be mapped to a single block!");
+          }
+        }
+        if (block_size > 0) {
+          if (occupied[new_block[sector]]) {
+            throw std::runtime_error("transform_operators: two blocks are mapped to the same block!");
+          }
+          occupied[new_block[sector]] = true;
+        }
+        offset += block_size;
+      }
+      //empty blocks fill the remaining places
+      int free_block = 0;
+      for (int sector=0; sector<num_sectors_; ++sector) {
+        if (new_block[sector] >= 0) {
+          continue;
+        }
+        while (occupied[free_block]) {
+          ++free_block;
+        }
+        new_block[sector] = free_block;
+        occupied[free_block] = true;
+      }
+
+      //transform each block
+      Scalar det_rat = 1.0;
+      offset = 0;
+      for (int sector=0; sector<num_sectors_; ++sector) {
+        const int block_size = det_mat_[sector].size();
+        if (block_size > 0) {
+          det_rat *= det_mat_[sector].transform_operators(
+            std::vector<CdaggerOp>(new_cdagg_ops.begin()+offset, new_cdagg_ops.begin()+offset+block_size),
+            std::vector<COp>(new_c_ops.begin()+offset, new_c_ops.begin()+offset+block_size),
+            std::vector<int>(sign_cdagg.begin()+offset, sign_cdagg.begin()+offset+block_size),
+            std::vector<int>(sign_c.begin()+offset, sign_c.begin()+offset+block_size)
+          );
+        }
+        offset += block_size;
+      }
+
+      //permute blocks
+      std::vector<int> source_block(num_sectors_);
+      for (int sector=0; sector<num_sectors_; ++sector) {
+        source_block[new_block[sector]] = sector;
+      }
+      std::vector<BlockMatrixType> det_mat_new;
+      det_mat_new.reserve(num_sectors_);
+      for (int sector=0; sector<num_sectors_; ++sector) {
+        det_mat_new.push_back(det_mat_[source_block[sector]]);
+      }
+      std::swap(det_mat_, det_mat_new);
+
+      const int perm_old = permutation_;
+      rebuild_time_ordered_sets();
+
+      sanity_check();
+
+      return (1.*permutation_/perm_old)*det_rat;
+    }
+
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    void
+    DeterminantMatrixPartitioned<Scalar,GreensFunction,CdaggerOp,COp>::set_operators(
+      const std::vector<std::vector<CdaggerOp> >& cdagg_ops,
+      const std::vector<std::vector<COp> >& c_ops,
+      const std::vector<eigen_matrix_t>& inverse_matrices
+    ) {
+      check_state(waiting);
+      assert(cdagg_ops.size()==num_sectors_ && c_ops.size()==num_sectors_ && inverse_matrices.size()==num_sectors_);
+
+      for (int sector=0; sector<num_sectors_; ++sector) {
+        det_mat_[sector].set_operators(cdagg_ops[sector], c_ops[sector], inverse_matrices[sector]);
+      }
+      singular_ = false;
+      rebuild_time_ordered_sets();
+
+      sanity_check();
+    }
+
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    void
+    DeterminantMatrixPartitioned<Scalar,GreensFunction,CdaggerOp,COp>::rebuild_time_ordered_sets() {
+      cdagg_times_set_.clear();
+      c_times_set_.clear();
+      for (int sector=0; sector<num_sectors_; ++sector) {
+        const std::vector<CdaggerOp>& cdagg_ops = det_mat_[sector].get_cdagg_ops();
+        const std::vector<COp>& c_ops = det_mat_[sector].get_c_ops();
+        cdagg_times_sectored_set_[sector] = cdagg_set_t(cdagg_ops.begin(), cdagg_ops.end());
+        c_times_sectored_set_[sector] = c_set_t(c_ops.begin(), c_ops.end());
+        cdagg_times_set_.insert(cdagg_ops.begin(), cdagg_ops.end());
+        c_times_set_.insert(c_ops.begin(), c_ops.end());
+      }
+      reconstruct_operator_list_in_actual_order();
+      permutation_ = compute_permutation_over_sectors();
+    }
+
+    template<
+      typename Scalar,
+      typename GreensFunction,
+      typename CdaggerOp,
+      typename COp
+    >
+    int
+    DeterminantMatrixPartitioned<Scalar,GreensFunction,CdaggerOp,COp>::compute_permutation_over_sectors() const {
+      std::vector<std::pair<int,CdaggerOp> > cdagg_ops_work;
+      std::vector<std::pair<int,COp> > c_ops_work;
+      for (typename cdagg_set_t::iterator it = cdagg_times_set_.begin(); it != cdagg_times_set_.end(); ++it) {
+        cdagg_ops_work.push_back(std::make_pair(block_belonging_to(operator_flavor(*it)), *it));
+      }
+      for (typename c_set_t::iterator it = c_times_set_.begin(); it != c_times_set_.end(); ++it) {
+        c_ops_work.push_back(std::make_pair(block_belonging_to(operator_flavor(*it)), *it));
+      }
+
+      detail::comb_sort(cdagg_ops_work.begin(), cdagg_ops_work.end(), CompareOverSectors<CdaggerOp>());
+      detail::comb_sort(c_ops_work.begin(),     c_ops_work.end(),     CompareOverSectors<COp>());
+      return
+        detail::comb_sort(cdagg_ops_work.begin(), cdagg_ops_work.end(), CompareWithinSectors<CdaggerOp>())*
+        detail::comb_sort(c_ops_work.begin(),     c_ops_work.end(),     CompareWithinSectors<COp>());
+    }
+
     template<
       typename Scalar,
       typename GreensFunction,
@@ -308,21 +470,7 @@ namespace alps {
       }
       assert(size()==pert_order);
 
-      std::vector<std::pair<int,CdaggerOp> > cdagg_ops_work;
-      std::vector<std::pair<int,COp> > c_ops_work;
-      for (typename cdagg_set_t::iterator it = cdagg_times_set_.begin(); it != cdagg_times_set_.end(); ++it) {
-        cdagg_ops_work.push_back(std::make_pair(block_belonging_to(it->flavor()), *it));
-      }
-      for (typename c_set_t::iterator it = c_times_set_.begin(); it != c_times_set_.end(); ++it) {
-        c_ops_work.push_back(std::make_pair(block_belonging_to(it->flavor()), *it));
-      }
-
-      detail::comb_sort(cdagg_ops_work.begin(), cdagg_ops_work.end(), CompareOverSectors<CdaggerOp>());
-      detail::comb_sort(c_ops_work.begin(),     c_ops_work.end(),     CompareOverSectors<COp>());
-      const int perm_recomputed =
-        detail::comb_sort(cdagg_ops_work.begin(), cdagg_ops_work.end(), CompareWithinSectors<CdaggerOp>())*
-        detail::comb_sort(c_ops_work.begin(),     c_ops_work.end(),     CompareWithinSectors<COp>());
-      assert(permutation_ == perm_recomputed);
+      assert(permutation_ == compute_permutation_over_sectors());
 
       //check list of operators in actual order
       if (state_ == waiting) {
@@ -51,8 +51,8 @@ namespace alps {
       typedef std::vector<CdaggerOp> cdagg_container_t;
       typedef std::vector<COp> c_container_t;
       typedef std::map<itime_t,int> operator_map_t;
-      typedef boost::multi_index::multi_index_container<CdaggerOp> cdagg_set_t;
-      typedef boost::multi_index::multi_index_container<COp> c_set_t;
+      typedef FlatSet<CdaggerOp> cdagg_set_t;
+      typedef FlatSet<COp> c_set_t;
 
       typedef typename cdagg_container_t::iterator cdagg_it;
       typedef typename c_container_t::iterator c_it;
@@ -195,6 +195,30 @@ namespace alps {
        */
       void rebuild_inverse_matrix();
 
+      /**
+       * Replace all the operators by new ones while keeping the inverse matrix: O(N^2)
+       * The new operators and the signs are given in the order of get_cdagg_ops() and get_c_ops().
+       * The caller must guarantee that the new matrix is G'(i,j) = sign_c[i] * G(i,j) * sign_cdagg[j],
+       * e.g., a global shift in imaginary time or a relabeling of flavors leaving the Green's function invariant.
+       * Returns the determinant ratio (including the change of the permutation sign from time-ordering).
+       */
+      Scalar transform_operators(
+        const std::vector<CdaggerOp>& new_cdagg_ops,
+        const std::vector<COp>& new_c_ops,
+        const std::vector<int>& sign_cdagg,
+        const std::vector<int>& sign_c
+      );
+
+      /**
+       * Replace all the operators and set an inverse matrix computed elsewhere (e.g., from an LU decomposition): O(N^2)
+       * Rows (cols) of the matrix correspond to new_c_ops (new_cdagg_ops) in the given order.
+       */
+      void set_operators(
+        const std::vector<CdaggerOp>& new_cdagg_ops,
+        const std::vector<COp>& new_c_ops,
+        const eigen_matrix_t& inverse_matrix
+      );
+
       /**
        * Compute the inverse matrix for the time-ordered set of operators
        * This could cost O(N^3) because rows and cols are time-ordered if needed
@@ -321,6 +345,9 @@ namespace alps {
 
       void reject_replace_c();
 
+      /** replace operators and rebuild the maps, the time-ordered sets and the permutation sign */
+      void reset_operators(const std::vector<CdaggerOp>& new_cdagg_ops, const std::vector<COp>& new_c_ops);
+
       /** swap cols of the matrix (and the rows of the inverse matrix)*/
       void swap_cdagg_op(int col1, int col2);
 
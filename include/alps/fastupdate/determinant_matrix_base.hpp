@@ -3,14 +3,12 @@
  */
 #pragma once
 
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/sequenced_index.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/identity.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include <Eigen/Dense>
 
+#include "flat_set.hpp"
+
 namespace alps {
   namespace fastupdate {
 
@@ -40,8 +38,8 @@ namespace alps {
       typedef Eigen::Matrix<Scalar,Eigen::Dynamic,Eigen::Dynamic> eigen_matrix_t;
       typedef std::vector<CdaggerOp> cdagg_container_t;
       typedef std::vector<COp> c_container_t;
-      typedef boost::multi_index::multi_index_container<CdaggerOp> cdagg_set_t;
-      typedef boost::multi_index::multi_index_container<COp> c_set_t;
+      typedef FlatSet<CdaggerOp> cdagg_set_t;
+      typedef FlatSet<COp> c_set_t;
 
       DeterminantMatrixBase(
         boost::shared_ptr<GreensFunction>& p_gf
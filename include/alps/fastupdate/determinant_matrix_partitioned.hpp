@@ -281,6 +281,32 @@ namespace alps {
         }
       }
 
+      /**
+       * Replace all the operators by new ones while keeping the inverse matrices: O(N^2)
+       * The new operators and the signs are given in the order of get_cdagg_ops() and get_c_ops().
+       * The caller must guarantee that the new matrix is G'(i,j) = sign_c[i] * G(i,j) * sign_cdagg[j].
+       * All the operators in a block must be mapped to a single block, i.e., blocks may be permuted
+       * (e.g. by an exchange of flavors that leaves the Green's function invariant).
+       * Returns the determinant ratio (including the change of the permutation sign from time-ordering).
+       */
+      Scalar transform_operators(
+        const std::vector<CdaggerOp>& new_cdagg_ops,
+        const std::vector<COp>& new_c_ops,
+        const std::vector<int>& sign_cdagg,
+        const std::vector<int>& sign_c
+      );
+
+      /**
+       * Replace all the operators and set inverse matrices computed elsewhere (e.g., from LU decompositions): O(N^2)
+       * The operators and the inverse matrix are given for each block.
+       * Rows (cols) of the matrix of a block correspond to c_ops[block] (cdagg_ops[block]) in the given order.
+       */
+      void set_operators(
+        const std::vector<std::vector<CdaggerOp> >& cdagg_ops,
+        const std::vector<std::vector<COp> >& c_ops,
+        const std::vector<eigen_matrix_t>& inverse_matrices
+      );
+
     private:
       typedef DeterminantMatrix<Scalar,GreensFunction,CdaggerOp,COp> BlockMatrixType;
 
@@ -413,6 +439,12 @@ namespace alps {
 
       void init(boost::shared_ptr<GreensFunction> p_gf);
 
+      /** rebuild the time-ordered sets and the permutation sign from the operators in the block matrices */
+      void rebuild_time_ordered_sets();
+
+      /** permutation from a set that is time-ordered in each sector to a time-ordered set */
+      int compute_permutation_over_sectors() const;
+
       inline void check_state(State state) const {
         if (state_ != state) {
           throw std::logic_error("Error: the system is not in a correct state!");
@@ -0,0 +1,309 @@
+/**
+ * Copyright (C) 2016 by Hiroshi Shinaoka <h.shinaoka@gmail.com>
+ */
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <boost/iterator/iterator_facade.hpp>
+
+namespace alps {
+  namespace fastupdate {
+
+    namespace detail {
+      /** Comparison by operator< which also accepts keys compatible with the element type (e.g. time for operators) */
+      struct less_compatible {
+        template<typename T1, typename T2>
+        bool operator()(const T1& x, const T2& y) const {
+          return x < y;
+        }
+      };
+
+      /** Return the first element in [first, last) for which pred is true (pred must be monotonic on the range) */
+      template<typename Iterator, typename Pred>
+      Iterator first_satisfying(Iterator first, Iterator last, const Pred& pred) {
+        typename std::iterator_traits<Iterator>::difference_type len = std::distance(first, last);
+        while (len > 0) {
+          const typename std::iterator_traits<Iterator>::difference_type half = len/2;
+          Iterator middle = first;
+          std::advance(middle, half);
+          if (!pred(*middle)) {
+            first = ++middle;
+            len -= half + 1;
+          } else {
+            len = half;
+          }
+        }
+        return first;
+      }
+
+      template<typename Pred>
+      struct not_satisfying {
+        not_satisfying(const Pred& pred) : pred_(pred) {}
+
+        template<typename T>
+        bool operator()(const T& x) const {
+          return !pred_(x);
+        }
+
+        const Pred& pred_;
+      };
+
+      template<typename Compare>
+      struct equivalent_by {
+        equivalent_by(const Compare& comp) : comp_(comp) {}
+
+        template<typename T>
+        bool operator()(const T& x, const T& y) const {
+          return !comp_(x, y) && !comp_(y, x);
+        }
+
+        Compare comp_;
+      };
+    }
+
+    /**
+     * @brief Ordered set stored in a sorted array with a gap buffer
+     *
+     * This is a drop-in replacement of boost::multi_index::multi_index_container<T> (a single ordered unique index)
+     * for sets of operators of a few hundred elements.
+     * Lookups and range queries are binary searches on contiguous memory and iterators are random access.
+     * The array has a gap (unused slots) at the position of the last insertion/erase.
+     * Insertion and erase cost O(distance from the previous insertion/erase),
+     * which is small for updates localized in a sliding window.
+     *
+     * Note: unlike a node-based container, insert() and erase() invalidate all iterators.
+     * An iterator refers to a container object and a logical position, not to an element:
+     * after swap(), copy or move assignment it points into the new contents of the same object.
+     */
+    template<typename T, typename Compare = detail::less_compatible>
+    class FlatSet {
+    private:
+      typedef std::vector<T> buffer_t;
+
+    public:
+      class const_iterator : public boost::iterator_facade<const_iterator, const T, std::random_access_iterator_tag> {
+      public:
+        const_iterator() : p_set_(0), pos_(0) {}
+        const_iterator(const FlatSet* p_set, std::size_t pos) : p_set_(p_set), pos_(pos) {}
+
+      private:
+        friend class boost::iterator_core_access;
+        friend class FlatSet;
+
+        const T& dereference() const { return p_set_->at_logical(pos_); }
+        bool equal(const const_iterator& other) const { return pos_ == other.pos_; }
+        void increment() { ++pos_; }
+        void decrement() { --pos_; }
+        void advance(std::ptrdiff_t n) { pos_ += n; }
+        std::ptrdiff_t distance_to(const const_iterator& other) const {
+          return static_cast<std::ptrdiff_t>(other.pos_) - static_cast<std::ptrdiff_t>(pos_);
+        }
+
+        const FlatSet* p_set_;
+        std::size_t pos_;
+      };
+
+      typedef T key_type;
+      typedef T value_type;
+      typedef Compare key_compare;
+      typedef std::size_t size_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const T& reference;
+      typedef const T& const_reference;
+      typedef const_iterator iterator;
+      typedef std::reverse_iterator<const_iterator> reverse_iterator;
+      typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+      FlatSet() : comp_(), buffer_(), gap_begin_(0), gap_end_(0) {}
+
+      template<typename InputIterator>
+      FlatSet(InputIterator first, InputIterator last) : comp_(), buffer_(), gap_begin_(0), gap_end_(0) {
+        insert(first, last);
+      }
+
+      const_iterator begin() const { return const_iterator(this, 0); }
+      const_iterator end() const { return const_iterator(this, size()); }
+      const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+      const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+      size_type size() const { return buffer_.size() - (gap_end_ - gap_begin_); }
+      bool empty() const { return size() == 0; }
+
+      void clear() {
+        buffer_.clear();
+        gap_begin_ = gap_end_ = 0;
+      }
+
+      /**
+       * Exchange the contents with another set.
+       * Unlike std::set::swap, iterators are not carried over to the other set:
+       * an iterator obtained before swap() must not be used after it.
+       */
+      void swap(FlatSet& other) {
+        buffer_.swap(other.buffer_);
+        std::swap(gap_begin_, other.gap_begin_);
+        std::swap(gap_end_, other.gap_end_);
+      }
+
+      /** Access to the n-th smallest element */
+      const_reference operator[](size_type n) const { return at_logical(n); }
+
+      /** Insert an element. Nothing is done if there is already an equivalent element. */
+      std::pair<iterator, bool> insert(const value_type& x) {
+        const_iterator it = lower_bound(x);
+        if (it != end() && !comp_(x, *it)) {
+          return std::make_pair(it, false);
+        }
+        const size_type pos = it.pos_;
+        move_gap_to(pos);
+        if (gap_begin_ == gap_end_) {
+          grow();
+        }
+        buffer_[gap_begin_] = x;
+        ++gap_begin_;
+        return std::make_pair(const_iterator(this, pos), true);
+      }
+
+      /** Insert elements in [first, last). Elements equivalent to existing ones are ignored. */
+      template<typename InputIterator>
+      void insert(InputIterator first, InputIterator last) {
+        close_gap();
+        const size_type old_size = buffer_.size();
+        buffer_.insert(buffer_.end(), first, last);
+        if (buffer_.size() == old_size) {
+          return;
+        }
+        //stable sort and merge so that the first one of equivalent elements survives
+        std::stable_sort(buffer_.begin() + old_size, buffer_.end(), comp_);
+        std::inplace_merge(buffer_.begin(), buffer_.begin() + old_size, buffer_.end(), comp_);
+        buffer_.erase(
+          std::unique(buffer_.begin(), buffer_.end(), detail::equivalent_by<Compare>(comp_)),
+          buffer_.end()
+        );
+        gap_begin_ = gap_end_ = buffer_.size();
+      }
+
+      iterator erase(const_iterator position) {
+        move_gap_to(position.pos_);
+        ++gap_end_;
+        return const_iterator(this, position.pos_);
+      }
+
+      iterator erase(const_iterator first, const_iterator last) {
+        move_gap_to(first.pos_);
+        gap_end_ += last.pos_ - first.pos_;
+        return const_iterator(this, first.pos_);
+      }
+
+      /** Erase the element equivalent to x. Return the number of elements erased (0 or 1). */
+      template<typename Key>
+      size_type erase(const Key& x) {
+        const_iterator it = find(x);
+        if (it == end()) {
+          return 0;
+        }
+        erase(it);
+        return 1;
+      }
+
+      template<typename Key>
+      const_iterator find(const Key& x) const {
+        const_iterator it = lower_bound(x);
+        return (it == end() || comp_(x, *it)) ? end() : it;
+      }
+
+      template<typename Key>
+      size_type count(const Key& x) const {
+        return find(x) == end() ? 0 : 1;
+      }
+
+      template<typename Key>
+      const_iterator lower_bound(const Key& x) const {
+        //search the part before the gap first
+        if (gap_begin_ > 0 && !comp_(buffer_[gap_begin_ - 1], x)) {
+          return const_iterator(this, std::lower_bound(buffer_.begin(), buffer_.begin() + gap_begin_, x, comp_) - buffer_.begin());
+        }
+        return const_iterator(this, std::lower_bound(buffer_.begin() + gap_end_, buffer_.end(), x, comp_) - buffer_.begin() - (gap_end_ - gap_begin_));
+      }
+
+      template<typename Key>
+      const_iterator upper_bound(const Key& x) const {
+        if (gap_begin_ > 0 && comp_(x, buffer_[gap_begin_ - 1])) {
+          return const_iterator(this, std::upper_bound(buffer_.begin(), buffer_.begin() + gap_begin_, x, comp_) - buffer_.begin());
+        }
+        return const_iterator(this, std::upper_bound(buffer_.begin() + gap_end_, buffer_.end(), x, comp_) - buffer_.begin() - (gap_end_ - gap_begin_));
+      }
+
+      template<typename Key>
+      std::pair<const_iterator, const_iterator> equal_range(const Key& x) const {
+        return std::make_pair(lower_bound(x), upper_bound(x));
+      }
+
+      /**
+       * Same as range() of an ordered index of boost::multi_index_container:
+       * return [first element satisfying lower, first element not satisfying upper).
+       */
+      template<typename LowerBounder, typename UpperBounder>
+      std::pair<const_iterator, const_iterator> range(LowerBounder lower, UpperBounder upper) const {
+        const_iterator it_lower = detail::first_satisfying(begin(), end(), lower);
+        const_iterator it_upper =
+          detail::first_satisfying(it_lower, end(), detail::not_satisfying<UpperBounder>(upper));
+        return std::make_pair(it_lower, it_upper);
+      }
+
+      friend bool operator==(const FlatSet& x, const FlatSet& y) {
+        return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin());
+      }
+
+      friend bool operator!=(const FlatSet& x, const FlatSet& y) {
+        return !(x == y);
+      }
+
+    private:
+      const T& at_logical(size_type pos) const {
+        return pos < gap_begin_ ? buffer_[pos] : buffer_[pos + (gap_end_ - gap_begin_)];
+      }
+
+      //move the gap so that it starts at the given logical position
+      void move_gap_to(size_type pos) {
+        if (pos < gap_begin_) {
+          std::copy_backward(buffer_.begin() + pos, buffer_.begin() + gap_begin_, buffer_.begin() + gap_end_);
+          gap_end_ -= gap_begin_ - pos;
+          gap_begin_ = pos;
+        } else if (pos > gap_begin_) {
+          const size_type n = pos - gap_begin_;
+          std::copy(buffer_.begin() + gap_end_, buffer_.begin() + gap_end_ + n, buffer_.begin() + gap_begin_);
+          gap_begin_ += n;
+          gap_end_ += n;
+        }
+      }
+
+      //remove the gap
+      void close_gap() {
+        buffer_.erase(buffer_.begin() + gap_begin_, buffer_.begin() + gap_end_);
+        gap_begin_ = gap_end_ = buffer_.size();
+      }
+
+      //enlarge the gap by reallocating the buffer
+      void grow() {
+        const size_type gap_size = std::max<size_type>(buffer_.size(), 16);
+        buffer_.insert(buffer_.begin() + gap_begin_, gap_size, T());
+        gap_end_ = gap_begin_ + gap_size;
+      }
+
+      Compare comp_;
+      buffer_t buffer_;//elements in [gap_begin_, gap_end_) are not used
+      size_type gap_begin_, gap_end_;
+    };
+
+    template<typename T, typename Compare>
+    void swap(FlatSet<T,Compare>& x, FlatSet<T,Compare>& y) {
+      x.swap(y);
+    }
+  }
+}
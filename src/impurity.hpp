@@ -101,6 +101,28 @@ class HybridizationSimulation: public alps::mcbase {
     return p_model->get_rotmat_Delta();
   }
 
+  //Flavor combinations stored in the measured data of G2
+  const G2FlavorIndexMap &get_G2_flavor_index_map() const {
+    if (!p_G2_meas) {
+      throw std::runtime_error("G2 is not measured.");
+    }
+    return p_G2_meas->get_flavor_index_map();
+  }
+
+  //Sum (moved out of the sink) and number of the data of an observable summed up on this process
+  //(see AsyncObservableSink)
+  void take_local_sum(const std::string &obs_name, std::vector<std::complex<double> > &sum) {
+    p_meas_sink->take_local_sum(obs_name, sum);
+  }
+  long get_local_count(const std::string &obs_name) const {
+    return p_meas_sink->get_local_count(obs_name);
+  }
+
+  //Means of the observables reduced over all processes by a single packed MPI_Reduce (valid on the master process)
+  std::map<std::string, std::vector<std::complex<double> > > reduce_packed_observables() const {
+    return p_meas_sink->reduce_local_observables(comm, packed_observables);
+  }
+
   std::vector<std::string> get_active_worm_updaters() const {
     std::vector<std::string> names;
     for (int i = 0; i < worm_insertion_removers.size(); ++i) {
@@ -199,9 +221,13 @@ class HybridizationSimulation: public alps::mcbase {
   //change the time of an operator (hybrized with the bath)
   SingleOperatorShiftUpdater<SCALAR, EXTENDED_SCALAR, SW_TYPE> single_op_shift_updater;
 
+  //frequencies of local updates
+  ProposalScheduler proposal_scheduler;
+
   //swap-flavor update
   std::vector<std::pair<std::vector<int>, int> >
       swap_vector;        // contains the flavors f1 f2 f3 f4 ...   Flavors 1 ... N will be relabeled as f1 f2 ... fN.
+  std::vector<bool> swap_trace_invariant; // true if the swap is a symmetry of the local Hamiltonian
 
   //N2Worm updater: worm for computing <c^\dagger_i(tau) c_j(tau) c^\dagger_k(0) c_l(0)>
   typedef LocalUpdater<SCALAR, EXTENDED_SCALAR, SW_TYPE> LocalUpdaterType;
@@ -230,9 +256,15 @@ class HybridizationSimulation: public alps::mcbase {
   //sliding window for computing trace
   SW_TYPE sliding_window;
 
+  //scratch sliding window for computing the trace of a configuration proposed by global updates
+  SW_TYPE sliding_window_scratch;
+
   //for measuring Green's function (by removal)
   GreensFunctionLegendreMeasurement<SCALAR> g_meas_legendre;
 
+  //for measuring Green's function at Matsubara frequencies (by removal)
+  boost::shared_ptr<GreensFunctionMatsubaraMeasurement<SCALAR> > p_g_meas_matsubara;
+
   //Measurement of two-time correlation functions by worm sampling
   boost::shared_ptr<TwoTimeG2Measurement<SCALAR> > p_two_time_G2_meas;
 
@@ -248,6 +280,12 @@ class HybridizationSimulation: public alps::mcbase {
   //Measurement of equal-time single-particle Green's function
   boost::shared_ptr<EqualTimeGMeasurement<SCALAR, 1> > p_equal_time_G1_meas;
 
+  //Passes large vector observables measured above to ALPS on a background thread
+  boost::scoped_ptr<AsyncObservableSink> p_meas_sink;
+
+  //Observables summed up in p_meas_sink and reduced by reduce_packed_observables() instead of ALPS
+  std::vector<std::string> packed_observables;
+
   //For measuring equal-time two-particle Green's function by insertion
   std::vector<EqualTimeOperator<2> > eq_time_two_particle_greens_meas;
 
@@ -20,22 +20,29 @@ void HybridizationSimulation<IMP_MODEL>::define_parameters(parameters_type &para
       .define<int>("verbose", 0, "Verbose output for a non-zero value")
       .define<int>("sliding_window.max", 1000, "Max number of windows")
       .define<int>("sliding_window.min", 1, "Min number of windows")
+      .define<int>("sliding_window.op_norms_in_trace_bound", 1, "Use the spectral norms of the operators in bounding the trace if a non-zero value is specified.")
           //Model definition
       .define<int>("model.sites", "Number of sites/orbitals")
       .define<int>("model.spins", "Number of spins")
       .define<double>("model.beta", "Inverse temperature")
       .define<int>("model.n_tau_hyb",
                    "Hybridization function is defined on a uniform mesh of N_TAU + 1 imaginary points.")
+      .define<int>("model.cubic_interpolation_hyb",
+                   0,
+                   "Interpolate the hybridization function by cubic polynomials if a non-zero value is specified.")
           //Updates
       .define<int>("update.multi_pair_ins_rem", 2, "Perform 1, 2, ..., k-pair updates.")
       .define<int>("update.n_global_updates", 10, "Global updates are performed every N_GLOBAL_UPDATES updates.")
       .define<std::string>("update.swap_vector", "", "Definition of global flavor-exchange updates.")
       .define<int>("update.single_operator_shift", 1, "Perform shifts of a single operator if a non-zero value is specified.")
       .define<int>("update.operator_pair_flavor_update", 1, "Perform changes of flavors of a pair of operators if a non-zero value is specified.")
+      .define<int>("update.adaptive_proposal_rates", 1, "Adjust the frequencies of local updates during thermalization if a non-zero value is specified.")
+      .define<int>("update.sector_aware_insertion", 1, "Propose insertions of a pair of operators only where they may yield a non-zero trace if a non-zero value is specified.")
           //Measurement
       .define<int>("measurement.n_non_worm_meas",
                    10,
                    "Non-worm measurements are performed every N_NON_WORM_MEAS updates.")
+      .define<int>("measurement.packed_reduction", 0, "Set a non-zero value to reduce G1, G2, two-time G2 and G(i omega_n) over MPI processes by a single MPI_Reduce instead of collecting them by ALPS. Only their means are computed: these observables are not written to /simulation/results and have no error bars.")
           //Single-particle GF
       .define<int>("measurement.G1.n_legendre", 100, "Number of legendre polynomials for measuring G(tau)")
       .define<int>("measurement.G1.n_tau",
@@ -47,8 +54,10 @@ void HybridizationSimulation<IMP_MODEL>::define_parameters(parameters_type &para
       .define<int>("measurement.G1.max_matrix_size", 100000, "Max size of inverse matrix for measurement.")
       .define<int>("measurement.G1.max_num_data_accumulated", 10, "Number of measurements before accumulated data are passed to ALPS library.")
       .define<double>("measurement.G1.aux_field", 1e-5, "Auxially field for avoiding a singular matrix")
+      .define<int>("measurement.G1.matsubara_nfft", 0, "Set a non-zero value to measure G(i omega_n) directly in the partition-function space by a non-uniform FFT. The result is written as gf_matsubara.")
           //Equal-time single-particle GF
       .define<int>("measurement.equal_time_G1.on", 0, "Set a non-zero value to activate measurement.")
+      .define<int>("measurement.equal_time_G1.max_num_data_accumulated", 10, "Number of measurements before accumulated data are passed to ALPS library.")
           //Two-particle GF
       .define<int>("measurement.G2.on", 0, "Set a non-zero value to activate measurement.")
       .define<int>("measurement.G2.n_legendre", 20, "Number of legendre polynomials for measurement")
@@ -56,6 +65,8 @@ void HybridizationSimulation<IMP_MODEL>::define_parameters(parameters_type &para
       .define<int>("measurement.G2.max_matrix_size", 5, "Max size of inverse matrix for measurement.")
       .define<int>("measurement.G2.max_num_data_accumulated", 100, "Number of measurements before accumulated data are passed to ALPS library.")
       .define<double>("measurement.G2.aux_field", 1e-5, "Auxially field for avoiding a singular matrix")
+      .define<int>("measurement.G2.improved_estimator", 0, "Set a non-zero value to measure <[d, H_U] d^dagger d d^dagger> by the improved estimator as well.")
+      .define<int>("measurement.G2.streaming_output", 0, "Set a non-zero value to sum up G2 on each process and write it into the output file chunk by chunk without collecting it on the master process.")
           //
           //Two-time two-particle GF
       .define<int>("measurement.two_time_G2.on", 0, "Set a non-zero value to activate measurement.")
@@ -65,6 +76,7 @@ void HybridizationSimulation<IMP_MODEL>::define_parameters(parameters_type &para
           //
           //Equal-time two-particle GF
       .define<int>("measurement.equal_time_G2.on", 0, "Set a non-zero value to activate measurement.")
+      .define<int>("measurement.equal_time_G2.max_num_data_accumulated", 100, "Number of measurements before accumulated data are passed to ALPS library.")
           //
           //Density-density correlations
       .define<std::string>("measurement.nn_corr.def",
@@ -98,7 +110,7 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
       start_time(time(NULL)),
       p_model(new IMP_MODEL(p, rank == 0)),//impurity model
       F(new HybridizationFunction<SCALAR>(
-          BETA, N, FLAVORS, p_model->get_F()
+          BETA, N, FLAVORS, p_model->get_F(), 1e-10, p["model.cubic_interpolation_hyb"].template as<int>() != 0
         )
       ),
 #ifdef ALPS_HAVE_MPI
@@ -109,10 +121,11 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
       mc_config(F),
       config_space_extra_weight(0),
       worm_space_extra_weight_map(),
-      operator_pair_flavor_updater(FLAVORS),
-      single_op_shift_updater(BETA, FLAVORS, N),
+      operator_pair_flavor_updater(FlavorProposer(*p_model, *F)),
+      single_op_shift_updater(BETA, FLAVORS, N, FlavorProposer(*p_model, *F)),
       worm_insertion_removers(0),
       sliding_window(p_model.get(), BETA),
+      sliding_window_scratch(p_model.get(), BETA),
       g_meas_legendre(FLAVORS, p["measurement.G1.n_legendre"], p["measurement.G1.n_matsubara"], BETA),
       p_meas_corr(0),
       global_shift_acc_rate(),
@@ -148,6 +161,9 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
     throw std::runtime_error("sliding_window.max cannot be smaller than sliding_window.max.");
   }
   sliding_window.init_stacks(p["sliding_window.min"], mc_config.operators);
+  sliding_window_scratch.init_stacks(1, mc_config.operators);
+  sliding_window.set_use_op_norms_in_trace_bound(p["sliding_window.op_norms_in_trace_bound"].template as<int>() != 0);
+  sliding_window_scratch.set_use_op_norms_in_trace_bound(p["sliding_window.op_norms_in_trace_bound"].template as<int>() != 0);
   mc_config.trace = sliding_window.compute_trace(mc_config.operators);
   if (comm.rank() == 0 && verbose) {
     std::cout << "initial trace = " << mc_config.trace << " with N_SLIDING_WINDOW = " << sliding_window.get_n_window()
@@ -160,6 +176,13 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
   //Two-time correlation functions
   read_two_time_correlation_functions();
 
+  //Green's function at Matsubara frequencies
+  if (p["measurement.G1.matsubara_nfft"].template as<int>() != 0) {
+    p_g_meas_matsubara.reset(
+        new GreensFunctionMatsubaraMeasurement<SCALAR>(FLAVORS, p["measurement.G1.n_matsubara"], BETA)
+    );
+  }
+
   if (comm.rank() == 0 && verbose) {
     std::cout << "The number of blocks in the inverse matrix is " << mc_config.M.num_blocks() << "." << std::endl;
     for (int block = 0; block < mc_config.M.num_blocks(); ++block) {
@@ -180,13 +203,35 @@ HybridizationSimulation<IMP_MODEL>::HybridizationSimulation(parameters_type cons
     typedef InsertionRemovalDiagonalUpdater<SCALAR, EXTENDED_SCALAR, SW_TYPE> TypeDiag;
     ins_rem_updater.push_back(
         boost::shared_ptr<TypeOffDiag>(
-            new TypeOffDiag(k, FLAVORS)
+            new TypeOffDiag(k, FLAVORS, par["update.sector_aware_insertion"].template as<int>() != 0)
         )
     );
   }
 
   create_worm_updaters();
 
+  //frequencies of local updates (adjusted during thermalization)
+  {
+    //Propose higher-order insertion/removal updates less frequently.
+    //One of them is chosen for a sweep and called FLAVORS times (times its factor) at each window position.
+    //The shift update is called FLAVORS * rank times at each window position (see do_one_sweep).
+    std::vector<double> rates;
+    for (int k = 1; k < rank_ins_rem + 1; ++k) {
+      rates.push_back(std::pow(0.25, k - 1));
+    }
+    const double rates_sum = std::accumulate(rates.begin(), rates.end(), 0.0);
+    double mean_rank = 0.0;
+    for (int k = 1; k < rank_ins_rem + 1; ++k) {
+      proposal_scheduler.add_update(ins_rem_updater[k - 1]->get_name(), FLAVORS * rates[k - 1] / rates_sum);
+      mean_rank += k * rates[k - 1] / rates_sum;
+    }
+    proposal_scheduler.add_update(operator_pair_flavor_updater.get_name(), FLAVORS);
+    proposal_scheduler.add_update(single_op_shift_updater.get_name(), FLAVORS * mean_rank);
+    for (typename worm_updater_map_t::iterator it = worm_movers.begin(); it != worm_movers.end(); ++it) {
+      proposal_scheduler.add_update(it->second->get_name(), 1.0);
+    }
+  }
+
   create_observables();
 }
 
@@ -263,6 +308,9 @@ void HybridizationSimulation<IMP_MODEL>::measure_every_step() {
   switch (mc_config.current_config_space()) {
     case Z_FUNCTION:
       g_meas_legendre.measure(mc_config);//measure Green's function by removal
+      if (p_g_meas_matsubara) {
+        p_g_meas_matsubara->measure(mc_config);
+      }
       measure_scalar_observable<SCALAR>(measurements, "kLkR",
                                         static_cast<double>(measure_kLkR(mc_config.operators, BETA,
                                                                          0.5 * BETA * random())) * mc_config.sign);
@@ -272,20 +320,22 @@ void HybridizationSimulation<IMP_MODEL>::measure_every_step() {
       break;
 
     case G1:
-      p_G1_meas->measure_via_hyb(mc_config, measurements, random, par["measurement.G1.max_matrix_size"],
+      p_G1_meas->measure_via_hyb(mc_config, *p_meas_sink, random, sliding_window,
+                                 par["measurement.G1.max_matrix_size"],
                                  par["measurement.G1.aux_field"]
       );
       break;
 
     case G2:
-      p_G2_meas->measure_via_hyb(mc_config, measurements, random, par["measurement.G2.max_matrix_size"],
+      p_G2_meas->measure_via_hyb(mc_config, *p_meas_sink, random, sliding_window,
+                                 par["measurement.G2.max_matrix_size"],
                                  par["measurement.G2.aux_field"]
       );
       break;
 
     case Two_time_G2:
       p_two_time_G2_meas->measure(mc_config,
-                                  measurements,
+                                  *p_meas_sink,
                                   random,
                                   sliding_window,
                                   N_win_standard,
@@ -293,11 +343,11 @@ void HybridizationSimulation<IMP_MODEL>::measure_every_step() {
       break;
 
     case Equal_time_G1:
-      p_equal_time_G1_meas->measure_G1(mc_config, measurements, "Equal_time_G1");
+      p_equal_time_G1_meas->measure_G1(mc_config, *p_meas_sink, "Equal_time_G1");
       break;
 
     case Equal_time_G2:
-      p_equal_time_G2_meas->measure_G2(mc_config, measurements, "Equal_time_G2");
+      p_equal_time_G2_meas->measure_G2(mc_config, *p_meas_sink, "Equal_time_G2");
       break;
 
     default:
@@ -435,6 +485,15 @@ void HybridizationSimulation<IMP_MODEL>::measure_Z_function_space() {
     g_meas_legendre.reset();
   }
 
+  //Measure single-particle Green's function at Matsubara frequencies
+  //(in the rotated basis; rotated back in postprocessing as G1)
+  if (p_g_meas_matsubara && p_g_meas_matsubara->has_samples()) {
+    const boost::multi_array<std::complex<double>, 3> gf_matsubara =
+        p_g_meas_matsubara->get_measured_data(Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic>::Identity(FLAVORS, FLAVORS));
+    p_meas_sink->push("Greens_matsubara", gf_matsubara.origin(), gf_matsubara.num_elements());
+    p_g_meas_matsubara->reset();
+  }
+
   measurements["Sign"] << mycast<double>(mc_config.sign);
 
 }
@@ -492,7 +551,8 @@ template<typename IMP_MODEL>
 void HybridizationSimulation<IMP_MODEL>::do_one_sweep() {
   //assert(sliding_window.get_position_right_edge() == 0);
 
-  //Propose higher-order insertion/removal updates less frequently
+  //Propose higher-order insertion/removal updates less frequently.
+  //The factors of the scheduler scale the number of calls, not the probability of choosing a rank.
   std::vector<double> proposal_rates;
   {
     double p = 1.0;
@@ -504,6 +564,10 @@ void HybridizationSimulation<IMP_MODEL>::do_one_sweep() {
   boost::random::discrete_distribution<> dist(proposal_rates);
 
   const int rank_ins_rem = dist(random.engine()) + 1;
+  const int ins_rem_index = proposal_scheduler.index(ins_rem_updater[rank_ins_rem - 1]->get_name());
+  const int flavor_update_index = proposal_scheduler.index(operator_pair_flavor_updater.get_name());
+  const int shift_index = proposal_scheduler.index(single_op_shift_updater.get_name());
+  std::chrono::steady_clock::time_point t_start;
   const int current_n_window = std::max(N_win_standard / rank_ins_rem, 1);
   if (current_n_window != sliding_window.get_n_window()) {
     sliding_window.set_window_size(current_n_window, mc_config.operators, 0, ITIME_LEFT);
@@ -514,22 +578,34 @@ void HybridizationSimulation<IMP_MODEL>::do_one_sweep() {
   for (int move = 0; move < num_move; ++move) {
     double pert_order_sum = 0;
     //insertion and removal of operators hybridized with the bath
-    for (int update = 0; update < FLAVORS; ++update) {
-      ins_rem_updater[rank_ins_rem - 1]->update(random, BETA, mc_config, sliding_window);
+    const int num_ins_rem = proposal_scheduler.num_calls(ins_rem_index, FLAVORS, random);
+    t_start = std::chrono::steady_clock::now();
+    int num_accepted = 0;
+    for (int update = 0; update < num_ins_rem; ++update) {
+      num_accepted += ins_rem_updater[rank_ins_rem - 1]->update(random, BETA, mc_config, sliding_window);
       pert_order_sum += mc_config.pert_order();
     }
+    proposal_scheduler.record(ins_rem_index, num_ins_rem, num_accepted, elapsed_seconds(t_start));
 
     if (par["update.operator_pair_flavor_update"].template as<int>() != 0) {
-      for (int update = 0; update < FLAVORS; ++update) {
-        operator_pair_flavor_updater.update(random, BETA, mc_config, sliding_window);
+      const int num_updates = proposal_scheduler.num_calls(flavor_update_index, FLAVORS, random);
+      t_start = std::chrono::steady_clock::now();
+      num_accepted = 0;
+      for (int update = 0; update < num_updates; ++update) {
+        num_accepted += operator_pair_flavor_updater.update(random, BETA, mc_config, sliding_window);
       }
+      proposal_scheduler.record(flavor_update_index, num_updates, num_accepted, elapsed_seconds(t_start));
     }
 
     //shift move of operators hybridized with the bath
     if (par["update.single_operator_shift"].template as<int>() != 0) {
-      for (int update = 0; update < FLAVORS * rank_ins_rem; ++update) {
-        single_op_shift_updater.update(random, BETA, mc_config, sliding_window);
+      const int num_updates = proposal_scheduler.num_calls(shift_index, FLAVORS * rank_ins_rem, random);
+      t_start = std::chrono::steady_clock::now();
+      num_accepted = 0;
+      for (int update = 0; update < num_updates; ++update) {
+        num_accepted += single_op_shift_updater.update(random, BETA, mc_config, sliding_window);
       }
+      proposal_scheduler.record(shift_index, num_updates, num_accepted, elapsed_seconds(t_start));
     }
 
     if (is_thermalized()) {
@@ -614,7 +690,14 @@ void HybridizationSimulation<IMP_MODEL>::transition_between_config_spaces() {
     for (typename worm_updater_map_t::iterator it = worm_movers.begin(); it != worm_movers.end();
          ++it) {
       if (it->first == mc_config.current_config_space()) {
-        it->second->update(random, BETA, mc_config, sliding_window, worm_space_extra_weight_map);
+        const int index = proposal_scheduler.index(it->second->get_name());
+        const int num_updates = proposal_scheduler.num_calls(index, 1.0, random);
+        const std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+        int num_accepted = 0;
+        for (int update = 0; update < num_updates; ++update) {
+          num_accepted += it->second->update(random, BETA, mc_config, sliding_window, worm_space_extra_weight_map);
+        }
+        proposal_scheduler.record(index, num_updates, num_accepted, elapsed_seconds(t_start));
       }
     }
   }
@@ -646,10 +729,12 @@ void HybridizationSimulation<IMP_MODEL>::global_updates() {
                                                                    mc_config,
                                                                    det_vec,
                                                                    sliding_window,
+                                                                   sliding_window_scratch,
                                                                    FLAVORS,
                                                                    ExchangeFlavor(&swap_vector[iupdate].first[0]),
                                                                    WormExchangeFlavor(&swap_vector[iupdate].first[0]),
-                                                                   std::max(N_win_standard, 10)
+                                                                   std::max(N_win_standard, 10),
+                                                                   swap_trace_invariant[iupdate]
       );
 
       if (accepted) {
@@ -669,6 +754,7 @@ void HybridizationSimulation<IMP_MODEL>::global_updates() {
                                                                  mc_config,
                                                                  det_vec,
                                                                  sliding_window,
+                                                                 sliding_window_scratch,
                                                                  FLAVORS,
                                                                  OperatorShift(BETA, shift),
                                                                  WormShift(BETA, shift),
@@ -686,7 +772,10 @@ void HybridizationSimulation<IMP_MODEL>::global_updates() {
     sanity_check();
   }
 
-  sliding_window.set_window_size(n_sliding_window_bak, mc_config.operators, 0, ITIME_LEFT);
+  //The window is already built for the current configuration if the last accepted global update used the same size.
+  if (sliding_window.get_n_window() != n_sliding_window_bak) {
+    sliding_window.set_window_size(n_sliding_window_bak, mc_config.operators, 0, ITIME_LEFT);
+  }
   sanity_check();
 }
 
@@ -739,6 +828,11 @@ void HybridizationSimulation<IMP_MODEL>::update_MC_parameters() {
     it->second->update_parameters();
   }
 
+  //Update frequencies of local updates
+  if (par["update.adaptive_proposal_rates"].template as<int>() != 0) {
+    proposal_scheduler.update_factors();
+  }
+
 }
 
 /////////////////////////////////////////////////
@@ -747,6 +841,9 @@ void HybridizationSimulation<IMP_MODEL>::update_MC_parameters() {
 template<typename IMP_MODEL>
 void HybridizationSimulation<IMP_MODEL>::prepare_for_measurement() {
   g_meas_legendre.reset();
+  if (p_g_meas_matsubara) {
+    p_g_meas_matsubara->reset();
+  }
   single_op_shift_updater.finalize_learning();
   for (int k = 1; k < par["update.multi_pair_ins_rem"].template as<int>() + 1; ++k) {
     ins_rem_updater[k - 1]->finalize_learning();
@@ -763,11 +860,16 @@ void HybridizationSimulation<IMP_MODEL>::prepare_for_measurement() {
        it != specialized_updaters.end(); ++it) {
     it->second->finalize_learning();
   }
+  proposal_scheduler.freeze();
 
   if (comm.rank() == 0) {
     std::cout << "Thermalization process done after " << sweeps << " steps." << std::endl;
     std::cout << "The number of segments for sliding window update is " << N_win_standard << "."
               << std::endl;
+    std::cout << "Relative frequencies of local updates are the following:" << std::endl;
+    for (int update = 0; update < proposal_scheduler.num_updates(); ++update) {
+      std::cout << " " << proposal_scheduler.get_name(update) << " " << proposal_scheduler.factor(update) << std::endl;
+    }
     std::cout << "Perturbation orders (averaged over processes) are the following:" << std::endl;
   }
   const std::vector<int> &order_creation_flavor = count_creation_operators(FLAVORS, mc_config);
@@ -807,6 +909,8 @@ void HybridizationSimulation<IMP_MODEL>::prepare_for_measurement() {
 
 template<typename IMP_MODEL>
 void HybridizationSimulation<IMP_MODEL>::finish_measurement() {
+  //Wait for the background thread before the accumulators are collected
+  p_meas_sink->flush();
   measurements["Pert_order_end"] << pert_order_recorder.mean();
   if (!is_thermalized()) {
     throw std::runtime_error("Thermalization process is not done.");
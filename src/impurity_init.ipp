@@ -2,6 +2,8 @@
 
 template<typename IMP_MODEL>
 void HybridizationSimulation<IMP_MODEL>::create_observables() {
+  p_meas_sink.reset(new AsyncObservableSink(measurements));
+
   // create measurement objects
   create_observable<COMPLEX, SimpleRealVectorObservable>(measurements, "Greens_legendre");
   create_observable<COMPLEX, SimpleRealVectorObservable>(measurements, "Greens_legendre_rotated");
@@ -30,20 +32,57 @@ void HybridizationSimulation<IMP_MODEL>::create_observables() {
         "worm_space_num_steps_" + get_config_space_name(worm_types[w]));
   }
 
+  //Large vector observables are summed up in p_meas_sink if they are reduced by reduce_packed_observables()
+  const bool packed_reduction = par["measurement.packed_reduction"] != 0;
+  if (packed_reduction && comm.rank() == 0) {
+    std::cout << "Warning: G1, G2, two-time G2 and G(i omega_n) are reduced by measurement.packed_reduction. "
+              << "They are not written to /simulation/results and have no error bars." << std::endl;
+  }
   if (par["measurement.two_time_G2.on"] != 0) {
-    create_observable<COMPLEX, SimpleRealVectorObservable>(measurements, "Two_time_G2");
+    if (packed_reduction) {
+      const int n_legendre = par["measurement.two_time_G2.n_legendre"];
+      p_meas_sink->create_local_observable("Two_time_G2", FLAVORS * FLAVORS * FLAVORS * FLAVORS * n_legendre);
+      packed_observables.push_back("Two_time_G2");
+    } else {
+      create_observable<COMPLEX, SimpleRealVectorObservable>(measurements, "Two_time_G2");
+    }
   }
   if (p_G1_meas) {
-    p_G1_meas->create_alps_observable(measurements);
+    if (packed_reduction) {
+      p_G1_meas->create_local_observable(*p_meas_sink);
+      packed_observables.push_back("G1");
+    } else {
+      p_G1_meas->create_alps_observable(measurements);
+    }
   }
   if (p_G2_meas) {
-    p_G2_meas->create_alps_observable(measurements);
+    if (par["measurement.G2.streaming_output"] != 0) {
+      p_G2_meas->create_local_observable(*p_meas_sink);
+    } else if (packed_reduction) {
+      p_G2_meas->create_local_observable(*p_meas_sink);
+      packed_observables.push_back("G2");
+      if (par["measurement.G2.improved_estimator"] != 0) {
+        packed_observables.push_back("G2_improved");
+      }
+    } else {
+      p_G2_meas->create_alps_observable(measurements);
+    }
   }
 
   if (par["measurement.equal_time_G1.on"] != 0) {
     create_observable<COMPLEX, SimpleRealVectorObservable>(measurements, "Equal_time_G1");
   }
 
+  if (par["measurement.G1.matsubara_nfft"] != 0) {
+    if (packed_reduction) {
+      const int n_matsubara = par["measurement.G1.n_matsubara"];
+      p_meas_sink->create_local_observable("Greens_matsubara", FLAVORS * FLAVORS * n_matsubara);
+      packed_observables.push_back("Greens_matsubara");
+    } else {
+      create_observable<COMPLEX, SimpleRealVectorObservable>(measurements, "Greens_matsubara");
+    }
+  }
+
   if (par["measurement.equal_time_G2.on"] != 0) {
     create_observable<COMPLEX, SimpleRealVectorObservable>(measurements, "Equal_time_G2");
   }
@@ -131,12 +170,26 @@ void HybridizationSimulation<IMP_MODEL>::create_worm_updaters() {
             )
         )
     );
+    //Only flavor combinations conserving the number of electrons in each block of the hybridization function are stored
+    //if the number is conserved by the local Hamiltonian as well
+    std::vector<std::vector<int> > conserved_flavor_groups;
+    for (int block = 0; block < mc_config.M.num_blocks(); ++block) {
+      if (p_model->conserves_num_electrons(mc_config.M.flavors(block))) {
+        conserved_flavor_groups.push_back(mc_config.M.flavors(block));
+      }
+    }
     p_G2_meas.reset(
         new GMeasurement<SCALAR, 2>(FLAVORS,
                                     par["measurement.G2.n_legendre"], par["measurement.G2.n_bosonic_freq"], BETA,
-                                    par["measurement.G2.max_num_data_accumulated"]
+                                    par["measurement.G2.max_num_data_accumulated"],
+                                    par["measurement.G2.improved_estimator"] != 0,
+                                    conserved_flavor_groups
         )
     );
+    if (comm.rank() == 0 && verbose) {
+      std::cout << "Number of flavor combinations stored for G2: "
+                << p_G2_meas->get_flavor_index_map().num_combinations() << std::endl;
+    }
     specialized_updaters["G2_ins_rem_hyb"] =
         boost::shared_ptr<LocalUpdaterType>(
             new G2WormInsertionRemoverType(
@@ -182,7 +235,7 @@ void HybridizationSimulation<IMP_MODEL>::create_worm_updaters() {
         )
     );
     p_equal_time_G1_meas.reset(
-        new EqualTimeGMeasurement<SCALAR, 1>(FLAVORS)
+        new EqualTimeGMeasurement<SCALAR, 1>(FLAVORS, par["measurement.equal_time_G1.max_num_data_accumulated"])
     );
   }
 
@@ -203,7 +256,7 @@ void HybridizationSimulation<IMP_MODEL>::create_worm_updaters() {
         )
     );
     p_equal_time_G2_meas.reset(
-        new EqualTimeGMeasurement<SCALAR, 2>(FLAVORS)
+        new EqualTimeGMeasurement<SCALAR, 2>(FLAVORS, par["measurement.equal_time_G2.max_num_data_accumulated"])
     );
   }
 
@@ -339,10 +392,17 @@ void HybridizationSimulation<IMP_MODEL>::resize_vectors() {
     }
     swap_acc_rate.resize(swap_vector.size());
 
+    //The trace needs not be computed for swaps which leave the local Hamiltonian invariant.
+    swap_trace_invariant.resize(swap_vector.size());
+    for (int i = 0; i < swap_vector.size(); ++i) {
+      swap_trace_invariant[i] = p_model->is_invariant_under_flavor_exchange(&swap_vector[i].first[0]);
+    }
+
     if (comm.rank() == 0) {
       std::cout << "The following swap updates will be performed." << std::endl;
       for (int i = 0; i < swap_vector.size(); ++i) {
-        std::cout << "Update #" << i << " generated from template #" << swap_vector[i].second << std::endl;
+        std::cout << "Update #" << i << " generated from template #" << swap_vector[i].second
+                  << (swap_trace_invariant[i] ? " (symmetry of the local Hamiltonian)" : "") << std::endl;
         for (int j = 0; j < swap_vector[i].first.size(); ++j) {
           std::cout << "flavor " << j << " to flavor " << swap_vector[i].first[j] << std::endl;
         }
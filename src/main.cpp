@@ -12,6 +12,8 @@
  *
  *************************************************************************************/
 
+#include <boost/scoped_ptr.hpp>
+
 #include "hdf5/boost_any.hpp"
 #include "solver.hpp"
 
@@ -47,18 +49,21 @@ int main(int argc, const char *argv[]) {
   p_solver->solve();
 
   //write the results into a hdf5 file
+  boost::scoped_ptr<alps::hdf5::archive> p_ar;
   if (c.rank() == 0) {
     std::string output_file = par["outputfile"];
-    alps::hdf5::archive ar(output_file, "w");
-    ar["/parameters"] << par;
-    ar["/simulation/results"] << p_solver->get_accumulated_results();
+    p_ar.reset(new alps::hdf5::archive(output_file, "w"));
+    (*p_ar)["/parameters"] << par;
+    (*p_ar)["/simulation/results"] << p_solver->get_accumulated_results();
     {
       const std::map<std::string,boost::any> &results = p_solver->get_results();
       for (std::map<std::string,boost::any>::const_iterator it = results.begin(); it != results.end(); ++it) {
-        ar["/" + it->first] << it->second;
+        (*p_ar)["/" + it->first] << it->second;
       }
     }
   }
+  //results reduced over processes chunk by chunk (called on all processes)
+  p_solver->write_streamed_results(p_ar.get());
 
   return 0;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <typeinfo>
+#include <map>
 
 #include <alps/fastupdate/determinant_matrix_partitioned.hpp>
 
@@ -10,29 +11,43 @@
 #include "./sliding_window/sliding_window.hpp"
 #include "worm.hpp"
 
+/**
+ * @brief Hybridization function F_{ab}(tau) interpolated on a mesh of n_tau intervals
+ *
+ * Not thread-safe: fill_block(), fill_column(), fill_row() and is_invariant_under_flavor_exchange() are const
+ * but write to mutable work space and a cache. An object may be shared (e.g., by the configurations of a Markov chain)
+ * only by code running on a single thread.
+ */
 template<typename SCALAR>
 class HybridizationFunction {
  private:
   typedef boost::multi_array<SCALAR, 3> container_t;
 
  public:
-  HybridizationFunction(double BETA, int n_tau, int n_flavors, const container_t &F, double eps = 1e-10) :
+  HybridizationFunction(double BETA, int n_tau, int n_flavors, const container_t &F, double eps = 1e-10,
+                        bool cubic_interpolation = false) :
       BETA_(BETA),
-      F_(F),
       n_tau_(n_tau),
       n_flavors_(n_flavors),
-      connected_(boost::extents[n_flavors_][n_flavors_]) {
-    assert(F_[0][0].size() == n_tau + 1);
+      cubic_(cubic_interpolation && n_tau >= 3),
+      num_coeff_(cubic_ ? 4 : 2),
+      pair_index_(boost::extents[n_flavors_][n_flavors_]),
+      connected_pairs_(),
+      table_() {
+    assert(F[0][0].size() == n_tau + 1);
     for (int flavor = 0; flavor < n_flavors; ++flavor) {
       for (int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
-        connected_[flavor][flavor2] = false;
+        pair_index_[flavor][flavor2] = -1;
         for (int itau = 0; itau < n_tau + 1; ++itau) {
           if (std::abs(F[flavor][flavor2][itau]) > eps) {
-            connected_[flavor][flavor2] = true;
+            pair_index_[flavor][flavor2] = connected_pairs_.size();
+            connected_pairs_.push_back(std::make_pair(flavor, flavor2));
+            break;
           }
         }
       }
     }
+    init_table(F);
   }
 
   int num_flavors() const { return n_flavors_; }
@@ -46,20 +61,246 @@ class HybridizationFunction {
     }
 
     double n = t / BETA_ * n_tau_;
-    int n_lower = (int) n;
-    const SCALAR *pF = &F_[c_op.flavor()][cdagger_op.flavor()][0];
-    return sign * (pF[n_lower] + (n - n_lower) * (pF[n_lower + 1] - pF[n_lower]));
+    int n_lower = std::min((int) n, n_tau_ - 1);
+    return sign * eval(c_op.flavor(), cdagger_op.flavor(), n_lower, n - n_lower);
+  }
+
+  /**
+   * @brief Fill mat(i, j) = F(c_ops[i], cdagg_ops[j]) for all pairs of the given operators.
+   *
+   * Equivalent to calling operator() for each element, but the times and flavors of the annihilation operators
+   * are gathered once into contiguous arrays and each column is interpolated by a branch-free loop.
+   */
+  template<typename COpIterator, typename CdaggOpIterator, typename MAT>
+  void fill_block(COpIterator c_first, COpIterator c_last,
+                  CdaggOpIterator cdagg_first, CdaggOpIterator cdagg_last,
+                  MAT &mat) const {
+    const int n_rows = gather(c_first, c_last, c_times_, c_flavors_);
+    int col = 0;
+    for (CdaggOpIterator it = cdagg_first; it != cdagg_last; ++it, ++col) {
+      interpolate_column(n_rows, it->time().time(), it->flavor());
+      for (int row = 0; row < n_rows; ++row) {
+        mat(row, col) = values_[row];
+      }
+    }
+  }
+
+  /**
+   * @brief Fill col[i] = F(c_ops[i], cdagger_op)
+   */
+  template<typename COpIterator, typename VEC>
+  void fill_column(COpIterator c_first, COpIterator c_last, const psi &cdagger_op, VEC &col) const {
+    const int n_rows = gather(c_first, c_last, c_times_, c_flavors_);
+    interpolate_column(n_rows, cdagger_op.time().time(), cdagger_op.flavor());
+    for (int row = 0; row < n_rows; ++row) {
+      col[row] = values_[row];
+    }
+  }
+
+  /**
+   * @brief Fill row[j] = F(c_op, cdagg_ops[j])
+   */
+  template<typename CdaggOpIterator, typename VEC>
+  void fill_row(const psi &c_op, CdaggOpIterator cdagg_first, CdaggOpIterator cdagg_last, VEC &row) const {
+    const int n_cols = gather(cdagg_first, cdagg_last, c_times_, c_flavors_);
+    interpolate_row(n_cols, c_op.time().time(), c_op.flavor());
+    for (int col = 0; col < n_cols; ++col) {
+      row[col] = values_[col];
+    }
   }
 
   bool is_connected(int flavor1, int flavor2) const {
-    return connected_[flavor1][flavor2];
+    return pair_index_[flavor1][flavor2] >= 0;
+  }
+
+  /**
+   * @brief Sparsity map of the hybridization function
+   *
+   * Element (flavor1, flavor2) is the position of the pair in connected_pairs(), or -1 if the pair is not connected.
+   * DeterminantMatrixPartitioned detects blocks through is_connected(), which is a single lookup in this map.
+   */
+  const boost::multi_array<int, 2> &pair_index() const { return pair_index_; }
+
+  /**
+   * @brief List of (c flavor, c^dagger flavor) pairs connected by the hybridization function
+   */
+  const std::vector<std::pair<int, int> > &connected_pairs() const { return connected_pairs_; }
+
+  bool cubic_interpolation() const { return cubic_; }
+
+  /**
+   * @brief Return true if F_{ab}(tau) = F_{flavor_map[a], flavor_map[b]}(tau) for all a, b
+   *
+   * Results are cached because the same exchanges are tried repeatedly in global updates.
+   */
+  bool is_invariant_under_flavor_exchange(const int *flavor_map, double eps = 1e-12) const {
+    const std::vector<int> key(flavor_map, flavor_map + n_flavors_);
+    typename std::map<std::vector<int>, bool>::const_iterator it = invariance_cache_.find(key);
+    if (it != invariance_cache_.end()) {
+      return it->second;
+    }
+
+    double max_abs = 0.0;
+    for (int i = 0; i < table_.size(); ++i) {
+      max_abs = std::max(max_abs, static_cast<double>(std::abs(table_[i])));
+    }
+    bool invariant = true;
+    for (int flavor = 0; flavor < n_flavors_ && invariant; ++flavor) {
+      for (int flavor2 = 0; flavor2 < n_flavors_ && invariant; ++flavor2) {
+        const int pair = pair_index_[flavor][flavor2];
+        const int pair_new = pair_index_[flavor_map[flavor]][flavor_map[flavor2]];
+        if ((pair < 0) != (pair_new < 0)) {
+          invariant = false;
+        } else if (pair >= 0) {
+          for (int i = 0; i < n_tau_ * num_coeff_; ++i) {
+            if (std::abs(table_[pair * n_tau_ * num_coeff_ + i] - table_[pair_new * n_tau_ * num_coeff_ + i])
+                > eps * max_abs) {
+              invariant = false;
+              break;
+            }
+          }
+        }
+      }
+    }
+    invariance_cache_[key] = invariant;
+    return invariant;
   }
 
  private:
+  template<typename Iterator>
+  static int gather(Iterator first, Iterator last, std::vector<double> &times, std::vector<int> &flavors) {
+    times.resize(0);
+    flavors.resize(0);
+    for (Iterator it = first; it != last; ++it) {
+      times.push_back(it->time().time());
+      flavors.push_back(it->flavor());
+    }
+    return times.size();
+  }
+
+  //values_[i] = F(t_c[i] - t_cdagg; flavors_c[i], flavor_cdagg)
+  void interpolate_column(int n, double t_cdagg, int flavor_cdagg) const {
+    values_.resize(n);
+    pos_.resize(n);
+    sign_.resize(n);
+    for (int i = 0; i < n; ++i) {
+      const double t = c_times_[i] - t_cdagg;
+      const bool negative = t < 0;
+      sign_[i] = negative ? -1.0 : 1.0;
+      pos_[i] = (negative ? t + BETA_ : t) * (n_tau_ / BETA_);
+    }
+    for (int i = 0; i < n; ++i) {
+      const int n_lower = std::min(static_cast<int>(pos_[i]), n_tau_ - 1);
+      values_[i] = sign_[i] * eval(c_flavors_[i], flavor_cdagg, n_lower, pos_[i] - n_lower);
+    }
+  }
+
+  //values_[j] = F(t_c - t_cdagg[j]; flavor_c, flavors_cdagg[j])
+  void interpolate_row(int n, double t_c, int flavor_c) const {
+    values_.resize(n);
+    pos_.resize(n);
+    sign_.resize(n);
+    for (int j = 0; j < n; ++j) {
+      const double t = t_c - c_times_[j];
+      const bool negative = t < 0;
+      sign_[j] = negative ? -1.0 : 1.0;
+      pos_[j] = (negative ? t + BETA_ : t) * (n_tau_ / BETA_);
+    }
+    for (int j = 0; j < n; ++j) {
+      const int n_lower = std::min(static_cast<int>(pos_[j]), n_tau_ - 1);
+      values_[j] = sign_[j] * eval(flavor_c, c_flavors_[j], n_lower, pos_[j] - n_lower);
+    }
+  }
+
+  /**
+   * Interpolation on the interval [n_lower, n_lower+1] of the mesh. Only connected flavor pairs are stored.
+   * The table holds (F(n), F(n+1)-F(n)) for linear interpolation, i.e., a single multiply-add per evaluation.
+   */
+  inline SCALAR eval(int flavor_c, int flavor_cdagg, int n_lower, double dx) const {
+    const int pair = pair_index_[flavor_c][flavor_cdagg];
+    if (pair < 0) {
+      return 0.0;
+    }
+    const SCALAR *pc = &table_[(pair * n_tau_ + n_lower) * num_coeff_];
+    if (cubic_) {
+      return pc[0] + dx * (pc[1] + dx * (pc[2] + dx * pc[3]));
+    }
+    return pc[0] + dx * pc[1];
+  }
+
+  void init_table(const container_t &F) {
+    const int num_pairs = connected_pairs_.size();
+    table_.resize(num_pairs * n_tau_ * num_coeff_);
+    if (!cubic_) {
+      for (int pair = 0; pair < num_pairs; ++pair) {
+        const int flavor = connected_pairs_[pair].first, flavor2 = connected_pairs_[pair].second;
+        for (int n = 0; n < n_tau_; ++n) {
+          table_[(pair * n_tau_ + n) * 2] = F[flavor][flavor2][n];
+          table_[(pair * n_tau_ + n) * 2 + 1] = F[flavor][flavor2][n + 1] - F[flavor][flavor2][n];
+        }
+      }
+      return;
+    }
+
+    /*
+     * Coefficients of the four-point Lagrange interpolation on each interval [n, n+1],
+     * expanded in powers of dx = tau/beta * n_tau - n. The stencil is n-1, ..., n+2 except at the edges of [0, beta],
+     * where it is shifted inwards because F(tau) is discontinuous at tau=0 and tau=beta.
+     */
+    for (int n = 0; n < n_tau_; ++n) {
+      const int first = std::max(0, std::min(n - 1, n_tau_ - 3));
+      //poly[k][p]: coefficient of dx^p of the k-th Lagrange basis polynomial
+      double poly[4][4];
+      for (int k = 0; k < 4; ++k) {
+        double coeff[4] = {1.0, 0.0, 0.0, 0.0};
+        double denom = 1.0;
+        int order = 0;
+        const double x_k = first + k - n;
+        for (int m = 0; m < 4; ++m) {
+          if (m == k) {
+            continue;
+          }
+          const double x_m = first + m - n;
+          //multiply by (dx - x_m)
+          for (int p = order + 1; p > 0; --p) {
+            coeff[p] = coeff[p - 1] - x_m * coeff[p];
+          }
+          coeff[0] *= -x_m;
+          ++order;
+          denom *= x_k - x_m;
+        }
+        for (int p = 0; p < 4; ++p) {
+          poly[k][p] = coeff[p] / denom;
+        }
+      }
+      for (int pair = 0; pair < num_pairs; ++pair) {
+        const int flavor = connected_pairs_[pair].first, flavor2 = connected_pairs_[pair].second;
+        for (int p = 0; p < 4; ++p) {
+          SCALAR sum = 0.0;
+          for (int k = 0; k < 4; ++k) {
+            sum += poly[k][p] * F[flavor][flavor2][first + k];
+          }
+          table_[(pair * n_tau_ + n) * 4 + p] = sum;
+        }
+      }
+    }
+  }
+
   double BETA_;
   int n_tau_, n_flavors_;
-  container_t F_;
-  boost::multi_array<bool, 2> connected_;
+  bool cubic_;
+  int num_coeff_;
+  boost::multi_array<int, 2> pair_index_;
+  std::vector<std::pair<int, int> > connected_pairs_;
+  //[pair][interval][coefficient]
+  std::vector<SCALAR> table_;
+
+  mutable std::map<std::vector<int>, bool> invariance_cache_;
+
+  //work space for batch evaluation (overwritten by every call to fill_block, fill_column and fill_row)
+  mutable std::vector<double> c_times_, pos_, sign_;
+  mutable std::vector<int> c_flavors_;
+  mutable std::vector<SCALAR> values_;
 };
 
 
@@ -121,7 +362,7 @@ void MonteCarloConfiguration<SCALAR>::sanity_check(SW &sliding_window) {
   operators2.insert(M.get_cdagg_ops().begin(), M.get_cdagg_ops().end());
   operators2.insert(M.get_c_ops().begin(), M.get_c_ops().end());
   if (p_worm) {
-    std::vector<psi> worm_ops = p_worm->get_operators();
+    const worm_operators_t &worm_ops = p_worm->get_operators();
     operators2.insert(worm_ops.begin(), worm_ops.end());
   }
   if (operators2 != operators) {
@@ -180,7 +421,7 @@ int compute_permutation_sign(
     const MonteCarloConfiguration<SCALAR> &mc_config
 ) {
 
-  const std::vector<psi> &worm_ops = mc_config.p_worm ? mc_config.p_worm->get_operators() : std::vector<psi>();
+  const worm_operators_t worm_ops = mc_config.p_worm ? mc_config.p_worm->get_operators() : worm_operators_t();
   return compute_permutation_sign_impl(mc_config.M.get_cdagg_ops(),
                                        mc_config.M.get_c_ops(),
                                        worm_ops
@@ -190,7 +431,7 @@ int compute_permutation_sign(
 inline int compute_permutation_sign_impl(
     const std::vector<psi>& cdagg_ops,
     const std::vector<psi>& c_ops,
-    const std::vector<psi>& worm_ops
+    const worm_operators_t& worm_ops
 ) {
   std::vector<OperatorTime> times_work, work1, work2;
   const int pert_order = cdagg_ops.size();
@@ -209,7 +450,7 @@ inline int compute_permutation_sign_impl(
     times_work.push_back(work2[p]);
     times_work.push_back(work1[p]);
   }
-  for (std::vector<psi>::const_iterator it = worm_ops.begin(); it != worm_ops.end(); ++it) {
+  for (worm_operators_t::const_iterator it = worm_ops.begin(); it != worm_ops.end(); ++it) {
     times_work.push_back(it->time());
   }
   const int perm_sign = alps::fastupdate::comb_sort(
@@ -228,7 +469,7 @@ int num_ops_less_than(const S &ops, const T &t) {
 //between the operators of a worm and operators hybridized with the batCount the number of exchanges between the operators of a worm and operators hybridized with the bath
 template<typename S>
 long count_worm_op_exchange(const S &ops,
-                            const std::vector<psi> &worm_ops) {
+                            const worm_operators_t &worm_ops) {
   long count = 0;
   for (int iop = 0; iop < worm_ops.size(); ++iop) {
     count += num_ops_less_than(ops, worm_ops[iop]);
@@ -237,62 +478,87 @@ long count_worm_op_exchange(const S &ops,
 }
 
 
-// Compute the change of the permutation sign (+/-) from the time-ordering of
-// c^dagger_0 c_0  c^dagger_1 c_1 ... c^dagger_N c_N,
-// where creation and annihilation operators are already time-ordered, respectively.
-template<typename SCALAR>
+//The number of operators in an unsorted container whose times are less than or equal to t.
+template<typename C, typename T>
+int num_ops_less_than_unsorted(const C &ops, const T &t) {
+  int count = 0;
+  for (typename C::const_iterator it = ops.begin(); it != ops.end(); ++it) {
+    if (!(t < *it)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+// Compute the change of the permutation sign (+/-) defined in compute_permutation_sign by a local update.
+// The permutation sign is (-1)^P with
+//   P = N(N-1)/2 + #{(c, c^dagger) | t_{c^dagger} > t_c} + sum_W #{hybridized operators earlier than W} + (exchanges among W),
+// where N is the perturbation order.
+// Only the parity of P is needed. Thus, the change of P is computed by rank queries in the time-ordered sets
+// of the operators hybridized with the bath after the update in O(k log N) operations,
+// where k is the number of operators removed or added.
+template<typename CdaggSet, typename CSet>
 int compute_permutation_sign_change(
-    const operator_container_t &cdagg_ops_old,
-    const operator_container_t &c_ops_old,
+    const CdaggSet &cdagg_ops_new,
+    const CSet &c_ops_new,
     const std::vector<psi> &cdagg_ops_rem,
     const std::vector<psi> &c_ops_rem,
     const std::vector<psi> &cdagg_ops_add,
-    const std::vector<psi> &c_ops_add
-    //const Worm &worm_old,
-    //const Worm &worm_new
+    const std::vector<psi> &c_ops_add,
+    const worm_operators_t &worm_ops_old,
+    const worm_operators_t &worm_ops_new
 ) {
-  namespace bll = boost::lambda;
   typedef std::vector<psi>::const_iterator IteratorType;
 
-  std::set<OperatorTime> cdagg_time_changed, c_time_changed;
-
+  //removed and added operators contribute to the parity in the same way
   long count_exchange = 0;
-  for (IteratorType it = cdagg_ops_rem.begin(); it != cdagg_ops_rem.end(); ++it) {
-    count_exchange += num_ops_less_than(c_ops_old, it->time());
-    count_exchange += num_ops_less_than(c_time_changed, it->time());
-    cdagg_time_changed.insert(it->time());
-  }
 
-  for (IteratorType it = c_ops_rem.begin(); it != c_ops_rem.end(); ++it) {
-    count_exchange += num_ops_less_than(cdagg_ops_old, it->time());
-    count_exchange += num_ops_less_than(cdagg_time_changed, it->time());
-    c_time_changed.insert(it->time());
+  //N(N-1)/2
+  const long pert_order_new = cdagg_ops_new.size();
+  const long pert_order_old = pert_order_new + cdagg_ops_rem.size() - cdagg_ops_add.size();
+  count_exchange += pert_order_new * (pert_order_new - 1) / 2 + pert_order_old * (pert_order_old - 1) / 2;
+
+  //pairs of c and c^dagger:
+  // #{c^dagger in D_rem/D_add later than c in C_new} and #{c^dagger in D_old later than c in C_rem/C_add},
+  // where D_old = D_new - D_add + D_rem.
+  const std::vector<psi> *cdagg_ops_changed[] = {&cdagg_ops_rem, &cdagg_ops_add};
+  const std::vector<psi> *c_ops_changed[] = {&c_ops_rem, &c_ops_add};
+  for (int i = 0; i < 2; ++i) {
+    for (IteratorType it = cdagg_ops_changed[i]->begin(); it != cdagg_ops_changed[i]->end(); ++it) {
+      count_exchange += num_ops_less_than(c_ops_new, it->time());
+    }
+    for (IteratorType it = c_ops_changed[i]->begin(); it != c_ops_changed[i]->end(); ++it) {
+      count_exchange += pert_order_old
+          + num_ops_less_than(cdagg_ops_new, it->time())
+          + num_ops_less_than_unsorted(cdagg_ops_rem, it->time())
+          + num_ops_less_than_unsorted(cdagg_ops_add, it->time());
+    }
   }
 
-  for (IteratorType it = cdagg_ops_add.begin(); it != cdagg_ops_add.end(); ++it) {
-    count_exchange += num_ops_less_than(c_ops_old, it->time());
-    count_exchange += num_ops_less_than(c_time_changed, it->time());
-    cdagg_time_changed.insert(it->time());
+  //exchanges between hybridized operators and worm operators
+  count_exchange += count_worm_op_exchange(cdagg_ops_new, worm_ops_new);
+  count_exchange += count_worm_op_exchange(c_ops_new, worm_ops_new);
+  count_exchange += count_worm_op_exchange(cdagg_ops_new, worm_ops_old);
+  count_exchange += count_worm_op_exchange(c_ops_new, worm_ops_old);
+  for (int iop = 0; iop < worm_ops_old.size(); ++iop) {
+    for (int i = 0; i < 2; ++i) {
+      count_exchange += num_ops_less_than_unsorted(*cdagg_ops_changed[i], worm_ops_old[iop].time());
+      count_exchange += num_ops_less_than_unsorted(*c_ops_changed[i], worm_ops_old[iop].time());
+    }
   }
 
-  for (IteratorType it = c_ops_add.begin(); it != c_ops_add.end(); ++it) {
-    count_exchange += num_ops_less_than(cdagg_ops_old, it->time());
-    count_exchange += num_ops_less_than(cdagg_time_changed, it->time());
-    c_time_changed.insert(it->time());
+  //exchanges among worm operators
+  const worm_operators_t *worm_ops[] = {&worm_ops_old, &worm_ops_new};
+  for (int i = 0; i < 2; ++i) {
+    for (int iop = 0; iop < worm_ops[i]->size(); ++iop) {
+      for (int iop2 = iop + 1; iop2 < worm_ops[i]->size(); ++iop2) {
+        if ((*worm_ops[i])[iop].time() < (*worm_ops[i])[iop2].time()) {
+          ++count_exchange;
+        }
+      }
+    }
   }
 
-  /*
-  const std::vector<psi> &worm_ops_old = worm_old.get_operators();
-  count_exchange += count_worm_op_exchange(cdagg_ops_old, worm_ops_old);
-  count_exchange += count_worm_op_exchange(c_ops_old, worm_ops_old);
-
-  const std::vector<psi> &worm_ops_new = worm_new.get_operators();
-  count_exchange += count_worm_op_exchange(cdagg_ops_old, worm_ops_new);
-  count_exchange += count_worm_op_exchange(cdagg_time_changed, worm_ops_new);
-  count_exchange += count_worm_op_exchange(c_ops_old, worm_ops_new);
-  count_exchange += count_worm_op_exchange(c_time_changed, worm_ops_new);
-  */
-
   return count_exchange % 2 == 0 ? 1 : -1;
 }
 
@@ -0,0 +1,198 @@
+#include "async_observable_sink.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+
+AsyncObservableSink::AsyncObservableSink(observableset_t &measurements)
+    : measurements_(measurements),
+      busy_(false),
+      stop_(false),
+      thread_(&AsyncObservableSink::run, this) {
+}
+
+AsyncObservableSink::~AsyncObservableSink() {
+  flush();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_pending_.notify_all();
+  thread_.join();
+  for (int i = 0; i < all_buffers_.size(); ++i) {
+    delete all_buffers_[i];
+  }
+}
+
+void AsyncObservableSink::push(const std::string &obs_name, const std::complex<double> *data, std::size_t size,
+                               double scale) {
+  Buffer *p_buffer;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<Buffer *> &free_buffers = free_buffers_[obs_name];
+    int &num_buffers = num_buffers_[obs_name];
+    if (free_buffers.empty() && num_buffers < num_buffers_per_obs) {
+      all_buffers_.push_back(new Buffer());
+      all_buffers_.back()->obs_name = obs_name;
+      free_buffers.push_back(all_buffers_.back());
+      ++num_buffers;
+    }
+    while (free_buffers.empty()) {
+      cond_free_.wait(lock);
+    }
+    p_buffer = free_buffers.back();
+    free_buffers.pop_back();
+  }
+
+  //copy outside the lock so that the background thread can proceed
+  p_buffer->data.assign(data, data + size);
+  p_buffer->scale = scale;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(p_buffer);
+  }
+  cond_pending_.notify_one();
+}
+
+void AsyncObservableSink::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!pending_.empty() || busy_) {
+    cond_free_.wait(lock);
+  }
+}
+
+void AsyncObservableSink::create_local_observable(const std::string &obs_name, std::size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  LocalObservable &obs = local_observables_[obs_name];
+  obs.sum.resize(0);
+  obs.sum.resize(size, 0.0);
+  obs.count = 0;
+}
+
+const AsyncObservableSink::LocalObservable &
+AsyncObservableSink::get_local_observable(const std::string &obs_name) const {
+  std::map<std::string, LocalObservable>::const_iterator it = local_observables_.find(obs_name);
+  if (it == local_observables_.end()) {
+    throw std::runtime_error("Local observable " + obs_name + " does not exist.");
+  }
+  return it->second;
+}
+
+const std::vector<std::complex<double> > &AsyncObservableSink::get_local_sum(const std::string &obs_name) const {
+  return get_local_observable(obs_name).sum;
+}
+
+void AsyncObservableSink::take_local_sum(const std::string &obs_name, std::vector<std::complex<double> > &sum) {
+  get_local_observable(obs_name);
+  std::vector<std::complex<double> >().swap(sum);
+  sum.swap(local_observables_[obs_name].sum);
+}
+
+long AsyncObservableSink::get_local_count(const std::string &obs_name) const {
+  return get_local_observable(obs_name).count;
+}
+
+std::map<std::string, std::vector<std::complex<double> > >
+AsyncObservableSink::reduce_local_observables(const alps::mpi::communicator &comm,
+                                              const std::vector<std::string> &names,
+                                              int root, int max_count) const {
+  //pack the sums of all the observables followed by their numbers of data
+  std::size_t size = names.size();
+  for (int i = 0; i < names.size(); ++i) {
+    size += get_local_observable(names[i]).sum.size();
+  }
+  std::vector<std::complex<double> > buffer;
+  buffer.reserve(size);
+  for (int i = 0; i < names.size(); ++i) {
+    const std::vector<std::complex<double> > &sum = get_local_observable(names[i]).sum;
+    buffer.insert(buffer.end(), sum.begin(), sum.end());
+  }
+  for (int i = 0; i < names.size(); ++i) {
+    buffer.push_back(static_cast<double>(get_local_observable(names[i]).count));
+  }
+
+  //One MPI_Reduce unless the buffer exceeds the limit of the int count argument
+  const bool is_root = (comm.rank() == root);
+  const std::size_t num_doubles = 2 * buffer.size();
+  const std::size_t max_chunk = max_count;
+  double *p_data = reinterpret_cast<double *>(buffer.data());
+  for (std::size_t offset = 0; offset < num_doubles; offset += max_chunk) {
+    const int count = static_cast<int>(std::min(max_chunk, num_doubles - offset));
+    MPI_Reduce(is_root ? MPI_IN_PLACE : (void *) (p_data + offset), is_root ? (void *) (p_data + offset) : NULL,
+               count, MPI_DOUBLE, MPI_SUM, root, comm);
+  }
+
+  std::map<std::string, std::vector<std::complex<double> > > means;
+  if (!is_root) {
+    return means;
+  }
+  std::vector<std::complex<double> >::const_iterator it = buffer.begin();
+  for (int i = 0; i < names.size(); ++i) {
+    const std::size_t size_obs = get_local_observable(names[i]).sum.size();
+    const double num_data = buffer[buffer.size() - names.size() + i].real();
+    std::vector<std::complex<double> > &mean = means[names[i]];
+    mean.assign(it, it + size_obs);
+    if (num_data > 0) {
+      for (int j = 0; j < size_obs; ++j) {
+        mean[j] /= num_data;
+      }
+    }
+    it += size_obs;
+  }
+  return means;
+}
+
+void AsyncObservableSink::run() {
+  std::vector<double> work;
+  while (true) {
+    Buffer *p_buffer;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (pending_.empty() && !stop_) {
+        cond_pending_.wait(lock);
+      }
+      if (pending_.empty()) {
+        return;
+      }
+      p_buffer = pending_.front();
+      pending_.pop_front();
+      busy_ = true;
+    }
+
+    //Only this thread accesses the accumulators of the observables passed through this class.
+    //local_observables_ is not modified while data are being pushed.
+    const std::vector<std::complex<double> > &data = p_buffer->data;
+    std::map<std::string, LocalObservable>::iterator it_local = local_observables_.find(p_buffer->obs_name);
+    if (it_local != local_observables_.end()) {
+      std::vector<std::complex<double> > &sum = it_local->second.sum;
+      assert(sum.size() == data.size());
+      for (int i = 0; i < data.size(); ++i) {
+        sum[i] += p_buffer->scale * data[i];
+      }
+      ++it_local->second.count;
+      release(p_buffer);
+      continue;
+    }
+    work.resize(data.size());
+    for (int i = 0; i < data.size(); ++i) {
+      work[i] = p_buffer->scale * data[i].real();
+    }
+    measurements_[p_buffer->obs_name + "_Re"] << work;
+    for (int i = 0; i < data.size(); ++i) {
+      work[i] = p_buffer->scale * data[i].imag();
+    }
+    measurements_[p_buffer->obs_name + "_Im"] << work;
+    release(p_buffer);
+  }
+}
+
+void AsyncObservableSink::release(Buffer *p_buffer) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_buffers_[p_buffer->obs_name].push_back(p_buffer);
+    busy_ = false;
+  }
+  cond_free_.notify_all();
+}
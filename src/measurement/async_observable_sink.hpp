@@ -0,0 +1,111 @@
+#pragma once
+
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <alps/utilities/mpi.hpp>
+
+#include "../accumulator.hpp"
+
+/**
+ * @brief Class for passing large complex vector observables to ALPS accumulators on a background thread
+ *
+ * Each observable owns two buffers. Pushing data copies them into a free buffer and returns immediately,
+ * while a background thread splits the buffer into real and imaginary parts and passes them to the ALPS accumulators.
+ * The Markov chain blocks only if both buffers of the observable are still waiting for the background thread.
+ *
+ * The observables passed through this class must not be measured directly, and
+ * the accumulator set must not be read (e.g., for collecting results) before flush() is called.
+ * Observables (_Re and _Im) must be created in advance.
+ *
+ * Observables created by create_local_observable() are not passed to ALPS, but summed up locally.
+ * This is intended for observables too large to be collected on the master process by ALPS.
+ */
+class AsyncObservableSink {
+ public:
+  AsyncObservableSink(observableset_t &measurements);
+  ~AsyncObservableSink();
+
+  /**
+   * @brief Pass data * scale to the observable named obs_name
+   *
+   * @param obs_name  name of the observable (without _Re/_Im)
+   * @param data      pointer to the data
+   * @param size      the number of elements
+   * @param scale     data are multiplied by this factor on the background thread (e.g., 1/the number of samples)
+   */
+  void push(const std::string &obs_name, const std::complex<double> *data, std::size_t size, double scale = 1.0);
+
+  /** @brief Block until all pushed data have been passed to ALPS */
+  void flush();
+
+  /**
+   * @brief Sum up the data pushed to obs_name locally instead of passing them to ALPS
+   *
+   * Must be called before any data are pushed.
+   */
+  void create_local_observable(const std::string &obs_name, std::size_t size);
+
+  /** @brief Sum of data * scale pushed to a local observable (call flush() before) */
+  const std::vector<std::complex<double> > &get_local_sum(const std::string &obs_name) const;
+
+  /**
+   * @brief Move the sum of a local observable into sum without copying it (call flush() before)
+   *
+   * The local observable is left empty, and no more data may be pushed to it.
+   */
+  void take_local_sum(const std::string &obs_name, std::vector<std::complex<double> > &sum);
+
+  /** @brief Number of data pushed to a local observable (call flush() before) */
+  long get_local_count(const std::string &obs_name) const;
+
+  /**
+   * @brief Reduce local observables over all processes in a single collective operation
+   *
+   * The sums and the numbers of data of the given observables are packed into one buffer and reduced by MPI_Reduce.
+   * Must be called on all processes with the same names (call flush() before).
+   * Only the means are reduced: no error bars are estimated.
+   *
+   * @param max_count  the buffer is reduced in chunks of at most this number of doubles (the limit of the int count)
+   * @return the mean of the data * scale of each observable on the root process, an empty map on the others
+   */
+  std::map<std::string, std::vector<std::complex<double> > >
+  reduce_local_observables(const alps::mpi::communicator &comm, const std::vector<std::string> &names,
+                           int root = 0, int max_count = std::numeric_limits<int>::max()) const;
+
+ private:
+  struct Buffer {
+    std::string obs_name;
+    std::vector<std::complex<double> > data;
+    double scale;
+  };
+  static const int num_buffers_per_obs = 2;
+
+  struct LocalObservable {
+    std::vector<std::complex<double> > sum;
+    long count;
+  };
+
+  const LocalObservable &get_local_observable(const std::string &obs_name) const;
+
+  void run();//main loop of the background thread
+  void release(Buffer *p_buffer);//return a processed buffer to the free pool
+
+  observableset_t &measurements_;
+  std::mutex mutex_;
+  std::condition_variable cond_pending_, cond_free_;
+  std::deque<Buffer *> pending_;
+  std::map<std::string, std::vector<Buffer *> > free_buffers_;
+  std::map<std::string, int> num_buffers_;
+  std::vector<Buffer *> all_buffers_;
+  std::map<std::string, LocalObservable> local_observables_;
+  bool busy_, stop_;
+  std::thread thread_;
+};
@@ -4,12 +4,50 @@
 typedef SlidingWindowManager<REAL_EIGEN_BASIS_MODEL> SW_REAL_MATRIX;
 typedef SlidingWindowManager<COMPLEX_EIGEN_BASIS_MODEL> SW_COMPLEX_MATRIX;
 
-void init_work_space(boost::multi_array<std::complex<double>, 3> &data, int num_flavors, int num_legendre, int num_freq) {
+G2FlavorIndexMap::G2FlavorIndexMap(int num_flavors, const std::vector<std::vector<int> > &conserved_flavor_groups)
+    : num_flavors_(num_flavors),
+      index_(num_flavors * num_flavors * num_flavors * num_flavors, -1),
+      flavors_() {
+  //in_group[g][flavor] = 1 if the flavor belongs to the g-th group, otherwise 0
+  std::vector<std::vector<int> > in_group(conserved_flavor_groups.size(), std::vector<int>(num_flavors, 0));
+  for (int g = 0; g < conserved_flavor_groups.size(); ++g) {
+    for (int i = 0; i < conserved_flavor_groups[g].size(); ++i) {
+      in_group[g][conserved_flavor_groups[g][i]] = 1;
+    }
+  }
+
+  boost::array<int, 4> flavors;
+  for (flavors[0] = 0; flavors[0] < num_flavors; ++flavors[0]) {
+    for (flavors[1] = 0; flavors[1] < num_flavors; ++flavors[1]) {
+      for (flavors[2] = 0; flavors[2] < num_flavors; ++flavors[2]) {
+        for (flavors[3] = 0; flavors[3] < num_flavors; ++flavors[3]) {
+          bool allowed = true;
+          for (int g = 0; g < conserved_flavor_groups.size(); ++g) {
+            if (in_group[g][flavors[0]] - in_group[g][flavors[1]] + in_group[g][flavors[2]] - in_group[g][flavors[3]]
+                != 0) {
+              allowed = false;
+              break;
+            }
+          }
+          if (allowed) {
+            index_[((flavors[0] * num_flavors + flavors[1]) * num_flavors + flavors[2]) * num_flavors + flavors[3]] =
+                flavors_.size();
+            flavors_.push_back(flavors);
+          }
+        }
+      }
+    }
+  }
+}
+
+void init_work_space(boost::multi_array<std::complex<double>, 3> &data, int num_flavors, int num_legendre, int num_freq,
+                     const G2FlavorIndexMap &flavor_map) {
   data.resize(boost::extents[num_flavors][num_flavors][num_legendre]);
 }
 
-void init_work_space(boost::multi_array<std::complex<double>, 7> &data, int num_flavors, int num_legendre, int num_freq) {
-  data.resize(boost::extents[num_flavors][num_flavors][num_flavors][num_flavors][num_legendre][num_legendre][num_freq]);
+void init_work_space(boost::multi_array<std::complex<double>, 4> &data, int num_flavors, int num_legendre, int num_freq,
+                     const G2FlavorIndexMap &flavor_map) {
+  data.resize(boost::extents[flavor_map.num_combinations()][num_legendre][num_legendre][num_freq]);
 }
 
 #undef PP_SCALAR
@@ -2,7 +2,9 @@
 
 #include <algorithm>
 #include <functional>
+#include <numeric>
 
+#include <boost/array.hpp>
 #include <boost/multi_array.hpp>
 #include <boost/range/algorithm.hpp>
 
@@ -13,9 +15,11 @@
 #include <alps/accumulators.hpp>
 
 #include "../accumulator.hpp"
+#include "./async_observable_sink.hpp"
 #include "../mc_config.hpp"
 #include "../sliding_window/sliding_window.hpp"
 #include "../legendre.hpp"
+#include "../nfft.hpp"
 #include "../operator.hpp"
 
 
@@ -52,15 +56,27 @@ class GreensFunctionLegendreMeasurement {
    * @param operators a set of annihilation and creation operators
    */
   void measure(const MonteCarloConfiguration<SCALAR> &mc_config) {
-    //Work array for P[x_l]
-    std::vector<double> Pl_vals(num_legendre_);
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> row_major_matrix_t;
+    typedef Eigen::Map<const row_major_matrix_t, 0, Eigen::OuterStride<> > Pl_map_t;
+
+    //Pairs of operators are processed in batches of this size to keep the work array for P_l[x] in cache
+    const int max_batch_size = 1024;
+    //real and imaginary parts of the coefficients
+    const int num_parts = Eigen::NumTraits<SCALAR>::IsComplex ? 2 : 1;
+
     ++n_meas_;
-    std::vector<psi>::const_iterator it1, it2;
 
     if (mc_config.pert_order() == 0) {
       return;
     }
 
+    //Work arrays for x, P_l[x] and the coefficients of a batch
+    std::vector<double> xvals;
+    boost::multi_array<double, 2> Pl_vals(boost::extents[num_legendre_][max_batch_size]);
+    Eigen::MatrixXd coeffs(max_batch_size, num_parts);
+    Eigen::MatrixXd g_flavor_pair(num_legendre_, num_parts);
+    std::vector<std::vector<int> > annihilators_flavor(num_flavors_), creators_flavor(num_flavors_);
+
     for (int block = 0; block < mc_config.M.num_blocks(); ++block) {
       const std::vector<psi> &creation_operators = mc_config.M.get_cdagg_ops(block);
       const std::vector<psi> &annihilation_operators = mc_config.M.get_c_ops(block);
@@ -68,30 +84,63 @@ class GreensFunctionLegendreMeasurement {
       const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &M =
           mc_config.M.compute_inverse_matrix(block);
 
-      //const Eigen::Matrix<SCALAR,Eigen::Dynamic,Eigen::Dynamic>& G =
-      //mc_config.M.compute_G_matrix(block);
-
+      //Group the operators by flavor
+      for (int flavor = 0; flavor < num_flavors_; ++flavor) {
+        annihilators_flavor[flavor].resize(0);
+        creators_flavor[flavor].resize(0);
+      }
       for (int k = 0; k < M.rows(); k++) {
-        (k == 0 ? it1 = annihilation_operators.begin() : it1++);
-        for (int l = 0; l < M.cols(); l++) {
-          (l == 0 ? it2 = creation_operators.begin() : it2++);
-          double argument = it1->time() - it2->time();
-          double bubble_sign = 1;
-          if (argument > 0) {
-            bubble_sign = 1;
-          } else {
-            bubble_sign = -1;
-            argument += beta_;
+        annihilators_flavor[annihilation_operators[k].flavor()].push_back(k);
+      }
+      for (int l = 0; l < M.cols(); l++) {
+        creators_flavor[creation_operators[l].flavor()].push_back(l);
+      }
+
+      //For each flavor pair, P_l[x] of all the time differences are evaluated in batches
+      //and contracted with the elements of M by a matrix-matrix product
+      for (int flavor_a = 0; flavor_a < num_flavors_; ++flavor_a) {
+        const std::vector<int> &ks = annihilators_flavor[flavor_a];
+        for (int flavor_c = 0; flavor_c < num_flavors_; ++flavor_c) {
+          const std::vector<int> &ls = creators_flavor[flavor_c];
+          const int num_pairs = ks.size() * ls.size();
+          if (num_pairs == 0) {
+            continue;
+          }
+
+          g_flavor_pair.setZero();
+          for (int pair_begin = 0; pair_begin < num_pairs; pair_begin += max_batch_size) {
+            const int batch_size = std::min(max_batch_size, num_pairs - pair_begin);
+            xvals.resize(batch_size);
+            for (int ip = 0; ip < batch_size; ++ip) {
+              const int k = ks[(pair_begin + ip) / ls.size()];
+              const int l = ls[(pair_begin + ip) % ls.size()];
+              double argument = annihilation_operators[k].time() - creation_operators[l].time();
+              double bubble_sign = 1;
+              if (argument > 0) {
+                bubble_sign = 1;
+              } else {
+                bubble_sign = -1;
+                argument += beta_;
+              }
+              assert(-0.01 < argument && argument < beta_ + 0.01);
+
+              xvals[ip] = 2 * argument * temperature_ - 1.0;
+              const SCALAR coeff = -M(l, k) * bubble_sign * mc_config.sign * temperature_;
+              coeffs(ip, 0) = get_real(coeff);
+              if (num_parts == 2) {
+                coeffs(ip, 1) = get_imag(coeff);
+              }
+            }
+            legendre_trans_.compute_legendre(xvals, Pl_vals);
+            g_flavor_pair.noalias() +=
+                Pl_map_t(Pl_vals.origin(), num_legendre_, batch_size, Eigen::OuterStride<>(max_batch_size))
+                    * coeffs.topRows(batch_size);
           }
-          assert(-0.01 < argument && argument < beta_ + 0.01);
 
-          const int flavor_a = it1->flavor();
-          const int flavor_c = it2->flavor();
-          const double x = 2 * argument * temperature_ - 1.0;
-          legendre_trans_.compute_legendre(x, Pl_vals);
-          const SCALAR coeff = -M(l, k) * bubble_sign * mc_config.sign * temperature_;
           for (int il = 0; il < num_legendre_; ++il) {
-            g_meas_[flavor_a][flavor_c][il] += coeff * legendre_trans_.get_sqrt_2l_1()[il] * Pl_vals[il];
+            const std::complex<double> g_il =
+                num_parts == 2 ? std::complex<double>(g_flavor_pair(il, 0), g_flavor_pair(il, 1)) : g_flavor_pair(il, 0);
+            g_meas_[flavor_a][flavor_c][il] += legendre_trans_.get_sqrt_2l_1()[il] * g_il;
           }
         }
       }
@@ -160,6 +209,122 @@ class GreensFunctionLegendreMeasurement {
   boost::multi_array<std::complex<double>, 3> g_meas_;
 };
 
+/**
+ * @brief Class for measurement of single-particle Green's function at Matsubara frequencies
+ *
+ * The contributions of all the pairs of operators are accumulated on the grids of a non-uniform FFT,
+ * which are transformed only when the measured data are retrieved.
+ */
+template<typename SCALAR>
+class GreensFunctionMatsubaraMeasurement {
+ public:
+  /**
+   * Constructor
+   *
+   * @param num_flavors    the number of flavors
+   * @param num_matsubara  the number of Matsubara frequencies
+   * @param beta           inverse temperature
+   */
+  GreensFunctionMatsubaraMeasurement(int num_flavors, int num_matsubara, double beta) :
+      num_flavors_(num_flavors),
+      num_matsubara_(num_matsubara),
+      temperature_(1.0 / beta),
+      nfft_(beta, num_matsubara, num_flavors * num_flavors),
+      n_meas_(0) {
+  }
+
+  /**
+   * Measure Green's function
+   *
+   * @param mc_config Monte Carlo configuration
+   */
+  void measure(const MonteCarloConfiguration<SCALAR> &mc_config) {
+    ++n_meas_;
+
+    if (mc_config.pert_order() == 0) {
+      return;
+    }
+
+    for (int block = 0; block < mc_config.M.num_blocks(); ++block) {
+      const std::vector<psi> &creation_operators = mc_config.M.get_cdagg_ops(block);
+      const std::vector<psi> &annihilation_operators = mc_config.M.get_c_ops(block);
+
+      const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &M =
+          mc_config.M.compute_inverse_matrix(block);
+
+      //G(i omega_n) = -(1/beta) sum_{k,l} M(l,k) exp(i omega_n (tau_k - tau_l))
+      for (int k = 0; k < M.rows(); k++) {
+        const int flavor_a = annihilation_operators[k].flavor();
+        for (int l = 0; l < M.cols(); l++) {
+          const double tau_diff = annihilation_operators[k].time() - creation_operators[l].time();
+          const std::complex<double> coeff = -M(l, k) * mc_config.sign * temperature_;
+          nfft_.add(flavor_a * num_flavors_ + creation_operators[l].flavor(), tau_diff, coeff);
+        }
+      }
+    }
+  }
+
+  /**
+   * Return the measured data in the original basis.
+   *
+   * @param rotmat_Delta   rotation matrix for Delta, which defines the single-particle basis for the perturbation expansion
+   */
+  template<typename Derived>
+  boost::multi_array<std::complex<double>, 3> get_measured_data(const Eigen::MatrixBase<Derived> &rotmat_Delta) const {
+    if (n_meas_ == 0) {
+      throw std::runtime_error("Error: n_meas_=0");
+    }
+
+    //Transform to Matsubara frequencies and divide by the number of measurements
+    boost::multi_array<std::complex<double>, 3> result(boost::extents[num_flavors_][num_flavors_][num_matsubara_]);
+    std::vector<std::complex<double> > gf_omega;
+    for (int flavor = 0; flavor < num_flavors_; ++flavor) {
+      for (int flavor2 = 0; flavor2 < num_flavors_; ++flavor2) {
+        nfft_.transform(flavor * num_flavors_ + flavor2, gf_omega);
+        for (int im = 0; im < num_matsubara_; ++im) {
+          result[flavor][flavor2][im] = gf_omega[im] / (1. * n_meas_);
+        }
+      }
+    }
+
+    //Transform to the original basis
+    Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> gf_tmp(num_flavors_, num_flavors_);
+    for (int im = 0; im < num_matsubara_; ++im) {
+      for (int flavor = 0; flavor < num_flavors_; ++flavor) {
+        for (int flavor2 = 0; flavor2 < num_flavors_; ++flavor2) {
+          gf_tmp(flavor, flavor2) = result[flavor][flavor2][im];
+        }
+      }
+      gf_tmp = rotmat_Delta * gf_tmp * rotmat_Delta.adjoint();
+      for (int flavor = 0; flavor < num_flavors_; ++flavor) {
+        for (int flavor2 = 0; flavor2 < num_flavors_; ++flavor2) {
+          result[flavor][flavor2][im] = gf_tmp(flavor, flavor2);
+        }
+      }
+    }
+
+    return result;
+  }
+
+  /**
+   * Clear all the data measured
+   */
+  void reset() {
+    n_meas_ = 0;
+    nfft_.reset();
+  }
+
+  inline bool has_samples() const { return n_meas_ > 0; }
+
+  inline int num_samples() const { return n_meas_; }
+
+ private:
+  const int num_flavors_, num_matsubara_;
+  const double temperature_;
+  FermionicNFFT nfft_;
+  int n_meas_;
+};
+
 /**
  * Helper for measuring kL and KR
  */
@@ -251,12 +416,12 @@ class TwoTimeG2Measurement {
    */
   template<typename SlidingWindow>
   void measure(MonteCarloConfiguration<SCALAR> &mc_config,
-               alps::accumulators::accumulator_set &measurements,
+               AsyncObservableSink &sink,
                    alps::random01 &random, SlidingWindow &sliding_window, int average_pert_order, const std::string &str);
 
  private:
   /** Measure correlation functions for a single configuration */
-  void measure_impl(const std::vector<psi> &worm_ops, SCALAR weight,
+  void measure_impl(const worm_operators_t &worm_ops, SCALAR weight,
                     boost::multi_array<std::complex<double>,5> &data);
   int num_flavors_;
   double beta_;
@@ -264,11 +429,51 @@ class TwoTimeG2Measurement {
   boost::multi_array<std::complex<double>, 5> data_;
 };
 
-void init_work_space(boost::multi_array<std::complex<double>, 3> &data, int num_flavors, int num_legendre, int num_freq);
-void init_work_space(boost::multi_array<std::complex<double>, 7> &data, int num_flavors, int num_legendre, int num_freq);
+/**
+ * @brief Map from flavor combinations (a, b, c, d) of G2 to indices in a compact storage
+ *
+ * G2_{abcd} vanishes unless d_a d^dagger_b d_c d^dagger_d conserves the number of electrons in each group of flavors
+ * given (e.g., blocks of the hybridization function whose electron number is conserved by the local Hamiltonian).
+ * Only the remaining combinations are stored. Without conserved groups, all num_flavors^4 combinations are stored.
+ */
+class G2FlavorIndexMap {
+ public:
+  G2FlavorIndexMap() : num_flavors_(0) {}
+  G2FlavorIndexMap(int num_flavors, const std::vector<std::vector<int> > &conserved_flavor_groups);
+
+  int num_flavors() const { return num_flavors_; }
+
+  //! Return the number of stored flavor combinations
+  int num_combinations() const { return flavors_.size(); }
+
+  //! Return the index of (a, b, c, d), or -1 if the combination is not stored
+  int index(int flavor_a, int flavor_b, int flavor_c, int flavor_d) const {
+    return index_[((flavor_a * num_flavors_ + flavor_b) * num_flavors_ + flavor_c) * num_flavors_ + flavor_d];
+  }
+
+  //! Return the flavors (a, b, c, d) of the given index
+  const boost::array<int, 4> &flavors(int index) const {
+    return flavors_[index];
+  }
+
+ private:
+  int num_flavors_;
+  std::vector<int> index_;
+  std::vector<boost::array<int, 4> > flavors_;
+};
+
+void init_work_space(boost::multi_array<std::complex<double>, 3> &data, int num_flavors, int num_legendre, int num_freq,
+                     const G2FlavorIndexMap &flavor_map);
+void init_work_space(boost::multi_array<std::complex<double>, 4> &data, int num_flavors, int num_legendre, int num_freq,
+                     const G2FlavorIndexMap &flavor_map);
 
 /**
  * @brief Helper struct for measurement of Green's function using Legendre basis in G space
+ *
+ * If comm_trace_ratios is not empty, the improved estimator is accumulated into data_improved as well.
+ * comm_trace_ratios[i] is the ratio of the trace with the i-th annihilation operator d replaced by [d, H_U]
+ * to the original trace.
+ * flavor_map is used only for G2.
  */
 template<typename SCALAR, int RANK>
 struct MeasureGHelper {
@@ -279,7 +484,10 @@ struct MeasureGHelper {
                       const std::vector<psi> &creation_ops,
                       const std::vector<psi> &annihilation_ops,
                       const alps::fastupdate::ResizableMatrix<SCALAR> &M,
-                      boost::multi_array<std::complex<double>, 4 * RANK -1> &data
+                      boost::multi_array<std::complex<double>, RANK + 2> &data,
+                      const std::vector<SCALAR> &comm_trace_ratios,
+                      boost::multi_array<std::complex<double>, RANK + 2> &data_improved,
+                      const G2FlavorIndexMap &flavor_map
   );
 };
 
@@ -295,7 +503,10 @@ struct MeasureGHelper<SCALAR, 1> {
                       const std::vector<psi> &creation_ops,
                       const std::vector<psi> &annihilation_ops,
                       const alps::fastupdate::ResizableMatrix<SCALAR> &M,
-                      boost::multi_array<std::complex<double>, 3> &data
+                      boost::multi_array<std::complex<double>, 3> &data,
+                      const std::vector<SCALAR> &comm_trace_ratios,
+                      boost::multi_array<std::complex<double>, 3> &data_improved,
+                      const G2FlavorIndexMap &flavor_map
   );
 };
 
@@ -311,7 +522,10 @@ struct MeasureGHelper<SCALAR, 2> {
                       const std::vector<psi> &creation_ops,
                       const std::vector<psi> &annihilation_ops,
                       const alps::fastupdate::ResizableMatrix<SCALAR> &M,
-                      boost::multi_array<std::complex<double>, 7> &data
+                      boost::multi_array<std::complex<double>, 4> &data,
+                      const std::vector<SCALAR> &comm_trace_ratios,
+                      boost::multi_array<std::complex<double>, 4> &data_improved,
+                      const G2FlavorIndexMap &flavor_map
   );
 };
 
@@ -328,16 +542,28 @@ class GMeasurement {
    * @param num_legendre   the number of legendre coefficients
    * @param num_freq       the number of bosonic frequencies
    * @param beta           inverse temperature
+   * @param max_num_data   the number of measurements before accumulated data are passed to ALPS
+   * @param improved_estimator  if true, measure <[d, H_U] ...> as well with the first annihilation operator replaced
+   * @param conserved_flavor_groups  groups of flavors whose electron number is conserved (used only for G2)
    */
-  GMeasurement(int num_flavors, int num_legendre, int num_freq, double beta, int max_num_data = 1) :
+  GMeasurement(int num_flavors, int num_legendre, int num_freq, double beta, int max_num_data = 1,
+               bool improved_estimator = false,
+               const std::vector<std::vector<int> > &conserved_flavor_groups = std::vector<std::vector<int> >()) :
       str_("G"+boost::lexical_cast<std::string>(Rank)),
       num_flavors_(num_flavors),
       num_freq_(num_freq),
       beta_(beta),
       legendre_trans_(1, num_legendre),
       num_data_(0),
-      max_num_data_(max_num_data) {
-    init_work_space(data_, num_flavors, num_legendre, num_freq);
+      max_num_data_(max_num_data),
+      improved_estimator_(improved_estimator) {
+    if (Rank == 2) {
+      flavor_map_ = G2FlavorIndexMap(num_flavors, conserved_flavor_groups);
+    }
+    init_work_space(data_, num_flavors, num_legendre, num_freq, flavor_map_);
+    if (improved_estimator_) {
+      init_work_space(data_improved_, num_flavors, num_legendre, num_freq, flavor_map_);
+    }
   };
 
   /**
@@ -345,24 +571,53 @@ class GMeasurement {
    */
   void create_alps_observable(alps::accumulators::accumulator_set &measurements) const {
     create_observable<std::complex<double>, SimpleRealVectorObservable>(measurements, str_.c_str());
+    if (improved_estimator_) {
+      create_observable<std::complex<double>, SimpleRealVectorObservable>(measurements, (str_ + "_improved").c_str());
+    }
+  }
+
+  /**
+   * @brief Sum up the measured data locally in the sink instead of passing them to ALPS
+   *
+   * The data are not collected by ALPS. See AsyncObservableSink::get_local_sum().
+   */
+  void create_local_observable(AsyncObservableSink &sink) const {
+    sink.create_local_observable(str_, data_.num_elements());
+    if (improved_estimator_) {
+      sink.create_local_observable(str_ + "_improved", data_improved_.num_elements());
+    }
   }
 
   /**
    * @brief Measure Green's function via hybridization function
+   *
+   * The sliding window is used only for computing the traces for the improved estimator.
    */
+  template<typename SlidingWindow>
   void measure_via_hyb(const MonteCarloConfiguration<SCALAR> &mc_config,
-               alps::accumulators::accumulator_set &measurements,
-               alps::random01 &random, int max_matrix_size, double eps = 1E-5);
+               AsyncObservableSink &sink,
+               alps::random01 &random, const SlidingWindow &sliding_window,
+               int max_matrix_size, double eps = 1E-5);
+
+  /**
+   * @brief Return the map from flavor combinations to indices in the measured data of G2
+   */
+  const G2FlavorIndexMap &get_flavor_index_map() const {
+    return flavor_map_;
+  }
 
  private:
   std::string str_;
   int num_flavors_, num_freq_;
   double beta_;
   LegendreTransformer legendre_trans_;
-  //flavor, ..., flavor, legendre, legendre, ..., legendre
-  boost::multi_array<std::complex<double>, 4 * Rank - 1> data_;
+  //G1: flavor, flavor, legendre
+  //G2: flavor combination (see G2FlavorIndexMap), legendre, legendre, bosonic frequency
+  boost::multi_array<std::complex<double>, Rank + 2> data_, data_improved_;
+  G2FlavorIndexMap flavor_map_;
   int num_data_;
   int max_num_data_;//max number of data accumlated before passing data to ALPS
+  bool improved_estimator_;
 };
 
 /**
@@ -375,26 +630,37 @@ class EqualTimeGMeasurement {
    * Constructor
    *
    * @param num_flavors    the number of flavors
+   * @param max_num_data   the number of measurements before accumulated data are passed to ALPS
    */
-  EqualTimeGMeasurement(int num_flavors) :
-      num_flavors_(num_flavors) {};
+  EqualTimeGMeasurement(int num_flavors, int max_num_data = 1) :
+      num_flavors_(num_flavors),
+      data_(static_cast<int>(std::pow(static_cast<double>(num_flavors), 2 * Rank)), 0.0),
+      num_data_(0),
+      max_num_data_(max_num_data) {};
 
   /**
    * Measurement of equal-time single-particle GF
    */
   void measure_G1(MonteCarloConfiguration<SCALAR> &mc_config,
-              alps::accumulators::accumulator_set &measurements,
+              AsyncObservableSink &sink,
               const std::string &str);
 
   /**
    * Measurement of equal-time two-particle GF
    */
   void measure_G2(MonteCarloConfiguration<SCALAR> &mc_config,
-               alps::accumulators::accumulator_set &measurements,
+               AsyncObservableSink &sink,
                const std::string &str);
 
  private:
+  //Pass the accumulated data to ALPS libraries if max_num_data_ samples have been accumulated
+  void add_sample(int index, SCALAR sign, AsyncObservableSink &sink, const std::string &str);
+
   int num_flavors_;
+  //flavor, ..., flavor (flattened)
+  std::vector<std::complex<double> > data_;
+  int num_data_;
+  int max_num_data_;//max number of data accumlated before passing data to ALPS
 };
 
 //#include "measurement.ipp"
\ No newline at end of file
@@ -3,7 +3,7 @@
 template<typename SCALAR>
 template<typename SlidingWindow>
 void TwoTimeG2Measurement<SCALAR>::measure(MonteCarloConfiguration<SCALAR> &mc_config,
-                                           alps::accumulators::accumulator_set &measurements,
+                                           AsyncObservableSink &sink,
                                            alps::random01 &random,
                                            SlidingWindow &sliding_window,
                                            int average_pert_order,
@@ -16,8 +16,8 @@ void TwoTimeG2Measurement<SCALAR>::measure(MonteCarloConfiguration<SCALAR> &mc_c
 
   //Remove the left-hand-side operators
   operator_container_t ops(mc_config.operators);
-  const std::vector<psi> worm_ops_original = mc_config.p_worm->get_operators();
-  safe_erase(ops, worm_ops_original);
+  const worm_operators_t worm_ops_original = mc_config.p_worm->get_operators();
+  safe_erase(ops, worm_ops_original.begin(), worm_ops_original.end());
 
   //Generate times of the left hand operator pair c^dagger c
   //Make sure there is no duplicate
@@ -39,12 +39,6 @@ void TwoTimeG2Measurement<SCALAR>::measure(MonteCarloConfiguration<SCALAR> &mc_c
     assert(new_times.size() == num_times);
   }
 
-  //remember the current status of the sliding window
-  const typename SlidingWindow::state_t state = sliding_window.get_state();
-  const int n_win = sliding_window.get_n_window();
-
-  std::vector<EXTENDED_REAL> trace_bound(sliding_window.get_num_brakets());
-
   //configurations whose trace is smaller than this cutoff are ignored.
   const EXTENDED_REAL trace_cutoff = EXTENDED_REAL(1.0E-30) * myabs(mc_config.trace);
 
@@ -54,8 +48,11 @@ void TwoTimeG2Measurement<SCALAR>::measure(MonteCarloConfiguration<SCALAR> &mc_c
   //compute Monte Carlo weights of configurations with new time
   // sweep = 0: configuration with new time for the left-hand operator pair
   // sweep = 1: configuration with new time and new flavors for all worm operators
+  //The traces at all the new times are computed in a single sweep over [0, beta] without touching the window.
+  const std::vector<double> times(new_times.begin(), new_times.end());
+  std::vector<EXTENDED_SCALAR> traces;
   for (int sweep = 0; sweep < 2; ++sweep) {
-    std::vector<psi> worm_ops = worm_ops_original;
+    worm_operators_t worm_ops = worm_ops_original;
     if (sweep == 1) {//change flavors of all worm operators
       for (int iop = 0; iop < worm_ops.size(); ++iop) {
         worm_ops[iop].set_flavor(static_cast<int>(random() * num_flavors_));
@@ -67,32 +64,17 @@ void TwoTimeG2Measurement<SCALAR>::measure(MonteCarloConfiguration<SCALAR> &mc_c
       safe_insert(ops, worm_ops[iop]);
     }
 
-    //reset the window and move to the right most position
-    sliding_window.set_window_size(std::max(num_times, n_win), ops, 0, ITIME_LEFT);
+    //worm_ops[1] is placed at (t, 0) and worm_ops[0] at (t, +1)
+    sliding_window.scan_trace_pair_insertion(ops, worm_ops[1], worm_ops[0], times, traces);
 
-    for (std::set<double>::iterator it = new_times.begin(); it != new_times.end(); ++it) {
-      //move the window so that it contains the time
-      while (*it > sliding_window.get_tau_high()) {
-        sliding_window.move_window_to_next_position(ops);
-      }
-      assert(*it <= sliding_window.get_tau_high());
-      assert(*it >= sliding_window.get_tau_low());
-
-      worm_ops[0].set_time(OperatorTime(*it, +1));
-      worm_ops[1].set_time(OperatorTime(*it, 0));
-      safe_insert(ops, worm_ops[0]);
-      safe_insert(ops, worm_ops[1]);
-
-      sliding_window.compute_trace_bound(ops, trace_bound);
-      std::pair<bool, EXTENDED_SCALAR> r = sliding_window.lazy_eval_trace(ops, EXTENDED_REAL(0.0), trace_bound);
-      if (myabs(r.second) > trace_cutoff) {
-        const SCALAR weight = convert_to_scalar(r.second / mc_config.trace);
+    for (int it = 0; it < times.size(); ++it) {
+      if (myabs(traces[it]) > trace_cutoff) {
+        worm_ops[0].set_time(OperatorTime(times[it], +1));
+        worm_ops[1].set_time(OperatorTime(times[it], 0));
+        const SCALAR weight = convert_to_scalar(traces[it] / mc_config.trace);
         measure_impl(worm_ops, mc_config.sign * weight, data_);
         norm += std::abs(weight);
       }
-
-      safe_erase(ops, worm_ops[0]);
-      safe_erase(ops, worm_ops[1]);
     }
 
     //remove worm operators which are not shifted in time
@@ -101,21 +83,12 @@ void TwoTimeG2Measurement<SCALAR>::measure(MonteCarloConfiguration<SCALAR> &mc_c
     }
   }
 
-  //normalize the data
-  std::transform(data_.origin(),
-                 data_.origin() + data_.num_elements(),
-                 data_.origin(),
-                 std::bind2nd(std::divides<std::complex<double> >(), norm));
-
-  //pass the data to ALPS libraries
-  measure_simple_vector_observable<std::complex<double> >(measurements, str.c_str(), to_std_vector(data_));
-
-  //restore the status of the sliding window
-  sliding_window.restore_state(mc_config.operators, state);
+  //pass the normalized data to ALPS libraries
+  sink.push(str, data_.origin(), data_.num_elements(), 1.0 / norm);
 }
 
 template<typename SCALAR>
-void TwoTimeG2Measurement<SCALAR>::measure_impl(const std::vector<psi> &worm_ops, SCALAR weight,
+void TwoTimeG2Measurement<SCALAR>::measure_impl(const worm_operators_t &worm_ops, SCALAR weight,
                                                 boost::multi_array<std::complex<double>, 5> &data) {
   boost::array<int, 4> flavors;
   if (worm_ops[0].time().time() != worm_ops[1].time().time()) {
@@ -146,9 +119,11 @@ void TwoTimeG2Measurement<SCALAR>::measure_impl(const std::vector<psi> &worm_ops
 }
 
 template<typename SCALAR, int Rank>
+template<typename SlidingWindow>
 void GMeasurement<SCALAR, Rank>::measure_via_hyb(const MonteCarloConfiguration<SCALAR> &mc_config,
-                                                 alps::accumulators::accumulator_set &measurements,
+                                                 AsyncObservableSink &sink,
                                                  alps::random01 &random,
+                                                 const SlidingWindow &sliding_window,
                                                  int max_num_ops,
                                                  double eps) {
   typedef typename ExtendedScalar<SCALAR>::value_type EXTENDED_SCALAR;
@@ -159,7 +134,7 @@ void GMeasurement<SCALAR, Rank>::measure_via_hyb(const MonteCarloConfiguration<S
   boost::shared_ptr<HybridizationFunction<SCALAR> > p_gf = mc_config.M.get_greens_function();
   const std::vector<psi> cdagg_ops = mc_config.M.get_cdagg_ops();
   const std::vector<psi> c_ops = mc_config.M.get_c_ops();
-  const std::vector<psi> worm_ops = mc_config.p_worm->get_operators();
+  const worm_operators_t &worm_ops = mc_config.p_worm->get_operators();
 
   const int n_aux_lines = Rank;
 
@@ -176,15 +151,13 @@ void GMeasurement<SCALAR, Rank>::measure_via_hyb(const MonteCarloConfiguration<S
   B.setZero();
   C.setZero();
   D.setZero();
-  for (int i = 0; i < pert_order; ++i) {
-    for (int j = 0; j < Rank; ++j) {
-      B(i, j) = p_gf->operator()(c_ops[i], worm_ops[2 * j + 1]);
-    }
+  for (int j = 0; j < Rank; ++j) {
+    typename matrix_t::ColXpr col = B.col(j);
+    p_gf->fill_column(c_ops.begin(), c_ops.end(), worm_ops[2 * j + 1], col);
   }
   for (int i = 0; i < Rank; ++i) {
-    for (int j = 0; j < pert_order; ++j) {
-      C(i, j) = p_gf->operator()(worm_ops[2 * i], cdagg_ops[j]);
-    }
+    typename matrix_t::RowXpr row = C.row(i);
+    p_gf->fill_row(worm_ops[2 * i], cdagg_ops.begin(), cdagg_ops.end(), row);
   }
   for (int i = 0; i < Rank + n_aux_lines; ++i) {
     for (int j = 0; j < Rank + n_aux_lines; ++j) {
@@ -213,6 +186,20 @@ void GMeasurement<SCALAR, Rank>::measure_via_hyb(const MonteCarloConfiguration<S
   }
   const SCALAR weight_rat = det_rat;
 
+  //Improved estimator: ratios of the traces with an annihilation operator d replaced by [d, H_U].
+  //The local trace is not changed by attaching the worm via hybridization lines.
+  std::vector<SCALAR> comm_trace_ratios;
+  if (improved_estimator_) {
+    std::vector<EXTENDED_SCALAR> comm_traces;
+    sliding_window.scan_trace_commutator_replacement(mc_config.operators, comm_traces);
+    comm_trace_ratios.resize(c_ops_new.size());
+    for (int i = 0; i < c_ops_new.size(); ++i) {
+      const int pos = std::distance(mc_config.operators.begin(), mc_config.operators.find(c_ops_new[i]));
+      assert(pos < mc_config.operators.size());
+      comm_trace_ratios[i] = convert_to_scalar(static_cast<EXTENDED_SCALAR>(comm_traces[pos] / mc_config.trace));
+    }
+  }
+
   //TO DO: move this to a separated function
   if (pert_order + Rank > max_num_ops) {
     const int num_ops = pert_order + Rank;
@@ -236,9 +223,13 @@ void GMeasurement<SCALAR, Rank>::measure_via_hyb(const MonteCarloConfiguration<S
 
     {
       std::vector<psi> cdagg_ops_reduced, c_ops_reduced;
+      std::vector<SCALAR> comm_trace_ratios_reduced;
       for (int i = 0; i < num_ops; ++i) {
         if (is_col_active[i]) {
           c_ops_reduced.push_back(c_ops_new[i]);
+          if (improved_estimator_) {
+            comm_trace_ratios_reduced.push_back(comm_trace_ratios[i]);
+          }
         }
         if (is_row_active[i]) {
           cdagg_ops_reduced.push_back(cdagg_ops_new[i]);
@@ -246,6 +237,7 @@ void GMeasurement<SCALAR, Rank>::measure_via_hyb(const MonteCarloConfiguration<S
       }
       std::swap(cdagg_ops_reduced, cdagg_ops_new);
       std::swap(c_ops_reduced, c_ops_new);
+      std::swap(comm_trace_ratios_reduced, comm_trace_ratios);
       assert(cdagg_ops_new.size() == max_num_ops);
       assert(c_ops_new.size() == max_num_ops);
     }
@@ -295,14 +287,19 @@ void GMeasurement<SCALAR, Rank>::measure_via_hyb(const MonteCarloConfiguration<S
                                         cdagg_ops_new,
                                         c_ops_new,
                                         M,
-                                        data_);
+                                        data_,
+                                        comm_trace_ratios,
+                                        data_improved_,
+                                        flavor_map_);
   ++ num_data_;
 
   if (num_data_ == max_num_data_) {
-    //pass the data to ALPS libraries
-    std::transform(data_.origin(), data_.origin() + data_.num_elements(), data_.origin(),
-                   std::bind2nd(std::divides<std::complex<double> >(), 1. * max_num_data_));
-    measure_simple_vector_observable<std::complex<double> >(measurements, str_.c_str(), to_std_vector(data_));
+    //pass the averaged data to ALPS libraries
+    sink.push(str_, data_.origin(), data_.num_elements(), 1. / max_num_data_);
+    if (improved_estimator_) {
+      sink.push(str_ + "_improved", data_improved_.origin(), data_improved_.num_elements(), 1. / max_num_data_);
+      std::fill(data_improved_.origin(), data_improved_.origin() + data_improved_.num_elements(), 0.0);
+    }
 
     num_data_ = 0;
     std::fill(data_.origin(), data_.origin() + data_.num_elements(), 0.0);
@@ -328,7 +325,10 @@ void MeasureGHelper<SCALAR, 1>::perform(double beta,
                                         const std::vector<psi> &creation_ops,
                                         const std::vector<psi> &annihilation_ops,
                                         const alps::fastupdate::ResizableMatrix<SCALAR> &M,
-                                        boost::multi_array<std::complex<double>, 3> &result) {
+                                        boost::multi_array<std::complex<double>, 3> &result,
+                                        const std::vector<SCALAR> &comm_trace_ratios,
+                                        boost::multi_array<std::complex<double>, 3> &result_improved,
+                                        const G2FlavorIndexMap &flavor_map) {
   const double temperature = 1. / beta;
   const int num_flavors = result.shape()[0];
   const int num_legendre = legendre_trans.num_legendre();
@@ -337,6 +337,8 @@ void MeasureGHelper<SCALAR, 1>::perform(double beta,
 
   std::vector<psi>::const_iterator it1, it2;
   const int mat_size = M.size1();
+  const bool improved = !comm_trace_ratios.empty();
+  assert(!improved || comm_trace_ratios.size() == annihilation_ops.size());
 
   //First, we compute relative weights
   boost::multi_array<SCALAR,2> coeffs(boost::extents[mat_size-1][mat_size-1]);
@@ -379,6 +381,12 @@ void MeasureGHelper<SCALAR, 1>::perform(double beta,
       for (int il = 0; il < num_legendre; ++il) {
         result[flavor_a][flavor_c][il] += scale_fact * coeffs[k][l] * legendre_trans.get_sqrt_2l_1()[il] * Pl_vals[il];
       }
+      if (improved) {
+        for (int il = 0; il < num_legendre; ++il) {
+          result_improved[flavor_a][flavor_c][il] +=
+              scale_fact * coeffs[k][l] * comm_trace_ratios[k] * legendre_trans.get_sqrt_2l_1()[il] * Pl_vals[il];
+        }
+      }
     }
   }
 };
@@ -393,33 +401,63 @@ void MeasureGHelper<SCALAR, 2>::perform(double beta,
                                         const std::vector<psi> &creation_ops,
                                         const std::vector<psi> &annihilation_ops,
                                         const alps::fastupdate::ResizableMatrix<SCALAR> &M,
-                                        boost::multi_array<std::complex<double>, 7> &result) {
+                                        boost::multi_array<std::complex<double>, 4> &result,
+                                        const std::vector<SCALAR> &comm_trace_ratios,
+                                        boost::multi_array<std::complex<double>, 4> &result_improved,
+                                        const G2FlavorIndexMap &flavor_map) {
+  typedef std::complex<double> complex_t;
+  typedef Eigen::Matrix<complex_t, Eigen::Dynamic, Eigen::Dynamic> complex_matrix_t;
+  typedef Eigen::Matrix<complex_t, Eigen::Dynamic, 1> complex_vector_t;
+  typedef Eigen::Matrix<complex_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> row_major_matrix_t;
+
   const double temperature = 1. / beta;
-  const int num_flavors = result.shape()[0];
+  const int num_flavors = flavor_map.num_flavors();
   const int num_legendre = legendre_trans.num_legendre();
   const int num_phys_rows = creation_ops.size();
-  //std::cout << "num_phys_rows " << num_phys_rows << " " << annihilation_ops.size() << " " << M.size1() << std::endl;
   const int n_aux_lines = 2;
   if (creation_ops.size() != annihilation_ops.size() || creation_ops.size() != M.size1() - n_aux_lines) {
     throw std::runtime_error("Fatal error in MeasureGHelper<SCALAR, 2>::perform()");
   }
+  const int n = num_phys_rows;
+  const bool improved = !comm_trace_ratios.empty();
+  assert(!improved || comm_trace_ratios.size() == annihilation_ops.size());
 
-  //Compute values of P
+  //Sort the operators by flavor so that the operators of each flavor form a contiguous range of indices
+  std::vector<int> ann_idx(n), cre_idx(n);
+  std::vector<int> flavor_offset_ann(num_flavors + 1, 0), flavor_offset_cre(num_flavors + 1, 0);
+  {
+    for (int i = 0; i < n; ++i) {
+      ++flavor_offset_ann[annihilation_ops[i].flavor() + 1];
+      ++flavor_offset_cre[creation_ops[i].flavor() + 1];
+    }
+    std::partial_sum(flavor_offset_ann.begin(), flavor_offset_ann.end(), flavor_offset_ann.begin());
+    std::partial_sum(flavor_offset_cre.begin(), flavor_offset_cre.end(), flavor_offset_cre.begin());
+    std::vector<int> pos_ann(flavor_offset_ann), pos_cre(flavor_offset_cre);
+    for (int i = 0; i < n; ++i) {
+      ann_idx[pos_ann[annihilation_ops[i].flavor()]++] = i;
+      cre_idx[pos_cre[creation_ops[i].flavor()]++] = i;
+    }
+  }
+  std::vector<int> num_ann(num_flavors), num_cre(num_flavors);
+  for (int flavor = 0; flavor < num_flavors; ++flavor) {
+    num_ann[flavor] = flavor_offset_ann[flavor + 1] - flavor_offset_ann[flavor];
+    num_cre[flavor] = flavor_offset_cre[flavor + 1] - flavor_offset_cre[flavor];
+  }
+
+  //Compute values of P (annihilator, creator) for each l and the phases (annihilator, creator) for each frequency
   std::vector<double> sqrt_2l_1 = legendre_trans.get_sqrt_2l_1();
   std::vector<double> sqrt_2l_1_p(sqrt_2l_1);
   for (int il = 0; il < num_legendre; il += 2) {
     sqrt_2l_1_p[il] *= -1;
   }
-
-  boost::multi_array<double, 3>
-      sqrt_2l_1_Pl(boost::extents[num_phys_rows][num_phys_rows][num_legendre]);//annihilator, creator, legendre
-  boost::multi_array<double, 3>
-      sqrt_2l_1_Pl_p(boost::extents[num_phys_rows][num_phys_rows][num_legendre]);//annihilator, creator, legendre
+  std::vector<complex_matrix_t> Pl(num_legendre, complex_matrix_t(n, n));
+  std::vector<complex_matrix_t> expiomega(n_freq, complex_matrix_t(n, n));
   {
     std::vector<double> Pl_tmp(num_legendre);
-    for (int k = 0; k < num_phys_rows; k++) {
-      for (int l = 0; l < num_phys_rows; l++) {
-        double argument = annihilation_ops[k].time() - creation_ops[l].time();
+    for (int k = 0; k < n; k++) {
+      for (int l = 0; l < n; l++) {
+        const double tau_diff = annihilation_ops[ann_idx[k]].time() - creation_ops[cre_idx[l]].time();
+        double argument = tau_diff;
         double arg_sign = 1.0;
         if (argument < 0) {
           argument += beta;
@@ -428,102 +466,221 @@ void MeasureGHelper<SCALAR, 2>::perform(double beta,
         const double x = 2 * argument * temperature - 1.0;
         legendre_trans.compute_legendre(x, Pl_tmp);
         for (int il = 0; il < num_legendre; ++il) {
-          sqrt_2l_1_Pl[k][l][il] = arg_sign * Pl_tmp[il] * sqrt_2l_1[il];
-          sqrt_2l_1_Pl_p[k][l][il] = arg_sign * Pl_tmp[il] * sqrt_2l_1_p[il];
+          Pl[il](k, l) = arg_sign * Pl_tmp[il];
         }
-      }
-    }
-  }
 
-  boost::multi_array<std::complex<double>, 3>
-      expiomega(boost::extents[num_phys_rows][num_phys_rows][n_freq]);//annihilator, creator, legendre
-  {
-    for (int k = 0; k < num_phys_rows; k++) {
-      for (int l = 0; l < num_phys_rows; l++) {
-        const double tau_diff = annihilation_ops[k].time() - creation_ops[l].time();
-        const std::complex<double> rat = std::exp(std::complex<double>(0.0, 2 * M_PI * tau_diff * temperature));
-        expiomega[k][l][0] = 1.0;
+        const complex_t rat = std::exp(complex_t(0.0, 2 * M_PI * tau_diff * temperature));
+        expiomega[0](k, l) = 1.0;
         for (int freq = 1; freq < n_freq; ++freq) {
-          expiomega[k][l][freq] = rat * expiomega[k][l][freq - 1];
+          expiomega[freq](k, l) = rat * expiomega[freq - 1](k, l);
         }
       }
     }
   }
 
-  //naive way to evaluate
-  //The indices of M are reverted from (C. 24) of L. Boehnke (2011) because we're using the F convention here.
-
-  //First, compute relative weights
-  const int rank = 2;
-  const int det_size = rank + n_aux_lines;
-  Eigen::Matrix<SCALAR,det_size,det_size> tmp_mat;
-  boost::array<int,det_size> rows3, cols3;
-  const int last = M.size1() - 1;
-  for (int i = 0; i < n_aux_lines; ++i) {
-    cols3[rank+i] = rows3[rank+i] = i + M.size1() - n_aux_lines;
+  /*
+   * The relative weight of the configuration without rows b, d and columns a, c is
+   * the determinant of the 4x4 submatrix of M (Delta convention)
+   *   M_ba  M_bc  M_b1  M_b2
+   *   M_da  M_dc  M_d1  M_d2
+   *   M_1a  M_1c  M_11  M_12
+   *   M_2a  M_2c  M_21  M_22,
+   * where 1 and 2 denote the auxiliary lines.
+   * The indices of M are reverted from (C. 24) of L. Boehnke (2011) because we're using the F convention here.
+   * The Laplace expansion along the last two rows yields
+   *   det = sum_t X_t(b,a) Y_t(d,c) - sum_t X'_t(b,c) Y'_t(d,a),
+   * with products of matrices of size n x n. No inverse of the auxiliary block is needed as it may be singular.
+   */
+  const int aux1 = M.size1() - 2, aux2 = M.size1() - 1;
+  complex_matrix_t M_phys(n, n), G(n, n);//(creator, annihilator)
+  complex_vector_t m1(n), m2(n), alpha(n), beta_aux(n);
+  const complex_t det_aux = M(aux1, aux1) * M(aux2, aux2) - M(aux1, aux2) * M(aux2, aux1);
+  for (int a = 0; a < n; ++a) {
+    alpha(a) = M(aux1, ann_idx[a]);
+    beta_aux(a) = M(aux2, ann_idx[a]);
   }
-  assert(cols3.back()==last);
-  boost::multi_array<SCALAR,4> coeffs(boost::extents[num_phys_rows][num_phys_rows][num_phys_rows][num_phys_rows]);
+  for (int b = 0; b < n; ++b) {
+    m1(b) = M(cre_idx[b], aux1);
+    m2(b) = M(cre_idx[b], aux2);
+    for (int a = 0; a < n; ++a) {
+      M_phys(b, a) = M(cre_idx[b], ann_idx[a]);
+    }
+  }
+  for (int a = 0; a < n; ++a) {
+    const complex_t delta1 = alpha(a) * M(aux2, aux1) - M(aux1, aux1) * beta_aux(a);
+    const complex_t delta2 = alpha(a) * M(aux2, aux2) - M(aux1, aux2) * beta_aux(a);
+    G.col(a) = delta1 * m2 - delta2 * m1;
+  }
+  const complex_matrix_t M_phys_G = det_aux * M_phys + G;
+
+  std::vector<complex_matrix_t> X_direct, Y_direct, X_exchange, Y_exchange;
+  X_direct.push_back(M_phys);
+  Y_direct.push_back(M_phys_G);
+  X_direct.push_back(G);
+  Y_direct.push_back(M_phys);
+  X_direct.push_back(m1 * alpha.transpose());
+  Y_direct.push_back(m2 * beta_aux.transpose());
+  X_direct.push_back(-m2 * alpha.transpose());
+  Y_direct.push_back(m1 * beta_aux.transpose());
+  X_direct.push_back(-m1 * beta_aux.transpose());
+  Y_direct.push_back(m2 * alpha.transpose());
+  X_direct.push_back(m2 * beta_aux.transpose());
+  Y_direct.push_back(m1 * alpha.transpose());
+  X_exchange.push_back(M_phys);
+  Y_exchange.push_back(M_phys_G);
+  X_exchange.push_back(G);
+  Y_exchange.push_back(M_phys);
+
+  //First, compute the normalization factor sum_{a!=c, b!=d} |weight|
   double norm = 0.0;
-  for (int a = 0; a < num_phys_rows; ++a) {
-    for (int b = 0; b < num_phys_rows; ++b) {
-      for (int c = 0; c < num_phys_rows; ++c) {
-        if (a==c) {
+  {
+    const complex_matrix_t delta_ac = alpha * beta_aux.transpose() - beta_aux * alpha.transpose();
+    const complex_matrix_t H_bd = m1 * m2.transpose() - m2 * m1.transpose();
+    for (int a = 0; a < n; ++a) {
+      for (int c = 0; c < n; ++c) {
+        if (a == c) {
           continue;
         }
-        for (int d = 0; d < num_phys_rows; ++d) {
-          if (b==d) {
-            continue;
-          }
-          /*
-           * Delta convention
-           * M_ab  M_ad  M_a*
-           * M_cb  M_cd  M_c*
-           * M_*b  M_*d  M_**
-           */
-          rows3[0] = b;
-          rows3[1] = d;
-          cols3[0] = a;
-          cols3[1] = c;
-          for (int j = 0; j < det_size; ++j) {
-            for (int i = 0; i < det_size; ++i) {
-              tmp_mat(i,j) = M(rows3[i], cols3[j]);
+        for (int b = 0; b < n; ++b) {
+          for (int d = 0; d < n; ++d) {
+            if (b == d) {
+              continue;
             }
+            const complex_t det =
+                M_phys(b, a) * M_phys_G(d, c) + G(b, a) * M_phys(d, c)
+                    - M_phys(b, c) * M_phys_G(d, a) - G(b, c) * M_phys(d, a)
+                    + delta_ac(a, c) * H_bd(b, d);
+            norm += std::abs(det);
           }
-          coeffs[a][b][c][d] = sign * weight_rat_intermediate_state * tmp_mat.determinant();
-          norm += std::abs(coeffs[a][b][c][d]);
         }
       }
     }
   }
+  norm *= std::abs(sign * weight_rat_intermediate_state);
+  if (norm == 0.0) {
+    return;
+  }
+  const complex_t coeff = sign * weight_rat_intermediate_state / (norm * beta);
 
   //Then, accumulate data
-  const double scale_fact = 1.0/(norm * beta);
-  for (int a = 0; a < num_phys_rows; ++a) {
-    const int flavor_a = annihilation_ops[a].flavor();
-    for (int b = 0; b < num_phys_rows; ++b) {
-      const int flavor_b = creation_ops[b].flavor();
-      for (int c = 0; c < num_phys_rows; ++c) {
-        if (a==c) {
-          continue;
+  // direct terms:   sum_{a,b,c,d} X(b,a) A_l(a,b) Y(d,c) B_l'(c,d) exp(i omega (tau_a-tau_d))
+  //                 = sum_{a,d} P_l(a) exp(i omega (tau_a-tau_d)) Q_l'(d)
+  // exchange terms: sum_{a,b,c,d} A_l(a,b) X(b,c) B_l'(c,d) Y(d,a) exp(i omega (tau_a-tau_d))
+  //                 = sum_{a,d} V_{l,l'}(a,d) Y(d,a) exp(i omega (tau_a-tau_d))
+  // with A_l(a,b) = sqrt(2l+1) P_l(a,b) and B_l'(c,d) = (-1)^{l'+1} sqrt(2l'+1) P_l'(c,d).
+  //The improved estimator replaces the annihilator a by [d_a, H_U], which rescales column a of X_direct and Y_exchange.
+  const int num_estimators = improved ? 2 : 1;
+  for (int estimator = 0; estimator < num_estimators; ++estimator) {
+    boost::multi_array<std::complex<double>, 4> &result_est = estimator == 0 ? result : result_improved;
+    if (estimator == 1) {
+      complex_vector_t ratios(n);
+      for (int a = 0; a < n; ++a) {
+        ratios(a) = comm_trace_ratios[ann_idx[a]];
+      }
+      for (int t = 0; t < X_direct.size(); ++t) {
+        X_direct[t] = X_direct[t] * ratios.asDiagonal();
+      }
+      for (int t = 0; t < Y_exchange.size(); ++t) {
+        Y_exchange[t] = Y_exchange[t] * ratios.asDiagonal();
+      }
+    }
+
+    for (int t = 0; t < X_direct.size(); ++t) {
+      const complex_matrix_t XT = X_direct[t].transpose();//(annihilator, creator)
+      //P[flavor_b](a,l), Q[flavor_c](d,l')
+      std::vector<complex_matrix_t> P(num_flavors, complex_matrix_t(n, num_legendre));
+      std::vector<complex_matrix_t> Q(num_flavors, complex_matrix_t(n, num_legendre));
+      for (int flavor = 0; flavor < num_flavors; ++flavor) {
+        const int ob = flavor_offset_cre[flavor], nb = num_cre[flavor];
+        const int oc = flavor_offset_ann[flavor], nc = num_ann[flavor];
+        for (int il = 0; il < num_legendre; ++il) {
+          P[flavor].col(il) =
+              sqrt_2l_1[il] * Pl[il].middleCols(ob, nb).cwiseProduct(XT.middleCols(ob, nb)).rowwise().sum();
+          Q[flavor].col(il) = sqrt_2l_1_p[il] *
+              Y_direct[t].middleCols(oc, nc).cwiseProduct(Pl[il].middleRows(oc, nc).transpose()).rowwise().sum();
         }
-        const int flavor_c = annihilation_ops[c].flavor();
-        for (int d = 0; d < num_phys_rows; ++d) {
-          if (b==d) {
-            continue;
-          }
-          const int flavor_d = creation_ops[d].flavor();
+      }
 
-          if (coeffs[a][b][c][d] == 0.0) {
+      for (int flavor_c = 0; flavor_c < num_flavors; ++flavor_c) {
+        for (int flavor_d = 0; flavor_d < num_flavors; ++flavor_d) {
+          const int od = flavor_offset_cre[flavor_d], nd = num_cre[flavor_d];
+          if (nd == 0 || num_ann[flavor_c] == 0) {
             continue;
           }
-          const SCALAR coeff = coeffs[a][b][c][d] * scale_fact;
-          for (int il = 0; il < num_legendre; ++il) {
+          //S(a, (l', omega)) = sum_{d in flavor_d} exp(i omega (tau_a-tau_d)) Q_l'(d)
+          complex_matrix_t S(n, num_legendre * n_freq);
+          for (int im = 0; im < n_freq; ++im) {
+            const complex_matrix_t S_im = expiomega[im].middleCols(od, nd) * Q[flavor_c].middleRows(od, nd);
             for (int il_p = 0; il_p < num_legendre; ++il_p) {
-              const SCALAR coeff2 = coeff * sqrt_2l_1_Pl[a][b][il] * sqrt_2l_1_Pl_p[c][d][il_p];
-              for (int im = 0; im < n_freq; ++im) {
-                result[flavor_a][flavor_b][flavor_c][flavor_d][il][il_p][im] += coeff2 * expiomega[a][d][im];
+              S.col(il_p * n_freq + im) = S_im.col(il_p);
+            }
+          }
+          for (int flavor_a = 0; flavor_a < num_flavors; ++flavor_a) {
+            const int oa = flavor_offset_ann[flavor_a], na = num_ann[flavor_a];
+            if (na == 0) {
+              continue;
+            }
+            const complex_matrix_t S_a = coeff * S.middleRows(oa, na);
+            for (int flavor_b = 0; flavor_b < num_flavors; ++flavor_b) {
+              const int idx = flavor_map.index(flavor_a, flavor_b, flavor_c, flavor_d);
+              if (num_cre[flavor_b] == 0 || idx < 0) {
+                continue;
+              }
+              Eigen::Map<row_major_matrix_t>
+                  result_block(&result_est[idx][0][0][0], num_legendre, num_legendre * n_freq);
+              result_block.noalias() += P[flavor_b].middleRows(oa, na).transpose() * S_a;
+            }
+          }
+        }
+      }
+    }
+
+    for (int t = 0; t < X_exchange.size(); ++t) {
+      for (int flavor_b = 0; flavor_b < num_flavors; ++flavor_b) {
+        const int ob = flavor_offset_cre[flavor_b], nb = num_cre[flavor_b];
+        if (nb == 0) {
+          continue;
+        }
+        //U_l(a,c) = sum_{b in flavor_b} A_l(a,b) X(b,c)
+        std::vector<complex_matrix_t> U(num_legendre);
+        for (int il = 0; il < num_legendre; ++il) {
+          U[il] = sqrt_2l_1[il] * (Pl[il].middleCols(ob, nb) * X_exchange[t].middleRows(ob, nb));
+        }
+
+        for (int flavor_a = 0; flavor_a < num_flavors; ++flavor_a) {
+          const int oa = flavor_offset_ann[flavor_a], na = num_ann[flavor_a];
+          for (int flavor_d = 0; flavor_d < num_flavors; ++flavor_d) {
+            const int od = flavor_offset_cre[flavor_d], nd = num_cre[flavor_d];
+            if (na == 0 || nd == 0) {
+              continue;
+            }
+            //Z((a,d), omega) = Y(d,a) exp(i omega (tau_a-tau_d))
+            complex_matrix_t Z(na * nd, n_freq);
+            for (int im = 0; im < n_freq; ++im) {
+              for (int id = 0; id < nd; ++id) {
+                for (int ia = 0; ia < na; ++ia) {
+                  Z(ia + id * na, im) = coeff * Y_exchange[t](od + id, oa + ia) * expiomega[im](oa + ia, od + id);
+                }
+              }
+            }
+
+            for (int flavor_c = 0; flavor_c < num_flavors; ++flavor_c) {
+              const int oc = flavor_offset_ann[flavor_c], nc = num_ann[flavor_c];
+              const int idx = flavor_map.index(flavor_a, flavor_b, flavor_c, flavor_d);
+              if (nc == 0 || idx < 0) {
+                continue;
+              }
+              //V((a,d), (l,l')) = sum_{c in flavor_c} U_l(a,c) B_l'(c,d)
+              complex_matrix_t V(na * nd, num_legendre * num_legendre);
+              for (int il = 0; il < num_legendre; ++il) {
+                for (int il_p = 0; il_p < num_legendre; ++il_p) {
+                  Eigen::Map<complex_matrix_t>(V.col(il * num_legendre + il_p).data(), na, nd).noalias() =
+                      sqrt_2l_1_p[il_p] * (U[il].block(oa, oc, na, nc) * Pl[il_p].block(oc, od, nc, nd));
+                }
               }
+              Eigen::Map<row_major_matrix_t>
+                  result_block(&result_est[idx][0][0][0], num_legendre * num_legendre, n_freq);
+              result_block.noalias() -= V.transpose() * Z;
             }
           }
         }
@@ -535,28 +692,37 @@ void MeasureGHelper<SCALAR, 2>::perform(double beta,
 template<typename SCALAR, int Rank>
 void
 EqualTimeGMeasurement<SCALAR, Rank>::measure_G1(MonteCarloConfiguration<SCALAR> &mc_config,
-                                                alps::accumulators::accumulator_set &measurements,
+                                                AsyncObservableSink &sink,
                                                 const std::string &str) {
-  boost::multi_array<std::complex<double>, 2> data;
-  data.resize(boost::extents[num_flavors_][num_flavors_]);
-  std::fill(data.origin(), data.origin() + data.num_elements(), 0.0);
-
-  data[mc_config.p_worm->get_flavor(0)][mc_config.p_worm->get_flavor(1)] = mc_config.sign;
-
-  measure_simple_vector_observable<std::complex<double> >(measurements, str.c_str(), to_std_vector(data));
+  const int index = mc_config.p_worm->get_flavor(0) * num_flavors_ + mc_config.p_worm->get_flavor(1);
+  add_sample(index, mc_config.sign, sink, str);
 };
 
 template<typename SCALAR, int Rank>
 void
 EqualTimeGMeasurement<SCALAR, Rank>::measure_G2(MonteCarloConfiguration<SCALAR> &mc_config,
-                                                alps::accumulators::accumulator_set &measurements,
+                                                AsyncObservableSink &sink,
                                                 const std::string &str) {
-  boost::multi_array<std::complex<double>, 4> data;
-  data.resize(boost::extents[num_flavors_][num_flavors_][num_flavors_][num_flavors_]);
-  std::fill(data.origin(), data.origin() + data.num_elements(), 0.0);
+  int index = 0;
+  for (int f = 0; f < 4; ++f) {
+    index = index * num_flavors_ + mc_config.p_worm->get_flavor(f);
+  }
+  add_sample(index, mc_config.sign, sink, str);
+};
+
+template<typename SCALAR, int Rank>
+void
+EqualTimeGMeasurement<SCALAR, Rank>::add_sample(int index, SCALAR sign, AsyncObservableSink &sink,
+                                                const std::string &str) {
+  assert(index >= 0 && index < data_.size());
+  data_[index] += sign;
+  ++num_data_;
 
-  data[mc_config.p_worm->get_flavor(0)][mc_config.p_worm->get_flavor(1)]
-  [mc_config.p_worm->get_flavor(2)][mc_config.p_worm->get_flavor(3)] = mc_config.sign;
+  if (num_data_ == max_num_data_) {
+    //pass the averaged data to ALPS libraries
+    sink.push(str, &data_[0], data_.size(), 1. / max_num_data_);
 
-  measure_simple_vector_observable<std::complex<double> >(measurements, str.c_str(), to_std_vector(data));
+    num_data_ = 0;
+    std::fill(data_.begin(), data_.end(), 0.0);
+  }
 };
@@ -239,6 +239,54 @@ void ImpurityModelEigenBasis<SCALAR>::build_basis(const alps::params &par) {
       }
     }
   }
+
+  //[d, H_U] = [d, H_loc] - sum_j t_{flavor, j} d_j in the eigenbasis
+  //Note: <m|[d, H_loc]|n> = (E_n - E_m) <m|d|n>
+  d_comm_ops_eigen.resize(flavors);
+  for (int flavor = 0; flavor < flavors; ++flavor) {
+    d_comm_ops_eigen[flavor].resize(num_sectors);
+    for (int src_sector = 0; src_sector < num_sectors; ++src_sector) {
+      const dense_matrix_t &d_op = d_ops_eigen[flavor][src_sector];
+      dense_matrix_t &comm_op = d_comm_ops_eigen[flavor][src_sector];
+      comm_op.resize(d_op.rows(), d_op.cols());
+      if (d_op.size() == 0) {
+        continue;
+      }
+      const int dst_sector = Base::get_dst_sector_ket(ANNIHILATION_OP, flavor, src_sector);
+      for (int n = 0; n < d_op.cols(); ++n) {
+        for (int m = 0; m < d_op.rows(); ++m) {
+          comm_op(m, n) = (eigenvals_sector[src_sector][n] - eigenvals_sector[dst_sector][m]) * d_op(m, n);
+        }
+      }
+      for (int flavor2 = 0; flavor2 < flavors; ++flavor2) {
+        const SCALAR t = Base::hopping_rot(flavor, flavor2);
+        const dense_matrix_t &d_op2 = d_ops_eigen[flavor2][src_sector];
+        if (t == 0.0 || d_op2.size() == 0) {
+          continue;
+        }
+        if (Base::get_dst_sector_ket(ANNIHILATION_OP, flavor2, src_sector) != dst_sector) {
+          throw std::runtime_error("Hopping connects annihilation operators acting to different sectors");
+        }
+        comm_op -= t * d_op2;
+      }
+    }
+  }
+
+  //spectral norms of the operators for bounding the trace
+  //(slightly enlarged so that rounding errors never make the bound smaller than the trace)
+  const double safety_factor = 1 + 1E-8;
+  ddag_ops_norm.resize(flavors);
+  d_ops_norm.resize(flavors);
+  for (int flavor = 0; flavor < flavors; ++flavor) {
+    ddag_ops_norm[flavor].resize(num_sectors);
+    d_ops_norm[flavor].resize(num_sectors);
+    for (int src_sector = 0; src_sector < num_sectors; ++src_sector) {
+      ddag_ops_norm[flavor][src_sector] =
+          safety_factor * spectral_norm_diag<SCALAR>(ddag_ops_eigen[flavor][src_sector]);
+      d_ops_norm[flavor][src_sector] =
+          safety_factor * spectral_norm_diag<SCALAR>(d_ops_eigen[flavor][src_sector]);
+    }
+  }
 }
 
 template<typename SCALAR>
@@ -333,6 +381,23 @@ void ImpurityModelEigenBasis<SCALAR>::apply_op_hyb_ket(
   }
 }
 
+template<typename SCALAR>
+void ImpurityModelEigenBasis<SCALAR>::apply_commutator_hyb_ket(int flavor, BRAKET_T &ket) const {
+  if (ket.invalid()) {
+    return;
+  }
+
+  const int sector_new = Base::get_dst_sector_ket(ANNIHILATION_OP, flavor, ket.sector());
+  if (sector_new == nirvana) {
+    ket.set_invalid();
+    return;
+  }
+
+  dense_matrix_t work_mat = d_comm_ops_eigen[flavor][ket.sector()] * ket.obj();
+  ket.swap_obj(work_mat);
+  ket.set_sector(sector_new);
+}
+
 template<typename SCALAR>
 void ImpurityModelEigenBasis<SCALAR>::apply_op_hyb_bra(const OPERATOR_TYPE &op_type, int flavor, BRAKET_T &bra) const {
   using std::swap;
@@ -262,6 +262,22 @@ class ImpurityModel {
 
   bool translationally_invariant() const;
 
+  /**
+   * @brief Return true if the local Hamiltonian is invariant under the exchange of flavors (flavor -> flavor_map[flavor]).
+   *
+   * The trace is then invariant under the same exchange of the flavors of all the operators.
+   * This function is defined in model.ipp
+   */
+  bool is_invariant_under_flavor_exchange(const int *flavor_map, double eps = 1e-12) const;
+
+  /**
+   * @brief Return true if the number of electrons in the given flavors takes a single value in each sector.
+   *
+   * The number is then conserved by the local Hamiltonian.
+   * This function is defined in model.ipp
+   */
+  bool conserves_num_electrons(const std::vector<int> &flavors) const;
+
   /**
    * @brief Apply c^dagger c on a bra from the right hand side.
    */
@@ -309,6 +325,9 @@ class ImpurityModel {
 
   boost::multi_array<SCALAR, 4> U_tensor_rot;
 
+  //Index: cdag, c (in the rotated basis)
+  matrix_t hopping_rot;
+
   //fermionic operators
   std::vector<std::vector<sparse_matrix_t> > d_ops_sectors, ddag_ops_sectors;//flavor, sector
 
@@ -359,6 +378,8 @@ class ImpurityModelEigenBasis: public ImpurityModel<SCALAR, ImpurityModelEigenBa
 
   void apply_op_hyb_bra(const OPERATOR_TYPE &op_type, int flavor, BRAKET_T &bra) const;
   void apply_op_hyb_ket(const OPERATOR_TYPE &op_type, int flavor, BRAKET_T &ket) const;
+  //Apply [d_flavor, H_U] on a ket, where H_U is the interaction part of the local Hamiltonian
+  void apply_commutator_hyb_ket(int flavor, BRAKET_T &ket) const;
   typename ExtendedScalar<SCALAR>::value_type product(const BRAKET_T &bra, const BRAKET_T &ket) const;
 
   inline int dim_sector(int sector) const {
@@ -380,6 +401,12 @@ class ImpurityModelEigenBasis: public ImpurityModel<SCALAR, ImpurityModelEigenBa
     return num_braket_;
   }
 
+  //Spectral norm of the block of a creation/annihilation operator acting on a given sector
+  inline double op_norm(OPERATOR_TYPE op_type, int flavor, int src_sector) const {
+    assert(src_sector >= 0 && src_sector < Base::num_sectors());
+    return op_type == CREATION_OP ? ddag_ops_norm[flavor][src_sector] : d_ops_norm[flavor][src_sector];
+  }
+
   bool translationally_invariant() const;
 
  private:
@@ -391,6 +418,8 @@ class ImpurityModelEigenBasis: public ImpurityModel<SCALAR, ImpurityModelEigenBa
   std::vector<std::vector<double> > eigenvals_sector;
   std::vector<double> min_eigenval_sector;
   std::vector<std::vector<dense_matrix_t> > ddag_ops_eigen, d_ops_eigen;//flavor, sector
+  std::vector<std::vector<dense_matrix_t> > d_comm_ops_eigen;//[d, H_U], flavor, sector
+  std::vector<std::vector<double> > ddag_ops_norm, d_ops_norm;//flavor, sector
 
   int num_braket_;
   //equal to the number of active sectors
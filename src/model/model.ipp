@@ -505,6 +505,74 @@ split_op_into_sectors(int num_sectors,
   }
 }
 
+template<typename SCALAR, typename DERIVED>
+bool ImpurityModel<SCALAR, DERIVED>::is_invariant_under_flavor_exchange(const int *flavor_map, double eps) const {
+  //interaction and hopping
+  for (int flavor1 = 0; flavor1 < flavors_; ++flavor1) {
+    for (int flavor2 = 0; flavor2 < flavors_; ++flavor2) {
+      if (std::abs(hopping_rot(flavor_map[flavor1], flavor_map[flavor2]) - hopping_rot(flavor1, flavor2)) > eps) {
+        return false;
+      }
+      for (int flavor3 = 0; flavor3 < flavors_; ++flavor3) {
+        for (int flavor4 = 0; flavor4 < flavors_; ++flavor4) {
+          if (std::abs(
+              U_tensor_rot[flavor_map[flavor1]][flavor_map[flavor2]][flavor_map[flavor3]][flavor_map[flavor4]]
+                  - U_tensor_rot[flavor1][flavor2][flavor3][flavor4]) > eps) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  //The exchange must map a sector to a sector of the same dimension
+  std::vector<int> dst_sector(num_sectors_, -1);
+  for (int state = 0; state < dim_; ++state) {
+    int state_new = 0;
+    for (int flavor = 0; flavor < flavors_; ++flavor) {
+      if (state & (1 << flavor)) {
+        state_new |= 1 << flavor_map[flavor];
+      }
+    }
+    const int sector = sector_of_state[state];
+    if (dst_sector[sector] < 0) {
+      dst_sector[sector] = sector_of_state[state_new];
+    } else if (dst_sector[sector] != sector_of_state[state_new]) {
+      return false;
+    }
+  }
+  for (int sector = 0; sector < num_sectors_; ++sector) {
+    if (dim_sectors[sector] != dim_sectors[dst_sector[sector]]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename SCALAR, typename DERIVED>
+bool ImpurityModel<SCALAR, DERIVED>::conserves_num_electrons(const std::vector<int> &flavors) const {
+  int mask = 0;
+  for (int i = 0; i < flavors.size(); ++i) {
+    mask |= 1 << flavors[i];
+  }
+  std::vector<int> num_elec_sector(num_sectors_, -1);
+  for (int state = 0; state < dim_; ++state) {
+    int num_elec = 0;
+    for (int flavor = 0; flavor < flavors_; ++flavor) {
+      if (state & mask & (1 << flavor)) {
+        ++num_elec;
+      }
+    }
+    const int sector = sector_of_state[state];
+    if (num_elec_sector[sector] < 0) {
+      num_elec_sector[sector] = num_elec;
+    } else if (num_elec_sector[sector] != num_elec) {
+      return false;
+    }
+  }
+  return true;
+}
+
 template<typename SCALAR, typename DERIVED>
 void ImpurityModel<SCALAR, DERIVED>::hilbert_space_partioning(const alps::params &par) {
   const double eps_numerics = 1E-12;
@@ -552,7 +620,7 @@ void ImpurityModel<SCALAR, DERIVED>::hilbert_space_partioning(const alps::params
       }
     }
   }
-  matrix_t hopping_rot = rotmat_Delta.adjoint() * hopping_org_basis * rotmat_Delta;
+  hopping_rot = rotmat_Delta.adjoint() * hopping_org_basis * rotmat_Delta;
 
   //Build sparse matrix representation of fermionic operators
   std::vector<sparse_matrix_t> d_ops, ddag_ops;
@@ -7,6 +7,7 @@
 #include <boost/assert.hpp>
 #include <boost/optional.hpp>
 #include <boost/optional/optional_io.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/math/special_functions/factorials.hpp>
 #include <boost/math/special_functions/binomial.hpp>
 #include <boost/range/algorithm.hpp>
@@ -31,6 +32,16 @@ struct ExchangeFlavor {
     );
     return op_new;
   }
+
+  /** The new hybridization matrix is identical to the old one if F is invariant under the exchange */
+  template<typename GreensFunction>
+  bool preserves_hybridization(const GreensFunction &gf) const {
+    return gf.is_invariant_under_flavor_exchange(first_);
+  }
+
+  int antiperiodic_sign(const psi &op) const {
+    return 1;
+  }
  private:
   int *first_;
 };
@@ -59,10 +70,178 @@ struct OperatorShift {
     op_new.set_time(new_time);
     return op_new;
   }
+
+  /** The new hybridization matrix differs from the old one only by the signs of rows and cols */
+  template<typename GreensFunction>
+  bool preserves_hybridization(const GreensFunction &gf) const {
+    return true;
+  }
+
+  /** F(tau-beta) = -F(tau): an operator winding around beta changes the sign of its row/col */
+  int antiperiodic_sign(const psi &op) const {
+    return op.time().time() + shift_ > beta_ ? -1 : 1;
+  }
  private:
   double beta_, shift_;
 };
 
+/**
+ * @brief Proposal of a new flavor for a creation/annihilation operator hybridized with the bath
+ *
+ * Flavor f2 is a candidate for replacing flavor f1 only if
+ *  (1) f1 and f2 belong to the same connected component of the hybridization function (otherwise the determinant vanishes),
+ *  (2) there is a sector on which the operators of f1 and f2 act nontrivially (otherwise the trace vanishes).
+ * This relation is symmetric. A candidate is picked with equal probability.
+ */
+class FlavorProposer {
+ public:
+  FlavorProposer() {}
+
+  template<typename MODEL, typename GreensFunction>
+  FlavorProposer(const MODEL &model, const GreensFunction &gf)
+      : candidates_(boost::extents[2][model.num_flavors()]) {
+    const int num_flavors = model.num_flavors();
+
+    //connected components of the hybridization function
+    std::vector<int> component(num_flavors);
+    for (int flavor = 0; flavor < num_flavors; ++flavor) {
+      component[flavor] = flavor;
+    }
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (int f1 = 0; f1 < num_flavors; ++f1) {
+        for (int f2 = 0; f2 < num_flavors; ++f2) {
+          if ((gf.is_connected(f1, f2) || gf.is_connected(f2, f1)) && component[f1] != component[f2]) {
+            component[f1] = component[f2] = std::min(component[f1], component[f2]);
+            changed = true;
+          }
+        }
+      }
+    }
+
+    for (int op = 0; op < 2; ++op) {
+      for (int f1 = 0; f1 < num_flavors; ++f1) {
+        for (int f2 = 0; f2 < num_flavors; ++f2) {
+          if (f1 != f2 && component[f1] == component[f2]
+              && act_on_common_sector(model, static_cast<OPERATOR_TYPE>(op), f1, f2)) {
+            candidates_[op][f1].push_back(f2);
+          }
+        }
+      }
+    }
+  }
+
+  int num_candidates(OPERATOR_TYPE op_type, int flavor) const {
+    return candidates_[op_type][flavor].size();
+  }
+
+  /** Pick a flavor different from the given one. Return -1 if there is no candidate. */
+  int propose(OPERATOR_TYPE op_type, int flavor, alps::random01 &rng) const {
+    const std::vector<int> &candidates = candidates_[op_type][flavor];
+    return candidates.empty() ? -1 : candidates[static_cast<int>(candidates.size() * rng())];
+  }
+
+  /** Ratio of the probability of proposing the reverse move to that of the forward move */
+  double proposal_ratio(OPERATOR_TYPE op_type, int old_flavor, int new_flavor) const {
+    return (1.0 * num_candidates(op_type, old_flavor)) / num_candidates(op_type, new_flavor);
+  }
+
+ private:
+  template<typename MODEL>
+  static bool act_on_common_sector(const MODEL &model, OPERATOR_TYPE op_type, int flavor1, int flavor2) {
+    for (int sector = 0; sector < model.num_sectors(); ++sector) {
+      if (model.get_dst_sector_ket(op_type, flavor1, sector) != nirvana
+          && model.get_dst_sector_ket(op_type, flavor2, sector) != nirvana) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  boost::multi_array<std::vector<int>, 2> candidates_;//candidates_[op_type][flavor]
+};
+
+/**
+ * @brief Proposal of the times of a pair of creation and annihilation operators restricted by the sector path
+ *
+ * A new pair can yield a non-zero trace only if the earlier of the two operators acts on the sector of some braket
+ * at its time in the current configuration (allowed intervals, see SlidingWindowManager::compute_allowed_intervals).
+ * The earlier operator is placed at t in its allowed intervals with a density proportional to (tau_high - t),
+ * and the later one uniformly in (t, tau_high).
+ * The joint density of (t_cdagg, t_c) is then 1/Z if the earlier operator is in an allowed interval, and 0 otherwise.
+ * If the whole window is allowed, Z = (tau_high - tau_low)^2 as for the uniform proposal.
+ */
+class PairTimeProposer {
+ public:
+  typedef std::vector<std::pair<double, double> > intervals_t;
+
+  PairTimeProposer() : tau_high_(0.0), norm_(0.0) {}
+
+  /** Set the allowed intervals of the creation operator (op_type=0) and the annihilation operator (op_type=1) */
+  void set_intervals(double tau_high, const intervals_t &intervals_cdagg, const intervals_t &intervals_c) {
+    tau_high_ = tau_high;
+    intervals_[0] = intervals_cdagg;
+    intervals_[1] = intervals_c;
+    norm_ = 0.0;
+    for (int op = 0; op < 2; ++op) {
+      cumulative_mass_[op].resize(intervals_[op].size());
+      for (int i = 0; i < intervals_[op].size(); ++i) {
+        const double a = tau_high_ - intervals_[op][i].first;
+        const double b = tau_high_ - intervals_[op][i].second;
+        norm_ += 0.5 * (a * a - b * b);
+        cumulative_mass_[op][i] = norm_;
+      }
+    }
+  }
+
+  /** Normalization constant Z. Zero if no pair can be inserted. */
+  double normalization() const { return norm_; }
+
+  /** Density of proposing (t_cdagg, t_c) */
+  double density(double t_cdagg, double t_c) const {
+    if (norm_ == 0.0) {
+      return 0.0;
+    }
+    const bool cdagg_first = t_cdagg < t_c;
+    return is_allowed(cdagg_first ? 0 : 1, cdagg_first ? t_cdagg : t_c) ? 1.0 / norm_ : 0.0;
+  }
+
+  /** Propose (t_cdagg, t_c). The normalization constant must be positive. */
+  std::pair<double, double> propose(alps::random01 &rng) const {
+    assert(norm_ > 0.0);
+    const double r = rng() * norm_;
+    const int op = (!cumulative_mass_[0].empty() && r < cumulative_mass_[0].back()) || cumulative_mass_[1].empty() ? 0 : 1;
+    const int i = std::min<int>(
+        std::upper_bound(cumulative_mass_[op].begin(), cumulative_mass_[op].end(), r) - cumulative_mass_[op].begin(),
+        intervals_[op].size() - 1
+    );
+
+    //sample s = tau_high - t with a density proportional to s
+    const double a = tau_high_ - intervals_[op][i].first;
+    const double b = tau_high_ - intervals_[op][i].second;
+    const double t_first = std::min(
+        std::max(tau_high_ - std::sqrt(b * b + rng() * (a * a - b * b)), intervals_[op][i].first),
+        intervals_[op][i].second);
+    const double t_second = open_random(rng, t_first, tau_high_);
+    return op == 0 ? std::make_pair(t_first, t_second) : std::make_pair(t_second, t_first);
+  }
+
+ private:
+  bool is_allowed(int op, double t) const {
+    for (int i = 0; i < intervals_[op].size(); ++i) {
+      if (intervals_[op][i].first <= t && t <= intervals_[op][i].second) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  double tau_high_, norm_;
+  intervals_t intervals_[2];
+  std::vector<double> cumulative_mass_[2];
+};
+
 template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
 class LocalUpdater {
   typedef std::map<ConfigSpace, double> weight_map_t;
@@ -161,10 +340,15 @@ template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
 class InsertionRemovalUpdater: public LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW> {
  public:
   typedef LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW> BaseType;
-  InsertionRemovalUpdater(int update_rank, int num_flavors)
+  /**
+   * If sector_aware is true, one-pair updates propose the times of new operators only
+   * where they may yield a non-zero trace (see PairTimeProposer).
+   */
+  InsertionRemovalUpdater(int update_rank, int num_flavors, bool sector_aware = false)
       : BaseType(boost::lexical_cast<std::string>(update_rank) + std::string("-pair_insertion_remover")),
         update_rank_(update_rank),
         num_flavors_(num_flavors),
+        sector_aware_(sector_aware && update_rank == 1),
         tau_low_(-1.0),
         tau_high_(-1.0) {}
 
@@ -179,11 +363,15 @@ class InsertionRemovalUpdater: public LocalUpdater<SCALAR, EXTENDED_SCALAR, SLID
   typedef operator_container_t::iterator it_t;
 
   const int num_flavors_;
+  const bool sector_aware_;
   double tau_low_, tau_high_; //, max_distance_;
 
   std::vector<int> num_cdagg_ops_in_range_, num_c_ops_in_range_;
   std::vector<std::pair<it_t, it_t> > cdagg_ops_range_, c_ops_range_;
 
+  PairTimeProposer pair_time_proposer_;
+  PairTimeProposer::intervals_t intervals_cdagg_, intervals_c_;
+
   /** 1 for two-operator update, 2 for four-operator update, ..., N for 2N-operator update*/
   const int update_rank_;
 
@@ -191,13 +379,23 @@ class InsertionRemovalUpdater: public LocalUpdater<SCALAR, EXTENDED_SCALAR, SLID
  * Propose insertion update
  */
   bool propose_insertion(alps::random01 &rng,
-                         MonteCarloConfiguration<SCALAR> &mc_config);
+                         MonteCarloConfiguration<SCALAR> &mc_config,
+                         const SLIDING_WINDOW &sliding_window);
 
 /**
  * Propose removal update
  */
   bool propose_removal(alps::random01 &rng,
-                       MonteCarloConfiguration<SCALAR> &mc_config);
+                       MonteCarloConfiguration<SCALAR> &mc_config,
+                       const SLIDING_WINDOW &sliding_window);
+
+/**
+ * Set up pair_time_proposer_ for the given flavors in the configuration without excluded_ops
+ */
+  void set_up_pair_time_proposer(MonteCarloConfiguration<SCALAR> &mc_config,
+                                 const SLIDING_WINDOW &sliding_window,
+                                 const std::vector<psi> &excluded_ops,
+                                 int flavor_cdagg, int flavor_c);
 };
 
 /**
@@ -255,9 +453,9 @@ template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
 class OperatorPairFlavorUpdater: public LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW> {
  public:
   typedef LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW> BaseType;
-  OperatorPairFlavorUpdater(int num_flavors)
+  OperatorPairFlavorUpdater(const FlavorProposer &flavor_proposer)
       : BaseType("Operator_pair_flavor_updater"),
-        num_flavors_(num_flavors),
+        flavor_proposer_(flavor_proposer),
         num_attempted_(0.0),
         num_accepted_(0.0) {}
 
@@ -269,7 +467,7 @@ class OperatorPairFlavorUpdater: public LocalUpdater<SCALAR, EXTENDED_SCALAR, SL
   );
 
  private:
-  const int num_flavors_;
+  const FlavorProposer flavor_proposer_;
   double num_attempted_, num_accepted_;
 };
 
@@ -281,9 +479,10 @@ template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
 class SingleOperatorShiftUpdater: public LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW> {
  public:
   typedef LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW> BaseType;
-  SingleOperatorShiftUpdater(double beta, int num_flavors, int num_bins) :
+  SingleOperatorShiftUpdater(double beta, int num_flavors, int num_bins, const FlavorProposer &flavor_proposer) :
       BaseType("Single_operator_shift_updater"),
       num_flavors_(num_flavors),
+      flavor_proposer_(flavor_proposer),
       max_distance_(num_flavors, 0.5 * beta),
       acc_rate_(num_bins, 0.5 * beta, num_flavors, 0.5 * beta) {}
 
@@ -307,15 +506,31 @@ class SingleOperatorShiftUpdater: public LocalUpdater<SCALAR, EXTENDED_SCALAR, S
 
  private:
   int num_flavors_;
+  const FlavorProposer flavor_proposer_;
   StepSizeOptimizer acc_rate_;
 
   std::vector<double> max_distance_;
   double distance_;
   int flavor_;
+};
+
+/**
+ * @brief LU decompositions of the blocks of the determinant matrix computed in a global update
+ *
+ * They are reused for building the inverse matrices when the update is accepted.
+ */
+template<typename SCALAR>
+struct BlockLUDecomposition {
+  typedef Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+
+  std::vector<std::vector<psi> > cdagg_ops, c_ops;
+  std::vector<Eigen::PartialPivLU<matrix_t> > lu;
 
-  static int gen_new_flavor(const MonteCarloConfiguration<SCALAR> &mc_config, int old_flavor, alps::random01 &rng);
+  std::vector<matrix_t> compute_inverse_matrices() const;
 };
 
+//Global update transforming all the operators.
+//If trace_invariant is true, the trace is assumed to be unchanged (e.g. a symmetry of the local Hamiltonian) and not computed.
 template<typename SCALAR, typename EXTENDED_SCALAR, typename R, typename SLIDING_WINDOW,
     typename HybridizedOperatorTransformer, typename WormTransformer>
 bool
@@ -324,10 +539,12 @@ global_update(R &rng,
               MonteCarloConfiguration<SCALAR> &mc_config,
               std::vector<SCALAR> &det_vec,
               SLIDING_WINDOW &sliding_window,
+              SLIDING_WINDOW &scratch_window,
               int num_flavors,
               const HybridizedOperatorTransformer &hyb_op_transformer,
               const WormTransformer &worm_transformer,
-              int Nwin
+              int Nwin,
+              bool trace_invariant = false
 );
 
 /**
@@ -49,12 +49,13 @@ struct OutOfRange {
   double tau_low_, tau_high_;
 };
 
+template<typename Container>
 inline void merge_diff_impl(
     std::vector<psi> &op_rem,
     std::vector<psi> &op_add,
-    const std::vector<psi> &op_add_new) {
+    const Container &op_add_new) {
 
-  for (std::vector<psi>::const_iterator it = op_add_new.begin(); it != op_add_new.end(); ++it) {
+  for (typename Container::const_iterator it = op_add_new.begin(); it != op_add_new.end(); ++it) {
     std::vector<psi>::iterator it2 = std::find(op_rem.begin(), op_rem.end(), *it);
     if (it2 == op_rem.end()) {
       op_add.push_back(*it);
@@ -67,8 +68,8 @@ inline void merge_diff_impl(
 
 inline void merge_diff(const std::vector<psi> &hyb_op_rem,
                        const std::vector<psi> &hyb_op_add,
-                       const std::vector<psi> &worm_op_rem,
-                       const std::vector<psi> &worm_op_add,
+                       const worm_operators_t &worm_op_rem,
+                       const worm_operators_t &worm_op_add,
                        std::vector<psi> &op_rem,
                        std::vector<psi> &op_add) {
   op_rem.resize(0);
@@ -110,6 +111,8 @@ bool LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::update(
 
   //Figure out which operators are actually removed and what operators are added into the trace
   std::vector<psi> op_rem_tot, op_add_tot;
+  const worm_operators_t worm_ops_old = mc_config.p_worm ? mc_config.p_worm->get_operators() : worm_operators_t();
+  const worm_operators_t worm_ops_new = p_new_worm_ ? p_new_worm_->get_operators() : worm_operators_t();
   {
     std::vector<psi> hyb_op_rem, hyb_op_add;
     hyb_op_rem.reserve(cdagg_ops_rem_.size() + c_ops_rem_.size());
@@ -120,9 +123,6 @@ bool LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::update(
     std::copy(cdagg_ops_add_.begin(), cdagg_ops_add_.end(), std::back_inserter(hyb_op_add));
     std::copy(c_ops_add_.begin(), c_ops_add_.end(), std::back_inserter(hyb_op_add));
 
-    const std::vector<psi> worm_ops_old = mc_config.p_worm ? mc_config.p_worm->get_operators() : std::vector<psi>();
-    const std::vector<psi> worm_ops_new = p_new_worm_ ? p_new_worm_->get_operators() : std::vector<psi>();
-
     merge_diff(hyb_op_rem, hyb_op_add, worm_ops_old, worm_ops_new, op_rem_tot, op_add_tot);
 
     range_check(op_rem_tot, tau_low, tau_high);
@@ -196,7 +196,12 @@ bool LocalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::update(
     mc_config.M.perform_update();
     mc_config.trace = trace_new;
     mc_config.p_worm = p_new_worm_;
-    const int perm_new = compute_permutation_sign(mc_config);
+    const int perm_new = mc_config.perm_sign * compute_permutation_sign_change(
+        mc_config.M.get_cdagg_ops_set(), mc_config.M.get_c_ops_set(),
+        cdagg_ops_rem_, c_ops_rem_, cdagg_ops_add_, c_ops_add_,
+        worm_ops_old, worm_ops_new
+    );
+    assert(perm_new == compute_permutation_sign(mc_config));
     mc_config.sign *= (1. * perm_new / mc_config.perm_sign) * mysign(prob);
     mc_config.perm_sign = perm_new;
     assert(!my_isnan(mc_config.sign));
@@ -292,40 +297,67 @@ bool InsertionRemovalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose(
   }
 
   if (rng() < 0.5) {
-    return propose_insertion(rng, mc_config);
+    return propose_insertion(rng, mc_config, sliding_window);
   } else {
-    return propose_removal(rng, mc_config);
+    return propose_removal(rng, mc_config, sliding_window);
   }
 }
 
+template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
+void InsertionRemovalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::set_up_pair_time_proposer(
+    MonteCarloConfiguration<SCALAR> &mc_config,
+    const SLIDING_WINDOW &sliding_window,
+    const std::vector<psi> &excluded_ops,
+    int flavor_cdagg, int flavor_c) {
+  sliding_window.compute_allowed_intervals(mc_config.operators, excluded_ops, CREATION_OP, flavor_cdagg, intervals_cdagg_);
+  sliding_window.compute_allowed_intervals(mc_config.operators, excluded_ops, ANNIHILATION_OP, flavor_c, intervals_c_);
+  pair_time_proposer_.set_intervals(tau_high_, intervals_cdagg_, intervals_c_);
+}
+
 
 template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
 bool InsertionRemovalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose_insertion(
     alps::random01 &rng,
-    MonteCarloConfiguration<SCALAR> &mc_config) {
+    MonteCarloConfiguration<SCALAR> &mc_config,
+    const SLIDING_WINDOW &sliding_window) {
   namespace bll = boost::lambda;
   typedef operator_container_t::iterator it_t;
 
   const int num_blocks = mc_config.M.num_blocks();
   std::vector<int> num_new_pairs(num_blocks, 0);
-  for (int iop = 0; iop < update_rank_; ++iop) {
+  if (sector_aware_) {
     const int block = static_cast<int>(rng() * num_blocks);
     num_new_pairs[block] += 1;
-    BaseType::cdagg_ops_add_.push_back(
-        psi(open_random(rng, tau_low_, tau_high_),
-            CREATION_OP,
-            pick(mc_config.M.flavors(block), rng)
-        )
-    );
-    BaseType::c_ops_add_.push_back(
-        psi(open_random(rng, tau_low_, tau_high_),
-            ANNIHILATION_OP,
-            pick(mc_config.M.flavors(block), rng)
-        )
-    );
+    const int flavor_cdagg = pick(mc_config.M.flavors(block), rng);
+    const int flavor_c = pick(mc_config.M.flavors(block), rng);
+    set_up_pair_time_proposer(mc_config, sliding_window, std::vector<psi>(), flavor_cdagg, flavor_c);
+    if (pair_time_proposer_.normalization() == 0.0) {
+      return false;
+    }
+    const std::pair<double, double> times = pair_time_proposer_.propose(rng);
+    BaseType::cdagg_ops_add_.push_back(psi(times.first, CREATION_OP, flavor_cdagg));
+    BaseType::c_ops_add_.push_back(psi(times.second, ANNIHILATION_OP, flavor_c));
+  } else {
+    for (int iop = 0; iop < update_rank_; ++iop) {
+      const int block = static_cast<int>(rng() * num_blocks);
+      num_new_pairs[block] += 1;
+      BaseType::cdagg_ops_add_.push_back(
+          psi(open_random(rng, tau_low_, tau_high_),
+              CREATION_OP,
+              pick(mc_config.M.flavors(block), rng)
+          )
+      );
+      BaseType::c_ops_add_.push_back(
+          psi(open_random(rng, tau_low_, tau_high_),
+              ANNIHILATION_OP,
+              pick(mc_config.M.flavors(block), rng)
+          )
+      );
+    }
   }
 
-  BaseType::acceptance_rate_correction_ = std::pow(tau_high_ - tau_low_, 2. * update_rank_);
+  BaseType::acceptance_rate_correction_ =
+      sector_aware_ ? pair_time_proposer_.normalization() : std::pow(tau_high_ - tau_low_, 2. * update_rank_);
   for (int ib = 0; ib < num_blocks; ++ib) {
     if (num_new_pairs[ib] == 0) {
       continue;
@@ -353,7 +385,8 @@ bool InsertionRemovalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose_i
 template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
 bool InsertionRemovalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose_removal(
     alps::random01 &rng,
-    MonteCarloConfiguration<SCALAR> &mc_config) {
+    MonteCarloConfiguration<SCALAR> &mc_config,
+    const SLIDING_WINDOW &sliding_window) {
 
   const int num_blocks = mc_config.M.num_blocks();
   std::vector<int> num_pairs_rem(num_blocks);
@@ -388,7 +421,20 @@ bool InsertionRemovalUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose_r
     }
   }
 
-  BaseType::acceptance_rate_correction_ = 1.0 / std::pow(tau_high_ - tau_low_, 2. * update_rank_);
+  if (sector_aware_) {
+    //density of proposing the reverse insertion from the configuration without the pair
+    std::vector<psi> ops_rem(BaseType::cdagg_ops_rem_);
+    ops_rem.insert(ops_rem.end(), BaseType::c_ops_rem_.begin(), BaseType::c_ops_rem_.end());
+    set_up_pair_time_proposer(mc_config, sliding_window, ops_rem,
+                              BaseType::cdagg_ops_rem_[0].flavor(), BaseType::c_ops_rem_[0].flavor());
+    BaseType::acceptance_rate_correction_ = pair_time_proposer_.density(
+        BaseType::cdagg_ops_rem_[0].time().time(), BaseType::c_ops_rem_[0].time().time());
+    if (*BaseType::acceptance_rate_correction_ == 0.0) {
+      return false;
+    }
+  } else {
+    BaseType::acceptance_rate_correction_ = 1.0 / std::pow(tau_high_ - tau_low_, 2. * update_rank_);
+  }
   for (int ib = 0; ib < num_blocks; ++ib) {
     if (num_pairs_rem[ib] == 0) {
       continue;
@@ -565,25 +611,32 @@ bool OperatorPairFlavorUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose
     return false;
   }
 
-  if (rng() < 0.5) {
-    //asign a new random flavor to one of creation operators
-    it_t it_cdagg = cdagg_range.first;
-    std::advance(it_cdagg, static_cast<int>(num_cdagg_ops * rng()));
-    BaseType::cdagg_ops_rem_.push_back(*it_cdagg);
-    psi cdagg_op_new = *it_cdagg;
-    cdagg_op_new.set_flavor(static_cast<int>(num_flavors_ * rng()));
-    BaseType::cdagg_ops_add_.push_back(cdagg_op_new);
+  //asign a new flavor to one of creation or annihilation operators.
+  //Only flavors which do not make the determinant or the trace vanish trivially are proposed.
+  const bool update_cdagg = rng() < 0.5;
+  it_t it_op;
+  if (update_cdagg) {
+    it_op = cdagg_range.first;
+    std::advance(it_op, static_cast<int>(num_cdagg_ops * rng()));
   } else {
-    //asign a new random flavor to one of annihilation operators
-    it_t it_c = c_range.first;
-    std::advance(it_c, static_cast<int>(num_c_ops * rng()));
-    BaseType::c_ops_rem_.push_back(*it_c);
-    psi c_op_new = *it_c;
-    c_op_new.set_flavor(static_cast<int>(num_flavors_ * rng()));
-    BaseType::c_ops_add_.push_back(c_op_new);
+    it_op = c_range.first;
+    std::advance(it_op, static_cast<int>(num_c_ops * rng()));
+  }
+  const int new_flavor = flavor_proposer_.propose(it_op->type(), it_op->flavor(), rng);
+  if (new_flavor < 0) {
+    return false;
+  }
+  psi op_new = *it_op;
+  op_new.set_flavor(new_flavor);
+  if (update_cdagg) {
+    BaseType::cdagg_ops_rem_.push_back(*it_op);
+    BaseType::cdagg_ops_add_.push_back(op_new);
+  } else {
+    BaseType::c_ops_rem_.push_back(*it_op);
+    BaseType::c_ops_add_.push_back(op_new);
   }
 
-  BaseType::acceptance_rate_correction_ = 1.0;
+  BaseType::acceptance_rate_correction_ = flavor_proposer_.proposal_ratio(it_op->type(), it_op->flavor(), new_flavor);
 
   return true;
 }
@@ -615,32 +668,41 @@ bool SingleOperatorShiftUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propos
 
   const int idx = static_cast<int>(rng() * (num_cdagg_ops + num_c_ops));
 
+  IteratorType it;
   if (idx < num_cdagg_ops) {
-    IteratorType it = cdagg_ops_range.first;
+    it = cdagg_ops_range.first;
     std::advance(it, idx);
-    flavor_ = it->flavor();
-    const int new_flavor = rng() < 0.5 ? it->flavor() : gen_new_flavor(mc_config, flavor_, rng);
-    const double new_time = (2 * rng() - 1.0) * max_distance_[flavor_] + it->time().time();
-    if (new_time < tau_low || new_time > tau_high) { return false; }
-    distance_ = std::abs(it->time().time() - new_time);
+  } else {
+    it = c_ops_range.first;
+    std::advance(it, idx - num_cdagg_ops);
+  }
+  flavor_ = it->flavor();
+
+  //keep the flavor with probability 1/2, otherwise pick one of the candidates
+  int new_flavor = flavor_;
+  if (rng() < 0.5) {
+    const int flavor_proposed = flavor_proposer_.propose(it->type(), flavor_, rng);
+    if (flavor_proposed >= 0) {
+      new_flavor = flavor_proposed;
+    }
+  }
+
+  const double new_time = (2 * rng() - 1.0) * max_distance_[flavor_] + it->time().time();
+  if (new_time < tau_low || new_time > tau_high) { return false; }
+  distance_ = std::abs(it->time().time() - new_time);
+  if (idx < num_cdagg_ops) {
     BaseType::cdagg_ops_rem_.push_back(*it);
     BaseType::cdagg_ops_add_.push_back(
         psi(new_time, CREATION_OP, new_flavor)
     );
   } else {
-    IteratorType it = c_ops_range.first;
-    std::advance(it, idx - num_cdagg_ops);
-    flavor_ = it->flavor();
-    const int new_flavor = rng() < 0.5 ? it->flavor() : gen_new_flavor(mc_config, flavor_, rng);
-    const double new_time = (2 * rng() - 1.0) * max_distance_[flavor_] + it->time().time();
-    if (new_time < tau_low || new_time > tau_high) { return false; }
-    distance_ = std::abs(it->time().time() - new_time);
     BaseType::c_ops_rem_.push_back(*it);
     BaseType::c_ops_add_.push_back(
         psi(new_time, ANNIHILATION_OP, new_flavor)
     );
   }
-  BaseType::acceptance_rate_correction_ = 1.0;
+  BaseType::acceptance_rate_correction_ =
+      new_flavor == flavor_ ? 1.0 : flavor_proposer_.proposal_ratio(it->type(), flavor_, new_flavor);
   return true;
 }
 
@@ -681,13 +743,6 @@ measure_acc_rate(alps::accumulators::accumulator_set &measurements) {
   acc_rate_.reset();
 }
 
-template<typename SCALAR, typename EXTENDED_SCALAR, typename SLIDING_WINDOW>
-int SingleOperatorShiftUpdater<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::
-gen_new_flavor(const MonteCarloConfiguration<SCALAR> &mc_config, int old_flavor, alps::random01 &rng) {
-  const int block = mc_config.M.block_belonging_to(old_flavor);
-  return pick(mc_config.M.flavors(block), rng);
-}
-
 template<typename SCALAR>
 SCALAR compute_det_rat(
     const std::vector<SCALAR> &det_vec_new,
@@ -709,31 +764,48 @@ SCALAR compute_det_rat(
   return det_rat;
 }
 
-template<typename Scalar, typename M>
+template<typename Scalar, typename LU>
 std::vector<Scalar>
-lu_product(const M &matrix) {
-  if (matrix.rows() == 0) {
+lu_product(const LU &lu) {
+  if (lu.rows() == 0) {
     return std::vector<Scalar>();
   }
-  Eigen::FullPivLU<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> > lu(matrix);
   const int size1 = lu.rows();
   std::vector<Scalar> results(size1);
   for (int i = 0; i < size1; ++i) {
     results[i] = lu.matrixLU()(i, i);
   }
-  results[0] *= lu.permutationP().determinant() * lu.permutationQ().determinant();
+  results[0] *= lu.permutationP().determinant();
   return results;
 };
 
+template<typename SCALAR>
+std::vector<typename BlockLUDecomposition<SCALAR>::matrix_t>
+BlockLUDecomposition<SCALAR>::compute_inverse_matrices() const {
+  std::vector<matrix_t> inv(lu.size());
+  for (int ib = 0; ib < lu.size(); ++ib) {
+    if (cdagg_ops[ib].size() == 0) {
+      inv[ib].resize(0, 0);
+    } else {
+      inv[ib] = lu[ib].inverse();
+    }
+  }
+  return inv;
+}
+
 template<typename SCALAR, typename GreensFunction, typename DetMatType>
 SCALAR compute_det_rat(const std::vector<psi> &creation_operators,
                        const std::vector<psi> &annihilation_operators,
                        std::vector<SCALAR> &det_vec_old,
                        DetMatType &M,
-                       std::vector<SCALAR> &det_vec_new
+                       std::vector<SCALAR> &det_vec_new,
+                       BlockLUDecomposition<SCALAR> &block_lu
 ) {
-  typedef alps::fastupdate::ResizableMatrix<SCALAR> M_TYPE;
-  std::vector<std::vector<psi> > cdagg_ops(M.num_blocks()), c_ops(M.num_blocks());
+  std::vector<std::vector<psi> > &cdagg_ops = block_lu.cdagg_ops;
+  std::vector<std::vector<psi> > &c_ops = block_lu.c_ops;
+  cdagg_ops.assign(M.num_blocks(), std::vector<psi>());
+  c_ops.assign(M.num_blocks(), std::vector<psi>());
+  block_lu.lu.resize(M.num_blocks());
 
   for (std::vector<psi>::const_iterator it = creation_operators.begin(); it != creation_operators.end(); ++it) {
     cdagg_ops[M.block_belonging_to(it->flavor())].push_back(*it);
@@ -756,13 +828,10 @@ SCALAR compute_det_rat(const std::vector<psi> &creation_operators,
     if (mat_size == 0) {
       continue;
     }
-    Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> M_new(mat_size, mat_size);
-    for (int col = 0; col < mat_size; ++col) {
-      for (int row = 0; row < mat_size; ++row) {
-        M_new(row, col) = p_gf->operator()(c_ops[ib][row], cdagg_ops[ib][col]);
-      }
-    }
-    const std::vector<SCALAR> &vec_tmp = lu_product<SCALAR>(M_new);
+    typename BlockLUDecomposition<SCALAR>::matrix_t M_new(mat_size, mat_size);
+    p_gf->fill_block(c_ops[ib].begin(), c_ops[ib].end(), cdagg_ops[ib].begin(), cdagg_ops[ib].end(), M_new);
+    block_lu.lu[ib].compute(M_new);
+    const std::vector<SCALAR> &vec_tmp = lu_product<SCALAR>(block_lu.lu[ib]);
     std::copy(vec_tmp.begin(), vec_tmp.end(), std::back_inserter(det_vec_new));
 
     for (int col = 0; col < mat_size; ++col) {
@@ -798,13 +867,13 @@ global_update(R &rng,
               MonteCarloConfiguration<SCALAR> &mc_config,
               std::vector<SCALAR> &det_vec,
               SLIDING_WINDOW &sliding_window,
+              SLIDING_WINDOW &scratch_window,
               int num_flavors,
               const HybridizedOperatorTransformer &hyb_op_transformer,
               const WormTransformer &worm_transformer,
-              int Nwin
+              int Nwin,
+              bool trace_invariant
 ) {
-  assert(sliding_window.get_tau_low() == 0);
-  assert(sliding_window.get_tau_high() == BETA);
   mc_config.sanity_check(sliding_window);
   const int pert_order = mc_config.pert_order();
   if (pert_order == 0) {
@@ -832,30 +901,52 @@ global_update(R &rng,
   if (mc_config.p_worm) {
     boost::shared_ptr<Worm> p_w = worm_transformer(*(mc_config.p_worm));
     p_new_worm.swap(p_w);
-    std::vector<psi> new_worm_ops = p_new_worm->get_operators();
+    const worm_operators_t &new_worm_ops = p_new_worm->get_operators();
     operators_new.insert(new_worm_ops.begin(), new_worm_ops.end());
   }
 
   //compute new trace (we use sliding window to avoid overflow/underflow).
-  sliding_window.set_window_size(1, mc_config.operators, 0, ITIME_LEFT);
-  sliding_window.set_window_size(Nwin, operators_new, 0, ITIME_LEFT);
+  //The trace is computed on the scratch window so that the window for the current configuration is left untouched.
+  //The two windows are swapped if the update is accepted.
+  EXTENDED_SCALAR trace_new = mc_config.trace;
+  if (!trace_invariant) {
+    scratch_window.set_window_size(Nwin, operators_new, 0, ITIME_LEFT);
 
-  std::vector<EXTENDED_REAL> trace_bound(sliding_window.get_num_brakets());
-  sliding_window.compute_trace_bound(operators_new, trace_bound);
+    std::vector<EXTENDED_REAL> trace_bound(scratch_window.get_num_brakets());
+    scratch_window.compute_trace_bound(operators_new, trace_bound);
 
-  std::pair<bool, EXTENDED_SCALAR> r = sliding_window.lazy_eval_trace(operators_new, EXTENDED_REAL(0.0), trace_bound);
-  const EXTENDED_SCALAR trace_new = r.second;
+    std::pair<bool, EXTENDED_SCALAR> r = scratch_window.lazy_eval_trace(operators_new, EXTENDED_REAL(0.0), trace_bound);
+    trace_new = r.second;
 
-  sliding_window.set_window_size(1, mc_config.operators, 0, ITIME_LEFT);
-  if (trace_new == EXTENDED_SCALAR(0.0)) {
-    return false;
+    if (trace_new == EXTENDED_SCALAR(0.0)) {
+      return false;
+    }
   }
 
   //compute determinant ratio
+  //If the transformation leaves the hybridization function invariant up to the signs of rows and cols,
+  //the new inverse matrix is obtained from the old one in O(N^2) operations instead of O(N^3).
+  typedef typename MonteCarloConfiguration<SCALAR>::DeterminantMatrixType DeterminantMatrixType;
+  const bool transform_M = hyb_op_transformer.preserves_hybridization(*mc_config.M.get_greens_function());
+  boost::scoped_ptr<DeterminantMatrixType> p_M_new;
+  BlockLUDecomposition<SCALAR> block_lu;
   std::vector<SCALAR> det_vec_new;
-  const SCALAR det_rat = compute_det_rat<SCALAR, HybridizationFunction<SCALAR> >(
-      creation_operators_new, annihilation_operators_new,
-      det_vec, mc_config.M, det_vec_new);
+  SCALAR det_rat;
+  if (transform_M) {
+    std::vector<int> sign_cdagg(pert_order), sign_c(pert_order);
+    for (int iop = 0; iop < pert_order; ++iop) {
+      sign_cdagg[iop] = hyb_op_transformer.antiperiodic_sign(mc_config.M.get_cdagg_ops()[iop]);
+      sign_c[iop] = hyb_op_transformer.antiperiodic_sign(mc_config.M.get_c_ops()[iop]);
+    }
+    p_M_new.reset(new DeterminantMatrixType(mc_config.M));
+    det_rat = p_M_new->transform_operators(creation_operators_new, annihilation_operators_new, sign_cdagg, sign_c);
+    det_vec_new = det_vec;
+    det_vec_new[0] *= det_rat;
+  } else {
+    det_rat = compute_det_rat<SCALAR, HybridizationFunction<SCALAR> >(
+        creation_operators_new, annihilation_operators_new,
+        det_vec, mc_config.M, det_vec_new, block_lu);
+  }
 
   const SCALAR prob =
       convert_to_scalar(
@@ -866,24 +957,25 @@ global_update(R &rng,
       );
 
   if (rng() < std::abs(prob)) {
-    std::vector<std::pair<psi, psi> > operator_pairs(pert_order);
-    for (int iop = 0; iop < pert_order; ++iop) {
-      operator_pairs[iop] = std::make_pair(creation_operators_new[iop], annihilation_operators_new[iop]);
+    if (!transform_M) {
+      //reuse the LU decompositions computed for the determinant ratio
+      p_M_new.reset(new DeterminantMatrixType(mc_config.M.get_greens_function()));
+      p_M_new->set_operators(block_lu.cdagg_ops, block_lu.c_ops, block_lu.compute_inverse_matrices());
     }
-    typedef typename MonteCarloConfiguration<SCALAR>::DeterminantMatrixType DeterminantMatrixType;
-    DeterminantMatrixType M_new(
-        mc_config.M.get_greens_function(),
-        operator_pairs.begin(),
-        operator_pairs.end()
-    );
 
     mc_config.trace = trace_new;
     std::swap(mc_config.operators, operators_new);
-    std::swap(mc_config.M, M_new);
+    std::swap(mc_config.M, *p_M_new);
     std::swap(det_vec, det_vec_new);
     if (mc_config.p_worm) {
       mc_config.p_worm.swap(p_new_worm);
     }
+    if (trace_invariant) {
+      //A window of size 1 does not depend on the operators.
+      sliding_window.set_window_size(1, mc_config.operators, 0, ITIME_LEFT);
+    } else {
+      sliding_window.swap(scratch_window);
+    }
     const int perm_sign_new = compute_permutation_sign(mc_config);
     mc_config.sign *= (1. * perm_sign_new / mc_config.perm_sign) * prob / std::abs(prob);
     mc_config.perm_sign = perm_sign_new;
@@ -1144,9 +1236,9 @@ bool WormInsertionRemover<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose_by_t
 
   if (mc_config.p_worm) {
     //make all the operators of the worm hybridized with the bath
-    const std::vector<psi> &worm_ops = mc_config.p_worm->get_operators();
+    const worm_operators_t &worm_ops = mc_config.p_worm->get_operators();
     std::vector<int> num_cdagg_ops_new(BaseType::num_flavors_, 0), num_c_ops_new(BaseType::num_flavors_, 0);
-    for (std::vector<psi>::const_iterator it = worm_ops.begin(); it != worm_ops.end(); ++it) {
+    for (worm_operators_t::const_iterator it = worm_ops.begin(); it != worm_ops.end(); ++it) {
       if (it->type() == CREATION_OP) {
         BaseType::cdagg_ops_add_.push_back(*it);
         BaseType::cdagg_ops_add_.back().set_time(OperatorTime(open_random(rng, tau_low, tau_high)));
@@ -1197,7 +1289,7 @@ bool WormInsertionRemover<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::propose_by_t
     }
 
     //Count operators in the worm, which will be removed from the bath
-    const std::vector<psi> &worm_ops = BaseType::p_new_worm_->get_operators();
+    const worm_operators_t &worm_ops = BaseType::p_new_worm_->get_operators();
     std::vector<int> num_cdagg_ops_rem, num_c_ops_rem;
     count_operators(worm_ops.begin(), worm_ops.end(), num_flavors, num_cdagg_ops_rem, CREATION_OP);
     count_operators(worm_ops.begin(), worm_ops.end(), num_flavors, num_c_ops_rem, ANNIHILATION_OP);
@@ -1258,7 +1350,7 @@ bool GWormInsertionRemover<SCALAR, RANK, EXTENDED_SCALAR, SLIDING_WINDOW>::propo
 
   if (mc_config.p_worm) {
     //propose removal by attaching worm operators to the bath
-    const std::vector<psi> &worm_ops = mc_config.p_worm->get_operators();
+    const worm_operators_t &worm_ops = mc_config.p_worm->get_operators();
     for (int rank = 0; rank < RANK; ++rank) {
       BaseType::c_ops_add_.push_back(worm_ops[2 * rank]);
       BaseType::cdagg_ops_add_.push_back(worm_ops[2 * rank + 1]);
@@ -1300,7 +1392,7 @@ bool GWormInsertionRemover<SCALAR, RANK, EXTENDED_SCALAR, SLIDING_WINDOW>::propo
 inline double get_tau_first_hyb_op_larger_than(const operator_container_t &ops,
                           const psi &op,
                           double tau_high,
-                          const std::vector<psi> &worm_ops,
+                          const worm_operators_t &worm_ops,
                           boost::optional<psi> &hyb_op_lower_bound) {
   operator_container_t::iterator it = ops.lower_bound(op);
   if (it == ops.end()) {
@@ -1321,7 +1413,7 @@ inline double get_tau_first_hyb_op_larger_than(const operator_container_t &ops,
 inline double get_tau_first_hyb_op_smaller_than(const operator_container_t &ops,
                           const psi &op,
                           double tau_low,
-                          const std::vector<psi> &worm_ops,
+                          const worm_operators_t &worm_ops,
                           boost::optional<psi> &hyb_op_upper_bound) {
   namespace bll = boost::lambda;
   typedef operator_container_t::iterator it_t;
@@ -1354,7 +1446,7 @@ inline double get_tau_first_hyb_op_smaller_than(const operator_container_t &ops,
 template<typename InputItr>
 int count_hyb_cdagg_c_op_pairs(InputItr op_begin,
                                InputItr op_end,
-                               const std::vector<psi> &worm_ops,
+                               const worm_operators_t &worm_ops,
                                alps::random01 &rng,
                                std::pair<psi, psi> &cdagg_c_pair) {
   std::vector<std::pair<psi, psi> > cdagg_c_pairs;
@@ -1400,7 +1492,7 @@ bool EqualTimeG1_TwoTimeG2_Connector<SCALAR, EXTENDED_SCALAR, SLIDING_WINDOW>::p
   const double tau_low = sliding_window.get_tau_low();
   const double tau_high = sliding_window.get_tau_high();
 
-  const std::vector<psi> &worm_ops = mc_config.p_worm->get_operators();
+  const worm_operators_t &worm_ops = mc_config.p_worm->get_operators();
 
   if (mc_config.current_config_space() == Equal_time_G1) {
     BaseType::p_new_worm_ = boost::shared_ptr<Worm>(new CorrelationWorm<2>());
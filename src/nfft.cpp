@@ -0,0 +1,85 @@
+#include "nfft.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <unsupported/Eigen/FFT>
+
+FermionicNFFT::FermionicNFFT(double beta, int n_matsubara, int num_grids, int n_spread)
+    : beta_(beta), n_matsubara_(n_matsubara), num_grids_(num_grids), n_spread_(n_spread), k_shift_(n_matsubara / 2) {
+  if (n_matsubara <= 0 || num_grids <= 0 || n_spread <= 0) {
+    throw std::invalid_argument("Invalid argument to FermionicNFFT");
+  }
+
+  //frequencies k = -k_shift_, ..., n_matsubara - 1 - k_shift_ must be in [-M/2, M/2).
+  //The grid is oversampled by a factor of 2 and must be larger than the width of the spread.
+  const int M = std::max(2 * (n_matsubara_ - k_shift_), 2 * n_spread_);
+  const double R = 2.0;
+  n_grid_ = static_cast<int>(R * M);
+  tau_gauss_ = M_PI * n_spread_ / (M * M * R * (R - 0.5));
+  h_ = 2 * M_PI / n_grid_;
+
+  exp_l2_.resize(n_spread_ + 1);
+  for (int l = 0; l < n_spread_ + 1; ++l) {
+    exp_l2_[l] = std::exp(-(l * h_) * (l * h_) / (4 * tau_gauss_));
+  }
+
+  grids_.resize(num_grids_);
+  reset();
+}
+
+void FermionicNFFT::add(int grid, double tau, const std::complex<double> &coeff) {
+  assert(grid >= 0 && grid < num_grids_);
+  assert(tau >= -beta_ && tau <= beta_);
+
+  //exp(i omega_n tau) = exp(i pi tau/beta) * exp(2 pi i k_shift_ x) * exp(2 pi i k x) with x = tau/beta mod 1
+  double x = tau / beta_;
+  x -= std::floor(x);
+  const std::complex<double> c =
+      coeff * std::exp(std::complex<double>(0.0, M_PI * tau / beta_ + 2 * M_PI * k_shift_ * x));
+
+  //spread the term to the 2*n_spread_ grid points around theta = 2 pi x
+  const double theta = 2 * M_PI * x;
+  const int m0 = std::min(static_cast<int>(theta / h_), n_grid_ - 1);
+  const double d = theta - m0 * h_;
+  const double E1 = std::exp(-d * d / (4 * tau_gauss_));
+  const double E2 = std::exp(d * h_ / (2 * tau_gauss_));
+
+  std::vector<std::complex<double> > &g = grids_[grid];
+  const std::complex<double> c_E1 = c * E1;
+  double E2_l = 1.0;
+  for (int l = 0; l < n_spread_ + 1; ++l) {
+    g[(m0 + l) % n_grid_] += c_E1 * (E2_l * exp_l2_[l]);
+    E2_l *= E2;
+  }
+  const double inv_E2 = 1.0 / E2;
+  E2_l = inv_E2;
+  for (int l = 1; l < n_spread_; ++l) {
+    g[(m0 - l + n_grid_) % n_grid_] += c_E1 * (E2_l * exp_l2_[l]);
+    E2_l *= inv_E2;
+  }
+}
+
+void FermionicNFFT::transform(int grid, std::vector<std::complex<double> > &result) const {
+  assert(grid >= 0 && grid < num_grids_);
+
+  //(1/n_grid) sum_m f_m exp(i k m h)
+  Eigen::FFT<double> fft;
+  std::vector<std::complex<double> > f_k;
+  fft.inv(f_k, grids_[grid]);
+
+  //deconvolution of the Gaussian
+  result.resize(n_matsubara_);
+  const double norm = std::sqrt(M_PI / tau_gauss_);
+  for (int n = 0; n < n_matsubara_; ++n) {
+    const int k = n - k_shift_;
+    result[n] = norm * std::exp(k * k * tau_gauss_) * f_k[(k + n_grid_) % n_grid_];
+  }
+}
+
+void FermionicNFFT::reset() {
+  for (int grid = 0; grid < num_grids_; ++grid) {
+    grids_[grid].resize(n_grid_);
+    std::fill(grids_[grid].begin(), grids_[grid].end(), std::complex<double>(0.0, 0.0));
+  }
+}
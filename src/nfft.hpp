@@ -0,0 +1,48 @@
+#pragma once
+
+#include<complex>
+#include<cmath>
+#include<vector>
+#include<assert.h>
+
+/**
+ * @brief Non-uniform fast Fourier transform to fermionic Matsubara frequencies
+ *
+ * Sums of the form F(i omega_n) = sum_j c_j exp(i omega_n tau_j) for omega_n = (2n+1)pi/beta (n = 0, ..., n_matsubara-1)
+ * and tau_j in (-beta, beta) are computed by Gaussian gridding followed by a FFT
+ * (L. Greengard and J.-Y. Lee, SIAM Rev. 46, 443 (2004)).
+ * Adding a term costs O(n_spread) and a transform costs O(n_matsubara log n_matsubara).
+ * Since both steps are linear, terms from many Monte Carlo steps can be accumulated on the same grid.
+ */
+class FermionicNFFT {
+ public:
+  /**
+   * Constructor
+   *
+   * @param beta          inverse temperature
+   * @param n_matsubara   the number of Matsubara frequencies
+   * @param num_grids     the number of independent sums (e.g. flavor pairs)
+   * @param n_spread      the number of grid points on each side of a term to which it is spread (12 gives a relative accuracy of about 1e-12)
+   */
+  FermionicNFFT(double beta, int n_matsubara, int num_grids, int n_spread = 12);
+
+  /** Add c * exp(i omega_n tau) to the sum for a grid */
+  void add(int grid, double tau, const std::complex<double> &coeff);
+
+  /** Compute the sum at all Matsubara frequencies for a grid */
+  void transform(int grid, std::vector<std::complex<double> > &result) const;
+
+  /** Clear all the terms */
+  void reset();
+
+  int num_matsubara() const { return n_matsubara_; }
+
+ private:
+  const double beta_;
+  const int n_matsubara_, num_grids_, n_spread_;
+  const int k_shift_;//n = k + k_shift_ for a frequency k on the centered grid
+  int n_grid_;
+  double tau_gauss_, h_;
+  std::vector<double> exp_l2_;//exp(-(l*h)^2/(4*tau_gauss)) for l = 0, ..., n_spread
+  std::vector<std::vector<std::complex<double> > > grids_;
+};
@@ -4,11 +4,11 @@
 #include <cassert>
 #include <vector>
 
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/sequenced_index.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/identity.hpp>
 #include <boost/array.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/static_assert.hpp>
+
+#include <alps/fastupdate/flat_set.hpp>
 
 enum OPERATOR_TYPE {
   CREATION_OP = 0,
@@ -107,39 +107,41 @@ double operator+(const OperatorTimeTemplate<T> &t1, const double &t2) {
 }
 
 //an operator.
-//operators are described by the time where they are inserted, as well as their site, flavor, and type (creation/annihilation).
+//operators are described by the time where they are inserted, as well as their flavor, and type (creation/annihilation).
+//The members are packed into 16 bytes because operators are copied and sorted by value everywhere.
 class psi {
  public:
   typedef OperatorTime itime_type;
   typedef OperatorTime TIME_T;
 
-  psi() {
-    t_ = 0;
-    type_ = INVALID_OP;
-    flavor_ = 0;
-    site_ = 0;
-  };
-  psi(TIME_T t, OPERATOR_TYPE type, int flavor) {
-    t_ = t;
-    type_ = type;
-    flavor_ = flavor;
-    site_ = 0;
+  psi() : time_(0.0), small_idx_(0), flavor_(0), type_(INVALID_OP) { };
+  psi(TIME_T t, OPERATOR_TYPE type, int flavor) :
+      time_(t.time()), small_idx_(t.small_index()), flavor_(flavor), type_(type) {
+    assert(flavor_ == flavor);
   };
-  TIME_T time() const { return t_; }
+  TIME_T time() const { return TIME_T(time_, small_idx_); }
 
   int flavor() const { return flavor_; }
-  OPERATOR_TYPE type() const { return type_; } // 0=create, 1=destroy
-  //void set_time(double t) {t_ = t;}
-  void set_time(TIME_T t) { t_ = t; }
+  OPERATOR_TYPE type() const { return static_cast<OPERATOR_TYPE>(type_); } // 0=create, 1=destroy
+  void set_time(TIME_T t) {
+    time_ = t.time();
+    small_idx_ = t.small_index();
+  }
 
-  void set_flavor(int flavor) { flavor_ = flavor; }
+  void set_flavor(int flavor) {
+    flavor_ = flavor;
+    assert(flavor_ == flavor);
+  }
   void set_type(OPERATOR_TYPE type) { type_ = type; }
  private:
-  TIME_T t_;
-  int site_, flavor_;
-  OPERATOR_TYPE type_;
+  double time_;
+  boost::int32_t small_idx_;
+  boost::int16_t flavor_;
+  boost::int8_t type_;
 };
 
+BOOST_STATIC_ASSERT(sizeof(psi) <= 16);
+
 inline OperatorTime operator_time(const psi &op) {
   return op.time();
 }
@@ -206,8 +208,41 @@ inline bool operator!=(const psi &op1, const psi &op2) {
   return !(op1 == op2);
 }
 
-typedef boost::multi_index::multi_index_container<psi>
-    operator_container_t; //one can use range() with multi_index_container.
+/**
+ * @brief Time-ordered sequence of operators stored as a structure of arrays (times[], flavors[], types[])
+ *
+ * This is a snapshot of operators in a time window used for walking through them
+ * (imaginary-time evolution of a bra/ket, sector paths)
+ */
+struct OperatorSequence {
+  std::vector<double> times;
+  std::vector<int> flavors;
+  std::vector<OPERATOR_TYPE> types;
+
+  int size() const { return times.size(); }
+
+  template<typename Iterator>
+  void assign(Iterator first, Iterator last) {
+    const int num_ops = std::distance(first, last);
+    times.resize(num_ops);
+    flavors.resize(num_ops);
+    types.resize(num_ops);
+    int iop = 0;
+    for (Iterator it = first; it != last; ++it, ++iop) {
+      times[iop] = it->time().time();
+      flavors[iop] = it->flavor();
+      types[iop] = it->type();
+    }
+  }
+
+  template<typename Iterator>
+  void assign(const std::pair<Iterator, Iterator> &range) {
+    assign(range.first, range.second);
+  }
+};
+
+typedef alps::fastupdate::FlatSet<psi>
+    operator_container_t; //one can use range() as with multi_index_container.
 
 template<typename V>
 void print_list(const V &operators) {
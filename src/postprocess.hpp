@@ -7,8 +7,12 @@
 
 #include <alps/gf/gf.hpp>
 #include <alps/gf/tail.hpp>
+#include <alps/mc/api.hpp>
+#include <alps/hdf5/archive.hpp>
+#include <alps/utilities/mpi.hpp>
 
 #include "legendre.hpp"
+#include "measurement/measurement.hpp"
 
 template<typename T>
 struct to_complex {
@@ -17,12 +21,82 @@ struct to_complex {
   }
 };
 
+//Means of observables reduced by AsyncObservableSink::reduce_local_observables() (keyed by name)
+typedef std::map<std::string, std::vector<std::complex<double> > > reduced_observables_t;
+
+/**
+ * @brief Load the mean of a complex vector observable into data[0], ..., data[size-1]
+ *
+ * The mean is taken from reduced_obs if the observable was reduced there, otherwise from the ALPS results.
+ */
+template<typename RESULTS>
+void load_complex_vector_mean(const RESULTS &results, const reduced_observables_t &reduced_obs,
+                              const std::string &name, std::size_t size, std::complex<double> *data) {
+  reduced_observables_t::const_iterator it = reduced_obs.find(name);
+  if (it != reduced_obs.end()) {
+    if (it->second.size() != size) {
+      throw std::runtime_error("data size inconsistency in loading observable " + name + "!");
+    }
+    std::copy(it->second.begin(), it->second.end(), data);
+    return;
+  }
+  const std::vector<double> data_Re = results[name + "_Re"].template mean<std::vector<double> >();
+  const std::vector<double> data_Im = results[name + "_Im"].template mean<std::vector<double> >();
+  if (data_Re.size() != size || data_Im.size() != size) {
+    throw std::runtime_error("data size inconsistency in loading observable " + name + "!");
+  }
+  std::transform(data_Re.begin(), data_Re.end(), data_Im.begin(), data, to_complex<double>());
+}
+
+/**
+ * @brief Transform a flavor index of data[f_0]...[f_{num_indices-1}][inner] in place:
+ *   data[..., f, ...] <- sum_g U(f, g) data[..., g, ...],
+ * where U is rotmat_Delta or its complex conjugate.
+ *
+ * The indices other than the transformed one are batched into the columns of matrix products,
+ * which cost O(n_flavors^(num_indices+1) * inner_size) in total.
+ */
+template<typename SCALAR>
+void transform_flavor_index(int n_flavors, int num_indices, int index, int inner_size, bool conjugate,
+                            const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &rotmat_Delta,
+                            std::complex<double> *data) {
+  typedef Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> complex_matrix_t;
+  typedef Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> row_major_matrix_t;
+  //Columns are processed in chunks of this size to keep the work array small
+  const int max_chunk_size = 4096;
+
+  complex_matrix_t rotmat = rotmat_Delta.template cast<std::complex<double> >();
+  if (conjugate) {
+    rotmat = rotmat.conjugate().eval();
+  }
+
+  int num_outer = 1, num_cols = inner_size;
+  for (int i = 0; i < index; ++i) {
+    num_outer *= n_flavors;
+  }
+  for (int i = index + 1; i < num_indices; ++i) {
+    num_cols *= n_flavors;
+  }
+
+  row_major_matrix_t work(n_flavors, std::min(num_cols, max_chunk_size));
+  for (int outer = 0; outer < num_outer; ++outer) {
+    Eigen::Map<row_major_matrix_t> block(data + static_cast<std::size_t>(outer) * n_flavors * num_cols,
+                                         n_flavors, num_cols);
+    for (int col = 0; col < num_cols; col += max_chunk_size) {
+      const int chunk_size = std::min(max_chunk_size, num_cols - col);
+      work.leftCols(chunk_size).noalias() = rotmat * block.middleCols(col, chunk_size);
+      block.middleCols(col, chunk_size) = work.leftCols(chunk_size);
+    }
+  }
+}
+
 template<typename SOLVER_TYPE>
 void compute_two_time_G2(const typename alps::results_type<SOLVER_TYPE>::type &results,
                          const typename alps::parameters_type<SOLVER_TYPE>::type &parms,
                          const Eigen::Matrix<typename SOLVER_TYPE::SCALAR,
                                              Eigen::Dynamic,
                                              Eigen::Dynamic> &rotmat_Delta,
+                         const reduced_observables_t &reduced_obs,
                          std::map<std::string,boost::any> &ar,
                          bool verbose = false) {
   const int n_legendre(parms["measurement.two_time_G2.n_legendre"].template as<int>());
@@ -39,44 +113,17 @@ void compute_two_time_G2(const typename alps::results_type<SOLVER_TYPE>::type &r
               << " : " << results["Z_function_space_volume"].template mean<double>() << std::endl;
   }
 
-  const std::vector<double> data_Re = results["Two_time_G2_Re"].template mean<std::vector<double> >();
-  const std::vector<double> data_Im = results["Two_time_G2_Im"].template mean<std::vector<double> >();
-  assert(data_Re.size() == n_flavors * n_flavors * n_flavors * n_flavors * n_legendre);
   boost::multi_array<std::complex<double>, 5>
       data(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors][n_legendre]);
-  std::transform(data_Re.begin(), data_Re.end(), data_Im.begin(), data.origin(), to_complex<double>());
+  load_complex_vector_mean(results, reduced_obs, "Two_time_G2", data.num_elements(), data.origin());
   std::transform(data.origin(), data.origin() + data.num_elements(), data.origin(),
                  std::bind1st(std::multiplies<std::complex<double> >(), coeff));
 
-  boost::multi_array<std::complex<double>, 5>
-      data_org_basis(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors][n_legendre]);
-  std::fill(data_org_basis.origin(), data_org_basis.origin() + data_org_basis.num_elements(), 0.0);
-
-  //basis rotation very ugly. TO DO: replace the loops with tensordots.
-  for (int f0 = 0; f0 < n_flavors; ++f0) {
-    for (int f1 = 0; f1 < n_flavors; ++f1) {
-      for (int f2 = 0; f2 < n_flavors; ++f2) {
-        for (int f3 = 0; f3 < n_flavors; ++f3) {
-          for (int g0 = 0; g0 < n_flavors; ++g0) {
-            for (int g1 = 0; g1 < n_flavors; ++g1) {
-              for (int g2 = 0; g2 < n_flavors; ++g2) {
-                for (int g3 = 0; g3 < n_flavors; ++g3) {
-                  for (int il = 0; il < n_legendre; ++il) {
-                    data_org_basis[f0][f1][f2][f3][il] += data[g0][g1][g2][g3][il] *
-                        myconj(rotmat_Delta(f0, g0)) *
-                        rotmat_Delta(f1, g1) *
-                        myconj(rotmat_Delta(f2, g2)) *
-                        rotmat_Delta(f3, g3);
-                  }
-                }
-              }
-            }
-          }
-        }
-      }
-    }
+  //rotate back to the original basis
+  for (int index = 0; index < 4; ++index) {
+    transform_flavor_index(n_flavors, 4, index, n_legendre, index % 2 == 0, rotmat_Delta, data.origin());
   }
-  ar["TWO_TIME_G2_LEGENDRE"] = data_org_basis;
+  ar["TWO_TIME_G2_LEGENDRE"] = data;
 }
 
 
@@ -113,6 +160,7 @@ template<typename SOLVER_TYPE>
 void compute_G1(const typename alps::results_type<SOLVER_TYPE>::type &results,
                 const typename alps::parameters_type<SOLVER_TYPE>::type &parms,
                 const Eigen::Matrix<typename SOLVER_TYPE::SCALAR, Eigen::Dynamic, Eigen::Dynamic> &rotmat_Delta,
+                const reduced_observables_t &reduced_obs,
                 std::map<std::string,boost::any> &ar,
                 bool verbose = false) {
   namespace g=alps::gf;
@@ -134,12 +182,9 @@ void compute_G1(const typename alps::results_type<SOLVER_TYPE>::type &results,
   boost::multi_array<std::complex<double>, 3>
       Gl_org_basis(boost::extents[n_flavors][n_flavors][n_legendre]);
   {
-    const std::vector<double> Gl_Re = results["G1_Re"].template mean<std::vector<double> >();
-    const std::vector<double> Gl_Im = results["G1_Im"].template mean<std::vector<double> >();
-    assert(Gl_Re.size() == n_flavors * n_flavors * n_legendre);
     boost::multi_array<std::complex<double>, 3>
         Gl(boost::extents[n_flavors][n_flavors][n_legendre]);
-    std::transform(Gl_Re.begin(), Gl_Re.end(), Gl_Im.begin(), Gl.origin(), to_complex<double>());
+    load_complex_vector_mean(results, reduced_obs, "G1", Gl.num_elements(), Gl.origin());
     std::transform(Gl.origin(), Gl.origin() + Gl.num_elements(), Gl.origin(),
                    std::bind1st(std::multiplies<std::complex<double> >(), coeff));
 
@@ -225,79 +270,62 @@ void compute_G1(const typename alps::results_type<SOLVER_TYPE>::type &results,
   ar["gf"] = gomega;
 }
 
-//very crapy way to implement ...
-template<typename SCALAR>
-void rotate_back_G2(int n_flavors, boost::multi_array<std::complex<double>, 4> &G2,
-                    const Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> &rotmat_Delta) {
+/**
+ * @brief G(i omega_n) measured in the partition-function space by a non-uniform FFT (measurement.G1.matsubara_nfft)
+ *
+ * The measured data are divided by the average sign and rotated back to the original basis.
+ */
+template<typename SOLVER_TYPE>
+void compute_G1_matsubara(const typename alps::results_type<SOLVER_TYPE>::type &results,
+                          const typename alps::parameters_type<SOLVER_TYPE>::type &parms,
+                          const Eigen::Matrix<typename SOLVER_TYPE::SCALAR, Eigen::Dynamic, Eigen::Dynamic> &rotmat_Delta,
+                          const reduced_observables_t &reduced_obs,
+                          std::map<std::string,boost::any> &ar) {
+  namespace g=alps::gf;
+  typedef Eigen::Matrix<typename SOLVER_TYPE::SCALAR, Eigen::Dynamic, Eigen::Dynamic> matrix_t;
+  typedef Eigen::Matrix<std::complex<double>, Eigen::Dynamic, Eigen::Dynamic> complex_matrix_t;
 
-  boost::multi_array<std::complex<double>, 4>
-      work(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors]);
+  const int n_matsubara(parms["measurement.G1.n_matsubara"]);
+  const double beta(parms["model.beta"]);
+  const int n_flavors = parms["model.sites"].template as<int>() * parms["model.spins"].template as<int>();
+  const double coeff = 1.0 / results["Sign"].template mean<double>();
 
-  //transform the first index
-  std::fill(work.origin(), work.origin() + work.num_elements(), 0.0);
-  for (int f1 = 0; f1 < n_flavors; ++f1) {
-    for (int f2 = 0; f2 < n_flavors; ++f2) {
-      for (int f3 = 0; f3 < n_flavors; ++f3) {
-        for (int f4 = 0; f4 < n_flavors; ++f4) {
-          for (int g1 = 0; g1 < n_flavors; ++g1) {
-            work[f1][f2][f3][f4] += rotmat_Delta(f1, g1) * G2[g1][f2][f3][f4];
-          }
-        }
-      }
-    }
-  }
-  G2 = work;
+  boost::multi_array<std::complex<double>, 3> G(boost::extents[n_flavors][n_flavors][n_matsubara]);
+  load_complex_vector_mean(results, reduced_obs, "Greens_matsubara", G.num_elements(), G.origin());
 
-  //transform the second index
-  std::fill(work.origin(), work.origin() + work.num_elements(), 0.0);
-  for (int f1 = 0; f1 < n_flavors; ++f1) {
-    for (int f2 = 0; f2 < n_flavors; ++f2) {
-      for (int f3 = 0; f3 < n_flavors; ++f3) {
-        for (int f4 = 0; f4 < n_flavors; ++f4) {
-          for (int g2 = 0; g2 < n_flavors; ++g2) {
-            work[f1][f2][f3][f4] += myconj(rotmat_Delta(f2, g2)) * G2[f1][g2][f3][f4];
-          }
-        }
-      }
-    }
-  }
-  G2 = work;
+  typedef alps::gf::three_index_gf<std::complex<double>, alps::gf::matsubara_positive_mesh,
+                                   alps::gf::index_mesh,
+                                   alps::gf::index_mesh
+  > GOMEGA;
+  GOMEGA gomega(alps::gf::matsubara_positive_mesh(beta, n_matsubara),
+                alps::gf::index_mesh(n_flavors),
+                alps::gf::index_mesh(n_flavors));
 
-  //transform the third index
-  std::fill(work.origin(), work.origin() + work.num_elements(), 0.0);
-  for (int f1 = 0; f1 < n_flavors; ++f1) {
-    for (int f2 = 0; f2 < n_flavors; ++f2) {
-      for (int f3 = 0; f3 < n_flavors; ++f3) {
-        for (int f4 = 0; f4 < n_flavors; ++f4) {
-          for (int g3 = 0; g3 < n_flavors; ++g3) {
-            work[f1][f2][f3][f4] += rotmat_Delta(f3, g3) * G2[f1][f2][g3][f4];
-          }
-        }
+  //rotate back to the original basis
+  complex_matrix_t mattmp(n_flavors, n_flavors), mattmp2(n_flavors, n_flavors);
+  const matrix_t inv_rotmat_Delta = rotmat_Delta.inverse();
+  for (int im = 0; im < n_matsubara; ++im) {
+    for (int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
+      for (int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
+        mattmp(flavor1, flavor2) = coeff * G[flavor1][flavor2][im];
       }
     }
-  }
-  G2 = work;
-
-  //transform the fourth index
-  std::fill(work.origin(), work.origin() + work.num_elements(), 0.0);
-  for (int f1 = 0; f1 < n_flavors; ++f1) {
-    for (int f2 = 0; f2 < n_flavors; ++f2) {
-      for (int f3 = 0; f3 < n_flavors; ++f3) {
-        for (int f4 = 0; f4 < n_flavors; ++f4) {
-          for (int g4 = 0; g4 < n_flavors; ++g4) {
-            work[f1][f2][f3][f4] += myconj(rotmat_Delta(f4, g4)) * G2[f1][f2][f3][g4];
-          }
-        }
+    mattmp2 = rotmat_Delta * mattmp * inv_rotmat_Delta;
+    for (int flavor1 = 0; flavor1 < n_flavors; ++flavor1) {
+      for (int flavor2 = 0; flavor2 < n_flavors; ++flavor2) {
+        gomega(g::matsubara_index(im), g::index(flavor1), g::index(flavor2)) = mattmp2(flavor1, flavor2);
       }
     }
   }
-  G2 = work;
+  ar["gf_matsubara"] = gomega;
 }
 
 template<typename SOLVER_TYPE>
 void compute_G2(const typename alps::results_type<SOLVER_TYPE>::type &results,
                 const typename alps::parameters_type<SOLVER_TYPE>::type &parms,
                 const Eigen::Matrix<typename SOLVER_TYPE::SCALAR, Eigen::Dynamic, Eigen::Dynamic> &rotmat_Delta,
+                const G2FlavorIndexMap &flavor_map,
+                const reduced_observables_t &reduced_obs,
                 std::map<std::string,boost::any> &ar,
                 bool verbose = false) {
   const int n_legendre(parms["measurement.G2.n_legendre"]);
@@ -310,50 +338,128 @@ void compute_G2(const typename alps::results_type<SOLVER_TYPE>::type &results,
       results["worm_space_volume_G2"].template mean<double>() /
           (sign * results["Z_function_space_volume"].template mean<double>());
 
-  const std::vector<double> Gl_Re = results["G2_Re"].template mean<std::vector<double> >();
-  const std::vector<double> Gl_Im = results["G2_Im"].template mean<std::vector<double> >();
-  boost::multi_array<std::complex<double>, 7>
-      Gl(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors][n_legendre][n_legendre][n_freq]);
-  std::transform(Gl_Re.begin(), Gl_Re.end(), Gl_Im.begin(), Gl.origin(), to_complex<double>());
-  std::transform(Gl.origin(), Gl.origin() + Gl.num_elements(), Gl.origin(),
-                 std::bind1st(std::multiplies<std::complex<double> >(), coeff));
+  //G2 and <[d, H_U] d^dagger d d^dagger> measured by the improved estimator
+  std::vector<std::string> names, keys;
+  names.push_back("G2");
+  keys.push_back("G2_LEGENDRE");
+  if (parms["measurement.G2.improved_estimator"] != 0) {
+    names.push_back("G2_improved");
+    keys.push_back("G2_IMPROVED_LEGENDRE");
+  }
+  for (int i = 0; i < names.size(); ++i) {
+    const int block_size = n_legendre * n_legendre * n_freq;
+    std::vector<std::complex<double> > Gl_compact(flavor_map.num_combinations() * block_size);
+    load_complex_vector_mean(results, reduced_obs, names[i], Gl_compact.size(), &Gl_compact[0]);
+
+    //expand the stored flavor combinations (the others are zero)
+    boost::multi_array<std::complex<double>, 7>
+        Gl(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors][n_legendre][n_legendre][n_freq]);
+    std::fill(Gl.origin(), Gl.origin() + Gl.num_elements(), 0.0);
+    for (int idx = 0; idx < flavor_map.num_combinations(); ++idx) {
+      const boost::array<int, 4> &f = flavor_map.flavors(idx);
+      std::copy(Gl_compact.begin() + idx * block_size, Gl_compact.begin() + (idx + 1) * block_size,
+                &Gl[f[0]][f[1]][f[2]][f[3]][0][0][0]);
+    }
+    std::transform(Gl.origin(), Gl.origin() + Gl.num_elements(), Gl.origin(),
+                   std::bind1st(std::multiplies<std::complex<double> >(), coeff));
 
-  //rotate back to the original basis (using not-cache-friendly approach...)
-  for (int il = 0; il < n_legendre; ++il) {
-    for (int il2 = 0; il2 < n_legendre; ++il2) {
-      for (int ifreq = 0; ifreq < n_freq; ++ifreq) {
+    //rotate back to the original basis
+    for (int index = 0; index < 4; ++index) {
+      transform_flavor_index(n_flavors, 4, index, block_size, index % 2 == 1, rotmat_Delta, Gl.origin());
+    }
+
+    ar[keys[i]] = Gl;
+  }
+}
+
+/**
+ * @brief G2 summed up on each MPI process, which is reduced and written into an HDF5 file chunk by chunk
+ *
+ * The sums are stored as [flavor combination][legendre][legendre][bosonic freq] (see G2FlavorIndexMap).
+ */
+template<typename SCALAR>
+struct StreamedG2 {
+  G2FlavorIndexMap flavor_map;
+  Eigen::Matrix<SCALAR, Eigen::Dynamic, Eigen::Dynamic> rotmat_Delta;
+  //normalization factor (used only on the master process)
+  double coeff;
+  //paths in the HDF5 file, sums and the numbers of the data on this process
+  std::vector<std::string> keys;
+  std::vector<std::vector<std::complex<double> > > local_sums;
+  std::vector<long> local_counts;
+};
+
+/**
+ * @brief Reduce G2 summed up on each process and write it in the original basis into an HDF5 file
+ *
+ * The data are reduced and rotated for each pair of the first Legendre index and the bosonic frequency.
+ * Besides its own compact local sum (moved out of AsyncObservableSink), the master process thus holds
+ * only n_flavors^4 * n_legendre elements of the dense G2 at a time.
+ * The layout in the file is the same as that of compute_G2.
+ * Must be called on all processes. p_ar is used only on the master process.
+ */
+template<typename SCALAR>
+void write_streamed_G2(const alps::mpi::communicator &comm, int n_flavors, int n_legendre, int n_freq,
+                       const StreamedG2<SCALAR> &G2, alps::hdf5::archive *p_ar) {
+  const G2FlavorIndexMap &flavor_map = G2.flavor_map;
+  const int n_comb = flavor_map.num_combinations();
+  const bool master = (comm.rank() == 0);
+
+  //flavor, flavor, flavor, flavor, legendre, legendre, bosonic freq, real/imaginary part
+  std::vector<std::size_t> size(4, n_flavors), chunk(4, n_flavors), offset(8, 0);
+  size.push_back(n_legendre);
+  size.push_back(n_legendre);
+  size.push_back(n_freq);
+  size.push_back(2);
+  chunk.push_back(1);
+  chunk.push_back(n_legendre);
+  chunk.push_back(1);
+  chunk.push_back(2);
+
+  std::vector<std::complex<double> > local_chunk(n_comb * n_legendre), chunk_sum(n_comb * n_legendre);
+  boost::multi_array<std::complex<double>, 5>
+      dense(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors][n_legendre]);
+  for (int i = 0; i < G2.keys.size(); ++i) {
+    const std::vector<std::complex<double> > &sum = G2.local_sums[i];
+    assert(sum.size() == n_comb * n_legendre * n_legendre * n_freq);
+    long count = 0;
+    MPI_Reduce((void *) &G2.local_counts[i], (void *) &count, 1, MPI_LONG, MPI_SUM, 0, comm);
+    const double coeff = count > 0 ? G2.coeff / count : 0.0;
 
-        //copy data to work1
-        boost::multi_array<std::complex<double>, 4>
-            work(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors]);
-        for (int f1 = 0; f1 < n_flavors; ++f1) {
-          for (int f2 = 0; f2 < n_flavors; ++f2) {
-            for (int f3 = 0; f3 < n_flavors; ++f3) {
-              for (int f4 = 0; f4 < n_flavors; ++f4) {
-                work[f1][f2][f3][f4] = Gl[f1][f2][f3][f4][il][il2][ifreq];
-              }
-            }
+    for (int il = 0; il < n_legendre; ++il) {
+      for (int ifreq = 0; ifreq < n_freq; ++ifreq) {
+        for (int idx = 0; idx < n_comb; ++idx) {
+          for (int il2 = 0; il2 < n_legendre; ++il2) {
+            local_chunk[idx * n_legendre + il2] = sum[((idx * n_legendre + il) * n_legendre + il2) * n_freq + ifreq];
           }
         }
+        MPI_Reduce((void *) &local_chunk[0], (void *) &chunk_sum[0], 2 * local_chunk.size(),
+                   MPI_DOUBLE, MPI_SUM, 0, comm);
+        if (!master) {
+          continue;
+        }
 
-        rotate_back_G2(n_flavors, work, rotmat_Delta);
-
-        //copy result to Gl
-        for (int f1 = 0; f1 < n_flavors; ++f1) {
-          for (int f2 = 0; f2 < n_flavors; ++f2) {
-            for (int f3 = 0; f3 < n_flavors; ++f3) {
-              for (int f4 = 0; f4 < n_flavors; ++f4) {
-                Gl[f1][f2][f3][f4][il][il2][ifreq] = work[f1][f2][f3][f4];
-              }
-            }
+        //expand the stored flavor combinations and rotate back to the original basis
+        std::fill(dense.origin(), dense.origin() + dense.num_elements(), 0.0);
+        for (int idx = 0; idx < n_comb; ++idx) {
+          const boost::array<int, 4> &f = flavor_map.flavors(idx);
+          for (int il2 = 0; il2 < n_legendre; ++il2) {
+            dense[f[0]][f[1]][f[2]][f[3]][il2] = coeff * chunk_sum[idx * n_legendre + il2];
           }
         }
+        for (int index = 0; index < 4; ++index) {
+          transform_flavor_index(n_flavors, 4, index, n_legendre, index % 2 == 1, G2.rotmat_Delta, dense.origin());
+        }
 
+        offset[4] = il;
+        offset[6] = ifreq;
+        p_ar->write("/" + G2.keys[i], reinterpret_cast<const double *>(dense.origin()), size, chunk, offset);
       }
     }
+    if (master) {
+      p_ar->set_complex("/" + G2.keys[i]);
+    }
   }
-
-  ar["G2_LEGENDRE"] = Gl;
 }
 
 template<typename SOLVER_TYPE>
@@ -372,28 +478,19 @@ void compute_euqal_time_G1(const typename alps::results_type<SOLVER_TYPE>::type
       temperature * results["worm_space_volume_Equal_time_G1"].template mean<double>() /
           (sign * results["Z_function_space_volume"].template mean<double>());
 
-  boost::multi_array<std::complex<double>, 2> data_org_basis(boost::extents[n_flavors][n_flavors]);
-  std::fill(data_org_basis.origin(), data_org_basis.origin() + data_org_basis.num_elements(), 0.0);
-  {
-    const std::vector<double> data_Re = results["Equal_time_G1_Re"].template mean<std::vector<double> >();
-    const std::vector<double> data_Im = results["Equal_time_G1_Im"].template mean<std::vector<double> >();
-    assert(data_Re.size() == n_flavors * n_flavors);
-    boost::multi_array<std::complex<double>, 2> data(boost::extents[n_flavors][n_flavors]);
-    std::transform(data_Re.begin(), data_Re.end(), data_Im.begin(), data.origin(), to_complex<double>());
-    std::transform(data.origin(), data.origin() + data.num_elements(), data.origin(),
-                   std::bind1st(std::multiplies<std::complex<double> >(), coeff));
-    for (int f0 = 0; f0 < n_flavors; ++f0) {
-      for (int f1 = 0; f1 < n_flavors; ++f1) {
-        for (int g0 = 0; g0 < n_flavors; ++g0) {
-          for (int g1 = 0; g1 < n_flavors; ++g1) {
-            data_org_basis[f0][f1] += data[g0][g1]
-                * myconj(rotmat_Delta(f0, g0)) * rotmat_Delta(f1, g1);
-          }
-        }
-      }
-    }
+  const std::vector<double> data_Re = results["Equal_time_G1_Re"].template mean<std::vector<double> >();
+  const std::vector<double> data_Im = results["Equal_time_G1_Im"].template mean<std::vector<double> >();
+  assert(data_Re.size() == n_flavors * n_flavors);
+  boost::multi_array<std::complex<double>, 2> data(boost::extents[n_flavors][n_flavors]);
+  std::transform(data_Re.begin(), data_Re.end(), data_Im.begin(), data.origin(), to_complex<double>());
+  std::transform(data.origin(), data.origin() + data.num_elements(), data.origin(),
+                 std::bind1st(std::multiplies<std::complex<double> >(), coeff));
+
+  //rotate back to the original basis
+  for (int index = 0; index < 2; ++index) {
+    transform_flavor_index(n_flavors, 2, index, 1, index % 2 == 0, rotmat_Delta, data.origin());
   }
-  ar["EQUAL_TIME_G1"] = data_org_basis;
+  ar["EQUAL_TIME_G1"] = data;
 }
 
 template<typename SOLVER_TYPE>
@@ -414,42 +511,20 @@ void compute_euqal_time_G2(const typename alps::results_type<SOLVER_TYPE>::type
       temperature * results["worm_space_volume_Equal_time_G2"].template mean<double>() /
           (sign * results["Z_function_space_volume"].template mean<double>());
 
+  const std::vector<double> data_Re = results["Equal_time_G2_Re"].template mean<std::vector<double> >();
+  const std::vector<double> data_Im = results["Equal_time_G2_Im"].template mean<std::vector<double> >();
+  assert(data_Re.size() == n_flavors * n_flavors * n_flavors * n_flavors);
   boost::multi_array<std::complex<double>, 4>
-      data_org_basis(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors]);
-  std::fill(data_org_basis.origin(), data_org_basis.origin() + data_org_basis.num_elements(), 0.0);
-  {
-    const std::vector<double> data_Re = results["Equal_time_G2_Re"].template mean<std::vector<double> >();
-    const std::vector<double> data_Im = results["Equal_time_G2_Im"].template mean<std::vector<double> >();
-    assert(data_Re.size() == n_flavors * n_flavors * n_flavors * n_flavors);
-    boost::multi_array<std::complex<double>, 4>
-        data(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors]);
-    std::transform(data_Re.begin(), data_Re.end(), data_Im.begin(), data.origin(), to_complex<double>());
-    std::transform(data.origin(), data.origin() + data.num_elements(), data.origin(),
-                   std::bind1st(std::multiplies<std::complex<double> >(), coeff));
-    //const matrix_t inv_rotmat_Delta = rotmat_Delta.inverse();
-    for (int f0 = 0; f0 < n_flavors; ++f0) {
-      for (int f1 = 0; f1 < n_flavors; ++f1) {
-        for (int f2 = 0; f2 < n_flavors; ++f2) {
-          for (int f3 = 0; f3 < n_flavors; ++f3) {
-            for (int g0 = 0; g0 < n_flavors; ++g0) {
-              for (int g1 = 0; g1 < n_flavors; ++g1) {
-                for (int g2 = 0; g2 < n_flavors; ++g2) {
-                  for (int g3 = 0; g3 < n_flavors; ++g3) {
-                    data_org_basis[f0][f1][f2][f3] += data[g0][g1][g2][g3] *
-                        myconj(rotmat_Delta(f0, g0)) *
-                        rotmat_Delta(f1, g1) *
-                        myconj(rotmat_Delta(f2, g2)) *
-                        rotmat_Delta(f3, g3);
-                  }
-                }
-              }
-            }
-          }
-        }
-      }
-    }
+      data(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors]);
+  std::transform(data_Re.begin(), data_Re.end(), data_Im.begin(), data.origin(), to_complex<double>());
+  std::transform(data.origin(), data.origin() + data.num_elements(), data.origin(),
+                 std::bind1st(std::multiplies<std::complex<double> >(), coeff));
+
+  //rotate back to the original basis
+  for (int index = 0; index < 4; ++index) {
+    transform_flavor_index(n_flavors, 4, index, 1, index % 2 == 0, rotmat_Delta, data.origin());
   }
-  ar["EQUAL_TIME_G2"] = data_org_basis;
+  ar["EQUAL_TIME_G2"] = data;
 }
 
 template<unsigned long N>
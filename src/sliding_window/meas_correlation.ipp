@@ -34,7 +34,6 @@ MeasCorrelation<SW, OBS>::perform_meas(SW &sw,
   namespace bll = boost::lambda;
 
   typedef typename SW::BRAKET_TYPE BRAKET_TYPE;
-  typedef typename operator_container_t::iterator OP_IT_TYPE;
 
   const int num_braket = sw.get_num_brakets();
 
@@ -52,11 +51,10 @@ MeasCorrelation<SW, OBS>::perform_meas(SW &sw,
   //Find out operators in imaginary time segments
   //Note: look at the differences between "<" and "<="
   //This avoids a double-counting problem of operators for the case there is (accidentaly) a creation/annihilation operator on the right top of a tau point.
-  std::vector<std::pair<OP_IT_TYPE, OP_IT_TYPE> > ops_ranges_from_left(num_tau_points_ - 1),
-      ops_ranges_from_right(num_tau_points_ - 1);
+  std::vector<OperatorSequence> ops_from_left(num_tau_points_ - 1), ops_from_right(num_tau_points_ - 1);
   for (int itau = 0; itau < num_tau_points_ - 1; ++itau) {
-    ops_ranges_from_right[itau] = operators.range(tau_points[itau] <= bll::_1, bll::_1 < tau_points[itau + 1]);
-    ops_ranges_from_left[itau] = operators.range(tau_points[itau] <= bll::_1, bll::_1 <= tau_points[itau + 1]);
+    ops_from_right[itau].assign(operators.range(tau_points[itau] <= bll::_1, bll::_1 < tau_points[itau + 1]));
+    ops_from_left[itau].assign(operators.range(tau_points[itau] <= bll::_1, bll::_1 <= tau_points[itau + 1]));
   }
 
   boost::multi_array<BRAKET_TYPE, 2> bra_sector(boost::extents[left_obs_unique_list.size()][num_tau_points_]);
@@ -73,7 +71,7 @@ MeasCorrelation<SW, OBS>::perform_meas(SW &sw,
 
       ket_sector[i_obs][0] = ket;
       for (int itau = 1; itau < num_tau_points_; ++itau) {
-        SW::evolve_ket(*sw.get_p_model(), ket, ops_ranges_from_right[itau - 1], tau_points[itau - 1], tau_points[itau]);
+        SW::evolve_ket(*sw.get_p_model(), ket, ops_from_right[itau - 1], tau_points[itau - 1], tau_points[itau]);
         ket_sector[i_obs][itau] = ket;
       }
     }
@@ -83,7 +81,7 @@ MeasCorrelation<SW, OBS>::perform_meas(SW &sw,
     BRAKET_TYPE bra(sw.get_bra(ibraket));
     for (int itau = num_tau_points_ - 1; itau >= 0; --itau) {
       if (itau != num_tau_points_ - 1) {
-        SW::evolve_bra(*sw.get_p_model(), bra, ops_ranges_from_left[itau], tau_points[itau + 1], tau_points[itau]);
+        SW::evolve_bra(*sw.get_p_model(), bra, ops_from_left[itau], tau_points[itau + 1], tau_points[itau]);
       }
       for (int i_obs = 0; i_obs < left_obs_unique_list.size(); ++i_obs) {
         bra_sector[i_obs][itau] = bra;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <queue>
+
 #include <boost/tuple/tuple.hpp>
 #include <boost/multi_array.hpp>
 
@@ -30,6 +32,10 @@ class SlidingWindowManager {
   //Initialization
   void init_stacks(int n_window_size, const operator_container_t &operators);
 
+  //Exchange the states of the window (stacks, size, position, direction of move) with another manager of the same model
+  //Iterators into operator containers swapped together with the window must be obtained again after the swap
+  void swap(SlidingWindowManager &other);
+
   //Change window size during MC simulation
   void set_window_size(int n_window_size, const operator_container_t &operators, int new_position_right_edge = 0,
                        ITIME_AXIS_LEFT_OR_RIGHT new_direction_move = ITIME_LEFT);
@@ -56,6 +62,9 @@ class SlidingWindowManager {
   inline const BRAKET_TYPE &get_bra(int bra) const { return left_states[bra].back(); }
   inline const BRAKET_TYPE &get_ket(int ket) const { return right_states[ket].back(); }
 
+  //If true, compute_trace_bound uses the spectral norms of the operators as well (tighter bound)
+  inline void set_use_op_norms_in_trace_bound(bool flag) { use_op_norms_in_trace_bound = flag; }
+
   //Manipulation of window
   void move_window_to_next_position(const operator_container_t &operators);
   void move_backward_edge(ITIME_AXIS_LEFT_OR_RIGHT, int num_move = 1);
@@ -74,17 +83,36 @@ class SlidingWindowManager {
       const;
   EXTENDED_REAL compute_trace_bound(const operator_container_t &ops, std::vector<EXTENDED_REAL> &bound) const;
 
+  //Traces of the configurations obtained by inserting a pair of operators at each of the given times (ascending order)
+  //op_later is placed just after op_earlier at the same time (only their types and flavors are used).
+  //The bras and kets are evolved over [0, beta] in a single sweep. The state of the window is neither used nor changed.
+  void scan_trace_pair_insertion(const operator_container_t &ops, const psi &op_earlier, const psi &op_later,
+                                 const std::vector<double> &times, std::vector<EXTENDED_SCALAR> &traces) const;
+
+  //Traces of the configurations obtained by replacing each annihilation operator d in ops by [d, H_U]
+  //(zero for creation operators). The order of traces is that of ops.
+  //The bras and kets are evolved over [0, beta] in a single sweep. The state of the window is neither used nor changed.
+  void scan_trace_commutator_replacement(const operator_container_t &ops, std::vector<EXTENDED_SCALAR> &traces) const;
+
+  //Time intervals in the window in which an operator of given type and flavor acts on the sector of some braket
+  //The operators in excluded_ops are ignored in evolving the sectors.
+  void compute_allowed_intervals(const operator_container_t &ops, const std::vector<psi> &excluded_ops,
+                                 OPERATOR_TYPE op_type, int flavor,
+                                 std::vector<std::pair<double, double> > &intervals) const;
+
   //static function for imaginary-time evolution of a bra or a ket
+  //ops: operators in the time window between tau_old and tau_new
   static void evolve_bra
-      (const MODEL &model, BRAKET_TYPE &bra, std::pair<op_it_t, op_it_t> ops_range, double tau_old, double tau_new);
+      (const MODEL &model, BRAKET_TYPE &bra, const OperatorSequence &ops, double tau_old, double tau_new);
   static void evolve_ket
-      (const MODEL &model, BRAKET_TYPE &ket, std::pair<op_it_t, op_it_t> ops_range, double tau_old, double tau_new);
+      (const MODEL &model, BRAKET_TYPE &ket, const OperatorSequence &ops, double tau_old, double tau_new);
 
  private:
   const MODEL *const p_model;
   const double BETA;
   const int num_brakets;
   const double norm_cutoff;
+  bool use_op_norms_in_trace_bound;
 
   inline int depth_left_states() const { return left_states[0].size(); }
   inline int depth_right_states() const { return right_states[0].size(); }
@@ -102,8 +130,11 @@ class SlidingWindowManager {
   inline bool is_braket_invalid(int braket) const {
     return right_states[braket].back().invalid() || left_states[braket].back().invalid();
   }
-  inline typename ExtendedScalar<typename model_traits<MODEL>::SCALAR_T>::value_type
-      compute_trace_braket(int braket, std::pair<op_it_t, op_it_t> ops_range, double tau_left, double tau_right) const;
+  //Bounds of the trace of a braket from the k-th operator in ops to the left edge (k = 0, ..., ops.size()),
+  //excluding the norm of the ket, and the minimum dimension of the sectors on the way
+  void compute_remaining_trace_bounds(int braket, const OperatorSequence &ops, double tau_left, double tau_right,
+                                      std::vector<EXTENDED_REAL> &remaining_bound,
+                                      std::vector<int> &remaining_min_dim) const;
 
   std::vector<std::vector<BRAKET_TYPE> > left_states, right_states;
   //bra and ket, respectively
@@ -113,6 +144,9 @@ class SlidingWindowManager {
   //for lazy evalulation of trace using spectral norm
   std::vector<std::vector<EXTENDED_REAL> > norm_left_states, norm_right_states;
 
+  //work space for operators in a time window
+  mutable OperatorSequence ops_work_;
+
   inline void sanity_check() const;
 };
 
@@ -5,7 +5,8 @@ SlidingWindowManager<MODEL>::SlidingWindowManager(MODEL *p_model_, double beta)
     : p_model(p_model_),
       BETA(beta),
       num_brakets(p_model->num_brakets()),
-      norm_cutoff(std::sqrt(std::numeric_limits<double>::min())) { };
+      norm_cutoff(std::sqrt(std::numeric_limits<double>::min())),
+      use_op_norms_in_trace_bound(false) { };
 
 template<typename MODEL>
 void
@@ -34,6 +35,23 @@ SlidingWindowManager<MODEL>::init_stacks(int n_window_size, const operator_conta
   sanity_check();
 }
 
+template<typename MODEL>
+void SlidingWindowManager<MODEL>::swap(SlidingWindowManager &other) {
+  if (p_model != other.p_model || BETA != other.BETA) {
+    throw std::logic_error("SlidingWindowManager::swap: the two windows must be for the same model.");
+  }
+  std::swap(left_states, other.left_states);
+  std::swap(right_states, other.right_states);
+  std::swap(norm_left_states, other.norm_left_states);
+  std::swap(norm_right_states, other.norm_right_states);
+  std::swap(position_left_edge, other.position_left_edge);
+  std::swap(position_right_edge, other.position_right_edge);
+  std::swap(n_window, other.n_window);
+  std::swap(direction_move_local_window, other.direction_move_local_window);
+  sanity_check();
+  other.sanity_check();
+}
+
 template<typename MODEL>
 void SlidingWindowManager<MODEL>::set_window_size(int n_window_new,
                                                   const operator_container_t &operators,
@@ -113,11 +131,11 @@ SlidingWindowManager<MODEL>::move_forward_right_edge(const operator_container_t
     const double tau_edge_old = get_tau_edge(position_right_edge);
     const double tau_edge_new = get_tau_edge(position_right_edge + 1);
     //const int new_size = depth_right_states()+1;
-    std::pair<op_it_t, op_it_t> ops_range = operators.range(tau_edge_old <= bll::_1, bll::_1 < tau_edge_new);
+    ops_work_.assign(operators.range(tau_edge_old <= bll::_1, bll::_1 < tau_edge_new));
     EXTENDED_REAL max_norm = -1;
     for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
       right_states[i_braket].push_back(right_states[i_braket].back());
-      evolve_ket(*p_model, right_states[i_braket].back(), ops_range, tau_edge_old, tau_edge_new);
+      evolve_ket(*p_model, right_states[i_braket].back(), ops_work_, tau_edge_old, tau_edge_new);
       norm_right_states[i_braket].push_back(right_states[i_braket].back().compute_spectral_norm());
       if (max_norm < norm_right_states[i_braket].back()) {
         max_norm = norm_right_states[i_braket].back();
@@ -153,14 +171,12 @@ SlidingWindowManager<MODEL>::move_forward_left_edge(const operator_container_t &
 
     const double tau_edge_old = get_tau_edge(position_left_edge);
     const double tau_edge_new = get_tau_edge(position_left_edge - 1);
-    const std::pair<op_it_t, op_it_t> ops_range = operators_tmp.range(tau_edge_new < bll::_1,
-                                                                      bll::_1 <= tau_edge_old);
-    //const int num_ops = std::distance(ops_range.first, ops_range.second);
+    ops_work_.assign(operators_tmp.range(tau_edge_new < bll::_1, bll::_1 <= tau_edge_old));
 
     EXTENDED_REAL max_norm = -1;
     for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
       left_states[i_braket].push_back(left_states[i_braket].back());
-      evolve_bra(*p_model, left_states[i_braket].back(), ops_range, tau_edge_old, tau_edge_new);
+      evolve_bra(*p_model, left_states[i_braket].back(), ops_work_, tau_edge_old, tau_edge_new);
       norm_left_states[i_braket].push_back(left_states[i_braket].back().compute_spectral_norm());
       if (max_norm < norm_left_states[i_braket].back()) {
         max_norm = norm_left_states[i_braket].back();
@@ -213,7 +229,7 @@ SlidingWindowManager<MODEL>::compute_trace(const operator_container_t &operators
 
   const double tau_right = get_tau_edge(position_right_edge);
   const double tau_left = get_tau_edge(position_left_edge);
-  std::pair<op_it_t, op_it_t> ops_range = operators.range(tau_right <= bll::_1, bll::_1 <= tau_left);
+  ops_work_.assign(operators.range(tau_right <= bll::_1, bll::_1 <= tau_left));
 
   for (int i_braket = 0; i_braket < num_brakets; ++i_braket) {
     if (is_braket_invalid(i_braket)) {
@@ -221,7 +237,7 @@ SlidingWindowManager<MODEL>::compute_trace(const operator_container_t &operators
     }
     BRAKET_TYPE ket = right_states[i_braket].back();
 
-    evolve_ket(*p_model, ket, ops_range, tau_right, tau_left);
+    evolve_ket(*p_model, ket, ops_work_, tau_right, tau_left);
     if (left_states[i_braket].back().sector() == ket.sector()) {
       const EXTENDED_SCALAR trace_braket = p_model->product(left_states[i_braket].back(), ket);
       assert(!my_isnan(trace_braket));
@@ -232,25 +248,39 @@ SlidingWindowManager<MODEL>::compute_trace(const operator_container_t &operators
 }
 
 template<typename MODEL>
-typename ExtendedScalar<typename model_traits<MODEL>::SCALAR_T>::value_type
-SlidingWindowManager<MODEL>::compute_trace_braket(int braket,
-                                                  std::pair<op_it_t, op_it_t> ops_range, double tau_left,
-                                                  double tau_right) const {
-  BRAKET_TYPE ket = right_states[braket].back();
-  evolve_ket(*p_model, ket, ops_range, tau_right, tau_left);
-  if (left_states[braket].back().sector() == ket.sector()) {
-    return p_model->product(left_states[braket].back(), ket);
-  } else {
-    return 0.0;
+void
+SlidingWindowManager<MODEL>::compute_remaining_trace_bounds(int braket, const OperatorSequence &ops,
+                                                            double tau_left, double tau_right,
+                                                            std::vector<EXTENDED_REAL> &remaining_bound,
+                                                            std::vector<int> &remaining_min_dim) const {
+  const int num_ops = ops.size();
+  remaining_bound.resize(num_ops + 1);
+  remaining_min_dim.resize(num_ops + 1);
+
+  //sectors[k] is the sector of the ket before the k-th operator is applied (sectors[num_ops] at the left edge)
+  std::vector<int> sectors(num_ops + 1);
+  sectors[0] = right_states[braket].back().sector();
+  for (int k = 0; k < num_ops; ++k) {
+    sectors[k + 1] = sectors[k] == nirvana ? nirvana : p_model->get_dst_sector_ket(ops.types[k], ops.flavors[k], sectors[k]);
+  }
+  if (sectors[num_ops] == nirvana || sectors[num_ops] != left_states[braket].back().sector()) {
+    std::fill(remaining_bound.begin(), remaining_bound.end(), EXTENDED_REAL(0.0));
+    std::fill(remaining_min_dim.begin(), remaining_min_dim.end(), 0);
+    return;
   }
-}
 
-template<typename T>
-struct bound_greater: std::binary_function<std::pair<T, int>, std::pair<T, int>, bool> {
-  bool operator()(const std::pair<T, int> &x, const std::pair<T, int> &y) const {
-    return x.first > y.first;
+  remaining_bound[num_ops] = norm_left_states[braket].back()
+      * compute_exp(sectors[num_ops], tau_left - (num_ops > 0 ? ops.times[num_ops - 1] : tau_right));
+  remaining_min_dim[num_ops] = p_model->dim_sector(sectors[num_ops]);
+  for (int k = num_ops - 1; k >= 0; --k) {
+    const double tau_prev = k > 0 ? ops.times[k - 1] : tau_right;
+    remaining_bound[k] = remaining_bound[k + 1] * compute_exp(sectors[k], ops.times[k] - tau_prev);
+    if (use_op_norms_in_trace_bound) {
+      remaining_bound[k] *= p_model->op_norm(ops.types[k], ops.flavors[k], sectors[k]);
+    }
+    remaining_min_dim[k] = std::min(remaining_min_dim[k + 1], p_model->dim_sector(sectors[k]));
   }
-};
+}
 
 template<typename MODEL>
 std::pair<bool, typename ExtendedScalar<typename model_traits<MODEL>::SCALAR_T>::value_type>
@@ -262,38 +292,80 @@ SlidingWindowManager<MODEL>::lazy_eval_trace(const operator_container_t &operato
 
   const double tau_right = get_tau_edge(position_right_edge);
   const double tau_left = get_tau_edge(position_left_edge);
-  std::pair<op_it_t, op_it_t> ops_range = operators.range(tau_right <= bll::_1, bll::_1 <= tau_left);
-
-  EXTENDED_REAL trace_bound_current = std::accumulate(trace_bound.begin(), trace_bound.end(), EXTENDED_REAL(0.0));
-  assert(trace_bound_current >= 0.0);
-
-  //sort trace bounds in decreasing order
-  std::vector<std::pair<EXTENDED_REAL, int> > indices(num_brakets);
+  ops_work_.assign(operators.range(tau_right <= bll::_1, bll::_1 <= tau_left));
+  const int num_ops = ops_work_.size();
+
+  assert(std::accumulate(trace_bound.begin(), trace_bound.end(), EXTENDED_REAL(0.0)) >= 0.0);
+
+  //The kets are evolved operator by operator, always advancing the braket with the largest bound.
+  //After each step, the bound of the braket is tightened by the norm of the evolved ket
+  //times the bound of the remaining path, and the evaluation is aborted
+  //as soon as the sum of the bounds drops below trace_cutoff.
+  //Unfinished brakets are kept in a max-heap keyed on their bounds, and the sum of the bounds is updated incrementally.
+  std::vector<BRAKET_TYPE> kets(num_brakets);
+  std::vector<int> next_op(num_brakets, 0);
+  std::vector<double> tau_prev(num_brakets, tau_right);
+  std::vector<std::vector<EXTENDED_REAL> > remaining_bound(num_brakets);
+  std::vector<std::vector<int> > remaining_min_dim(num_brakets);
+  std::priority_queue<std::pair<EXTENDED_REAL, int> > queue;
   for (int braket = 0; braket < num_brakets; ++braket) {
-    indices[braket] = std::make_pair(trace_bound[braket], braket);
-  }
-  std::sort(indices.begin(), indices.end(), bound_greater<EXTENDED_REAL>());
-#ifndef NDEBUG
-  for (int idx = 0; idx < num_brakets - 1; ++idx) {
-    assert(indices[idx].first >= indices[idx].first);
+    if (trace_bound[braket] != 0.0) {
+      queue.push(std::make_pair(trace_bound[braket], braket));
+    }
   }
-#endif
+  EXTENDED_REAL trace_bound_sum = std::accumulate(trace_bound.begin(), trace_bound.end(), EXTENDED_REAL(0.0));
 
   EXTENDED_SCALAR trace_sum = 0.0;
-  for (int idx = 0; idx < num_brakets; ++idx) {
-    int braket = indices[idx].second;
+  while (!queue.empty()) {
+    const int braket = queue.top().second;
     if (trace_bound[braket] < 1E-15 * myabs(trace_sum)) {
       break;
     }
+    queue.pop();
+    const EXTENDED_REAL trace_bound_old = trace_bound[braket];
+
+    BRAKET_TYPE &ket = kets[braket];
+    if (remaining_bound[braket].empty()) {
+      ket = right_states[braket].back();
+      ket.normalize();
+      compute_remaining_trace_bounds(braket, ops_work_, tau_left, tau_right,
+                                     remaining_bound[braket], remaining_min_dim[braket]);
+    }
 
-    const EXTENDED_SCALAR trace_braket = compute_trace_braket(braket, ops_range, tau_left, tau_right);
+    const int iop = next_op[braket];
+    if (iop < num_ops) {
+      p_model->sector_propagate_ket(ket, ops_work_.times[iop] - tau_prev[braket]);
+      p_model->apply_op_hyb_ket(ops_work_.types[iop], ops_work_.flavors[iop], ket);
+      tau_prev[braket] = ops_work_.times[iop];
+      ++next_op[braket];
+
+      //Frobenius norm is an upper bound of the spectral norm
+      const EXTENDED_REAL bound = ket.invalid() ? EXTENDED_REAL(0.0) :
+                                  ket.coeff() * ket.obj().norm() * remaining_bound[braket][iop + 1] *
+                                      ((EXTENDED_REAL) 1. * std::min(ket.min_dim(), remaining_min_dim[braket][iop + 1]));
+      trace_bound[braket] = std::min(trace_bound[braket], bound);
+      if (trace_bound[braket] != 0.0) {
+        queue.push(std::make_pair(trace_bound[braket], braket));
+      }
+    } else {
+      p_model->sector_propagate_ket(ket, tau_left - tau_prev[braket]);
+      ket.normalize();
+      const EXTENDED_SCALAR trace_braket =
+          !ket.invalid() && left_states[braket].back().sector() == ket.sector() ?
+          p_model->product(left_states[braket].back(), ket) : EXTENDED_SCALAR(0.0);
+
+      assert(myabs(trace_braket) <= trace_bound[braket] * 1.01);
+      trace_sum += trace_braket;
+      trace_bound[braket] = myabs(trace_braket);
+    }
 
-    assert(myabs(trace_braket) <= trace_bound[braket] * 1.01);
-    trace_sum += trace_braket;
-    trace_bound[braket] = myabs(trace_braket);
-    trace_bound_current = std::accumulate(trace_bound.begin(), trace_bound.end(), EXTENDED_REAL(0.0));
-    if (trace_bound_current < trace_cutoff) {
-      return std::make_pair(false, 0.0);
+    //Recompute the sum from scratch before aborting to rule out rounding errors of the incremental updates
+    trace_bound_sum += trace_bound[braket] - trace_bound_old;
+    if (trace_bound_sum < trace_cutoff) {
+      trace_bound_sum = std::accumulate(trace_bound.begin(), trace_bound.end(), EXTENDED_REAL(0.0));
+      if (trace_bound_sum < trace_cutoff) {
+        return std::make_pair(false, 0.0);
+      }
     }
   }
   return std::make_pair(myabs(trace_sum) > trace_cutoff, trace_sum);
@@ -302,7 +374,7 @@ SlidingWindowManager<MODEL>::lazy_eval_trace(const operator_container_t &operato
 template<typename MODEL>
 void
 SlidingWindowManager<MODEL>::evolve_bra(const MODEL &model, BRAKET_TYPE &bra,
-                                        std::pair<op_it_t, op_it_t> ops_range, double tau_old, double tau_new) {
+                                        const OperatorSequence &ops, double tau_old, double tau_new) {
   if (bra.invalid()) {
     return;
   }
@@ -312,37 +384,24 @@ SlidingWindowManager<MODEL>::evolve_bra(const MODEL &model, BRAKET_TYPE &bra,
   //range check
   assert(tau_new <= tau_old);
 
-  const int num_ops = std::distance(ops_range.first, ops_range.second);
-
-  if (num_ops > 0) {
-    op_it_t it = ops_range.second;
-    --it;//pointing to the operator with the largest tau
-    op_it_t it_down = it;
-    --it_down;
+  const int num_ops = ops.size();
+  const double *times = num_ops > 0 ? &ops.times[0] : 0;
 
-    model.sector_propagate_bra(bra, tau_old - it->time());
-    for (int i = 0; i < num_ops; i++) {
-      model.apply_op_hyb_bra(it->type(), it->flavor(), bra);
-
-      if (it == ops_range.first) {//no more operators left
-        model.sector_propagate_bra(bra, it->time() - tau_new);
-      } else {
-        //there is still some operator left
-        model.sector_propagate_bra(bra, it->time() - it_down->time());
-      }
-      --it;
-      --it_down;
-    }
-  } else {
-    model.sector_propagate_bra(bra, tau_old - tau_new);
+  //from the operator with the largest tau
+  double tau_prev = tau_old;
+  for (int iop = num_ops - 1; iop >= 0; --iop) {
+    model.sector_propagate_bra(bra, tau_prev - times[iop]);
+    model.apply_op_hyb_bra(ops.types[iop], ops.flavors[iop], bra);
+    tau_prev = times[iop];
   }
+  model.sector_propagate_bra(bra, tau_prev - tau_new);
   bra.normalize();
 }
 
 template<typename MODEL>
 void
 SlidingWindowManager<MODEL>::evolve_ket(const MODEL &model, BRAKET_TYPE &ket,
-                                        std::pair<op_it_t, op_it_t> ops_range, double tau_old, double tau_new) {
+                                        const OperatorSequence &ops, double tau_old, double tau_new) {
   if (ket.invalid()) {
     return;
   }
@@ -352,28 +411,16 @@ SlidingWindowManager<MODEL>::evolve_ket(const MODEL &model, BRAKET_TYPE &ket,
 
   ket.normalize();
 
-  const int num_ops = std::distance(ops_range.first, ops_range.second);
-  if (num_ops > 0) {
-    op_it_t it = ops_range.first;
-    op_it_t it_up = it;
-    it_up++;
-
-    BRAKET_TYPE tmp;
-    model.sector_propagate_ket(ket, it->time() - tau_old);
-    for (int i = 0; i < num_ops; i++) {
-      model.apply_op_hyb_ket(it->type(), it->flavor(), ket);
-
-      if (it_up != ops_range.second) {
-        model.sector_propagate_ket(ket, it_up->time() - it->time());
-      } else {
-        model.sector_propagate_ket(ket, tau_new - it->time());
-      }
-      it++;
-      it_up++;
-    }
-  } else {
-    model.sector_propagate_ket(ket, tau_new - tau_old);
+  const int num_ops = ops.size();
+  const double *times = num_ops > 0 ? &ops.times[0] : 0;
+
+  double tau_prev = tau_old;
+  for (int iop = 0; iop < num_ops; ++iop) {
+    model.sector_propagate_ket(ket, times[iop] - tau_prev);
+    model.apply_op_hyb_ket(ops.types[iop], ops.flavors[iop], ket);
+    tau_prev = times[iop];
   }
+  model.sector_propagate_ket(ket, tau_new - tau_prev);
 
   ket.normalize();
 }
@@ -385,9 +432,8 @@ SlidingWindowManager<MODEL>::compute_trace_bound(const operator_container_t &ope
   namespace bll = boost::lambda;
   const double tau_right = get_tau_edge(position_right_edge);
   const double tau_left = get_tau_edge(position_left_edge);
-  std::pair<op_it_t, op_it_t> ops_range = operators.range(tau_right <= bll::_1, bll::_1 <= tau_left);
-  std::vector<psi> ops_in_range(ops_range.first, ops_range.second);
-  const int num_ops = ops_in_range.size();
+  ops_work_.assign(operators.range(tau_right <= bll::_1, bll::_1 <= tau_left));
+  const int num_ops = ops_work_.size();
 
   assert(tau_left >= tau_right);
   assert(bound.size() >= get_num_brakets());
@@ -403,27 +449,21 @@ SlidingWindowManager<MODEL>::compute_trace_bound(const operator_container_t &ope
     EXTENDED_REAL norm_prod = 1.0;
 
     if (num_ops > 0) {
-      std::vector<psi>::const_iterator it = ops_in_range.begin();
-      std::vector<psi>::const_iterator it_up = it;
-      it_up++;
-
       assert(sector_ket >= 0);
-      norm_prod *= compute_exp(sector_ket, it->time() - tau_right);
+      norm_prod *= compute_exp(sector_ket, ops_work_.times[0] - tau_right);
       for (int i = 0; i < num_ops; i++) {
         assert(sector_ket >= 0);
-        sector_ket = p_model->get_dst_sector_ket(it->type(), it->flavor(), sector_ket);
+        if (use_op_norms_in_trace_bound) {
+          norm_prod *= p_model->op_norm(ops_work_.types[i], ops_work_.flavors[i], sector_ket);
+        }
+        sector_ket = p_model->get_dst_sector_ket(ops_work_.types[i], ops_work_.flavors[i], sector_ket);
         if (sector_ket == nirvana) {
           break;
         }
         min_dim = std::min(min_dim, p_model->dim_sector(sector_ket));
 
-        if (it_up != ops_in_range.end()) {
-          norm_prod *= compute_exp(sector_ket, it_up->time() - it->time());
-        } else {
-          norm_prod *= compute_exp(sector_ket, tau_left - it->time());
-        }
-        it++;
-        it_up++;
+        const double tau_next = i + 1 < num_ops ? ops_work_.times[i + 1] : tau_left;
+        norm_prod *= compute_exp(sector_ket, tau_next - ops_work_.times[i]);
       }
       if (sector_ket == nirvana) {
         norm_prod = 0.0;
@@ -443,6 +483,152 @@ SlidingWindowManager<MODEL>::compute_trace_bound(const operator_container_t &ope
 }
 
 
+template<typename MODEL>
+void
+SlidingWindowManager<MODEL>::scan_trace_pair_insertion(const operator_container_t &operators,
+                                                       const psi &op_earlier, const psi &op_later,
+                                                       const std::vector<double> &times,
+                                                       std::vector<EXTENDED_SCALAR> &traces) const {
+  namespace bll = boost::lambda;
+  const int num_times = times.size();
+  traces.resize(num_times);
+  std::fill(traces.begin(), traces.end(), EXTENDED_SCALAR(0.0));
+
+  std::vector<BRAKET_TYPE> bras(num_times);
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    //bras at all the times, evolved from beta
+    BRAKET_TYPE bra = p_model->get_outer_bra(braket);
+    double tau = BETA;
+    for (int i = num_times - 1; i >= 0; --i) {
+      assert(times[i] <= tau);
+      ops_work_.assign(operators.range(times[i] < bll::_1, bll::_1 <= tau));
+      evolve_bra(*p_model, bra, ops_work_, tau, times[i]);
+      bras[i] = bra;
+      tau = times[i];
+    }
+
+    //kets evolved from 0; the pair is inserted into a copy at each time
+    BRAKET_TYPE ket = p_model->get_outer_ket(braket);
+    tau = 0.0;
+    for (int i = 0; i < num_times; ++i) {
+      ops_work_.assign(operators.range(tau <= bll::_1, bll::_1 < times[i]));
+      evolve_ket(*p_model, ket, ops_work_, tau, times[i]);
+      tau = times[i];
+
+      BRAKET_TYPE ket_pair(ket);
+      p_model->apply_op_hyb_ket(op_earlier.type(), op_earlier.flavor(), ket_pair);
+      p_model->apply_op_hyb_ket(op_later.type(), op_later.flavor(), ket_pair);
+      if (!ket_pair.invalid() && !bras[i].invalid() && ket_pair.sector() == bras[i].sector()) {
+        traces[i] += p_model->product(bras[i], ket_pair);
+      }
+    }
+  }
+}
+
+template<typename MODEL>
+void
+SlidingWindowManager<MODEL>::scan_trace_commutator_replacement(const operator_container_t &operators,
+                                                               std::vector<EXTENDED_SCALAR> &traces) const {
+  const std::vector<psi> ops(operators.begin(), operators.end());
+  const int num_ops = ops.size();
+  traces.resize(num_ops);
+  std::fill(traces.begin(), traces.end(), EXTENDED_SCALAR(0.0));
+
+  std::vector<BRAKET_TYPE> bras(num_ops);
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    //bras just after each operator, evolved from beta
+    BRAKET_TYPE bra = p_model->get_outer_bra(braket);
+    double tau = BETA;
+    for (int iop = num_ops - 1; iop >= 0; --iop) {
+      const double t = ops[iop].time().time();
+      p_model->sector_propagate_bra(bra, tau - t);
+      bra.normalize();
+      bras[iop] = bra;
+      p_model->apply_op_hyb_bra(ops[iop].type(), ops[iop].flavor(), bra);
+      tau = t;
+    }
+
+    //kets just before each operator, evolved from 0
+    BRAKET_TYPE ket = p_model->get_outer_ket(braket);
+    tau = 0.0;
+    for (int iop = 0; iop < num_ops; ++iop) {
+      const double t = ops[iop].time().time();
+      p_model->sector_propagate_ket(ket, t - tau);
+      ket.normalize();
+      tau = t;
+
+      if (ops[iop].type() == ANNIHILATION_OP) {
+        BRAKET_TYPE ket_comm(ket);
+        p_model->apply_commutator_hyb_ket(ops[iop].flavor(), ket_comm);
+        if (!ket_comm.invalid() && !bras[iop].invalid() && ket_comm.sector() == bras[iop].sector()) {
+          traces[iop] += p_model->product(bras[iop], ket_comm);
+        }
+      }
+      p_model->apply_op_hyb_ket(ops[iop].type(), ops[iop].flavor(), ket);
+    }
+  }
+}
+
+template<typename MODEL>
+void
+SlidingWindowManager<MODEL>::compute_allowed_intervals(const operator_container_t &operators,
+                                                       const std::vector<psi> &excluded_ops,
+                                                       OPERATOR_TYPE op_type, int flavor,
+                                                       std::vector<std::pair<double, double> > &intervals) const {
+  namespace bll = boost::lambda;
+  typedef operator_container_t::iterator it_t;
+  const double tau_right = get_tau_edge(position_right_edge);
+  const double tau_left = get_tau_edge(position_left_edge);
+  assert(tau_left >= tau_right);
+
+  //boundaries of the intervals: tau_right, operators in the window, tau_left
+  std::vector<psi> ops;
+  std::pair<it_t, it_t> ops_range = operators.range(tau_right <= bll::_1, bll::_1 <= tau_left);
+  for (it_t it = ops_range.first; it != ops_range.second; ++it) {
+    if (std::find(excluded_ops.begin(), excluded_ops.end(), *it) == excluded_ops.end()) {
+      ops.push_back(*it);
+    }
+  }
+  const int num_ops = ops.size();
+
+  //allowed[i] is true if the operator can act on the sector of some braket between the (i-1)-th and i-th operators
+  std::vector<bool> allowed(num_ops + 1, false);
+  for (int braket = 0; braket < num_brakets; ++braket) {
+    if (is_braket_invalid(braket)) {
+      continue;
+    }
+    int sector_ket = right_states[braket].back().sector();
+    for (int i = 0; i <= num_ops; ++i) {
+      assert(sector_ket >= 0);
+      if (p_model->get_dst_sector_ket(op_type, flavor, sector_ket) != nirvana) {
+        allowed[i] = true;
+      }
+      if (i == num_ops) {
+        break;
+      }
+      sector_ket = p_model->get_dst_sector_ket(ops[i].type(), ops[i].flavor(), sector_ket);
+      if (sector_ket == nirvana) {
+        break;
+      }
+    }
+  }
+
+  //merge adjacent allowed intervals
+  intervals.resize(0);
+  for (int i = 0; i <= num_ops; ++i) {
+    if (!allowed[i]) {
+      continue;
+    }
+    const double t_low = i == 0 ? tau_right : ops[i - 1].time().time();
+    const double t_high = i == num_ops ? tau_left : ops[i].time().time();
+    if (!intervals.empty() && intervals.back().second == t_low) {
+      intervals.back().second = t_high;
+    } else {
+      intervals.push_back(std::make_pair(t_low, t_high));
+    }
+  }
+}
+
 template<typename MODEL>
 void
 SlidingWindowManager<MODEL>::move_window_to_next_position(const operator_container_t &operators) {
@@ -14,6 +14,7 @@
 #pragma once
 
 #include <boost/any.hpp>
+#include <boost/shared_ptr.hpp>
 #include <alps/utilities/signal.hpp>
 #include <alps/mc/api.hpp>
 #include <alps/mc/mcbase.hpp>
@@ -31,6 +32,7 @@
 template<typename T> class ImpurityModelEigenBasis;
 template<typename T> class HybridizationSimulation;
 template<typename T> class mymcmpiadapter;
+template<typename T> struct StreamedG2;
 
 namespace alps {
 namespace cthyb {
@@ -47,6 +49,12 @@ class Solver {
   /** Get a reference to accumulated raw Monte Carlo results */
   virtual const alps::accumulators::result_set& get_accumulated_results() const = 0;
 
+  /**
+   * Reduce results too large to be collected on the master process and write them into an HDF5 archive chunk by chunk.
+   * Must be called on all MPI processes after solve(). p_ar is used only on the master process.
+   */
+  virtual void write_streamed_results(alps::hdf5::archive *p_ar) = 0;
+
   typedef alps::gf::three_index_gf<std::complex<double>, alps::gf::itime_mesh,
                                    alps::gf::index_mesh,
                                    alps::gf::index_mesh
@@ -82,11 +90,16 @@ class MatrixSolver : public Solver {
   /** Get a reference to accumulated raw Monte Carlo results */
   const alps::accumulators::result_set& get_accumulated_results() const;
 
+  void write_streamed_results(alps::hdf5::archive *p_ar);
+
  private:
 
   alps::accumulators::result_set mc_results_;
 
   std::map<std::string,boost::any> results_;
+
+  //G2 summed up on each process (measurement.G2.streaming_output)
+  boost::shared_ptr<StreamedG2<Scalar> > p_streamed_G2_;
 };
 
 }
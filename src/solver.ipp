@@ -3,6 +3,7 @@
 #include "util.hpp"
 
 #include <boost/any.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <alps/utilities/signal.hpp>
 #include <alps/mc/api.hpp>
@@ -41,6 +42,33 @@ int MatrixSolver<Scalar>::solve(const std::string& dump_file) {
 
     std::pair<bool, bool> r = sim.run(cb);
 
+    //G2 summed up on each process is written by write_streamed_results()
+    const bool stream_G2 =
+        Base::parameters_["measurement.G2.on"] != 0 && Base::parameters_["measurement.G2.streaming_output"] != 0;
+    if (stream_G2) {
+      std::vector<std::string> names, keys;
+      names.push_back("G2");
+      keys.push_back("G2_LEGENDRE");
+      if (Base::parameters_["measurement.G2.improved_estimator"] != 0) {
+        names.push_back("G2_improved");
+        keys.push_back("G2_IMPROVED_LEGENDRE");
+      }
+      p_streamed_G2_.reset(new StreamedG2<Scalar>());
+      p_streamed_G2_->flavor_map = sim.get_G2_flavor_index_map();
+      p_streamed_G2_->rotmat_Delta = sim.get_rotmat_Delta();
+      p_streamed_G2_->coeff = 0.0;
+      p_streamed_G2_->keys = keys;
+      for (int i = 0; i < names.size(); ++i) {
+        //moved out of the sink so that the process holds only one copy of the local sum
+        p_streamed_G2_->local_sums.push_back(std::vector<std::complex<double> >());
+        sim.take_local_sum(names[i], p_streamed_G2_->local_sums.back());
+        p_streamed_G2_->local_counts.push_back(sim.get_local_count(names[i]));
+      }
+    }
+
+    //Large vector observables reduced by a single MPI_Reduce instead of ALPS (measurement.packed_reduction)
+    const reduced_observables_t reduced_obs = sim.reduce_packed_observables();
+
     if (c.rank() == 0) {
       if (!r.second) {
         throw std::runtime_error("Master process is not thermalized yet. Increase simulation time!");
@@ -53,17 +81,26 @@ int MatrixSolver<Scalar>::solve(const std::string& dump_file) {
         results_["Sign"] = mc_results_["Sign"].template mean<double>();
 
         //Single-particle Green's function
-        compute_G1<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), results_);
+        compute_G1<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), reduced_obs, results_);
+        if (Base::parameters_["measurement.G1.matsubara_nfft"] != 0) {
+          compute_G1_matsubara<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), reduced_obs,
+                                            results_);
+        }
         if (Base::parameters_["measurement.equal_time_G1.on"] != 0) {
           compute_euqal_time_G1<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), results_);
         }
 
         //Two-particle Green's function
-        if (Base::parameters_["measurement.G2.on"] != 0) {
-          compute_G2<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), results_);
+        if (stream_G2) {
+          p_streamed_G2_->coeff = mc_results_["worm_space_volume_G2"].template mean<double>() /
+              (mc_results_["Sign"].template mean<double>() * mc_results_["Z_function_space_volume"].template mean<double>());
+        } else if (Base::parameters_["measurement.G2.on"] != 0) {
+          compute_G2<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), sim.get_G2_flavor_index_map(),
+                                  reduced_obs, results_);
         }
         if (Base::parameters_["measurement.two_time_G2.on"] != 0) {
-          compute_two_time_G2<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), results_);
+          compute_two_time_G2<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), reduced_obs,
+                                           results_);
         }
         if (Base::parameters_["measurement.equal_time_G2.on"] != 0) {
           compute_euqal_time_G2<SOLVER_TYPE>(mc_results_, Base::parameters_, sim.get_rotmat_Delta(), results_);
@@ -93,16 +130,18 @@ int MatrixSolver<Scalar>::solve(const std::string& dump_file) {
     c.barrier();
 
     // Dump data for debug
-    if (c.rank() == 0 && dump_file != "") {
-      alps::hdf5::archive ar(dump_file, "w");
-      ar["/parameters"] << Base::parameters_;
-      ar["/simulation/results"] << this->get_accumulated_results();
-      {
+    if (dump_file != "") {
+      boost::scoped_ptr<alps::hdf5::archive> p_ar;
+      if (c.rank() == 0) {
+        p_ar.reset(new alps::hdf5::archive(dump_file, "w"));
+        (*p_ar)["/parameters"] << Base::parameters_;
+        (*p_ar)["/simulation/results"] << this->get_accumulated_results();
         const std::map<std::string,boost::any> &results = this->get_results();
         for (std::map<std::string,boost::any>::const_iterator it = results.begin(); it != results.end(); ++it) {
-          ar["/" + it->first] << it->second;
+          (*p_ar)["/" + it->first] << it->second;
         }
       }
+      write_streamed_results(p_ar.get());
     }
 
   } catch (const std::exception& e) {
@@ -121,6 +160,20 @@ const std::map<std::string,boost::any>& MatrixSolver<Scalar>::get_results() cons
   return results_;
 }
 
+template<typename Scalar>
+void MatrixSolver<Scalar>::write_streamed_results(alps::hdf5::archive *p_ar) {
+  if (Base::comm_.rank() == 0 && !p_ar) {
+    throw std::runtime_error("HDF5 archive must be given at master MPI process");
+  }
+  if (p_streamed_G2_) {
+    write_streamed_G2(Base::comm_,
+                      Base::parameters_["model.sites"].template as<int>() * Base::parameters_["model.spins"].template as<int>(),
+                      Base::parameters_["measurement.G2.n_legendre"],
+                      Base::parameters_["measurement.G2.n_bosonic_freq"],
+                      *p_streamed_G2_, p_ar);
+  }
+}
+
 template<typename Scalar>
 const alps::accumulators::result_set& MatrixSolver<Scalar>::get_accumulated_results() const {
   if (Base::comm_.rank() != 0) {
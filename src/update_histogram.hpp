@@ -1,7 +1,12 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <map>
+#include <stdexcept>
+#include <string>
 #include <valarray>
+#include <vector>
 
 #ifdef ALPS_HAVE_MPI
 #include <alps/utilities/mpi.hpp>
@@ -376,3 +381,136 @@ class PertOrderRecorder {
   int max_num_data_;
   std::list<int> data_;
 };
+
+//Wall time (in sec) elapsed since t_start (used for ProposalScheduler::record)
+inline double elapsed_seconds(const std::chrono::steady_clock::time_point &t_start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+}
+
+/**
+ * @brief Adaptive frequencies of Monte Carlo updates
+ *
+ * Each update is registered with its nominal number of calls (e.g., per position of the sliding window).
+ * During thermalization, the wall time and the number of accepted moves are recorded for each update.
+ * update_factors() rescales the nominal number of calls of each update in proportion to
+ * its number of accepted moves per second, keeping the expected wall time of a sweep unchanged.
+ * The factors are bounded by [min_factor, max_factor] so that no update is switched off.
+ * Old samples are discarded gradually so that the factors follow the growth of the perturbation order.
+ * The normalization assumes that each update is called num_calls(update, nominal_calls, rng) times,
+ * i.e., nominal_calls * factor times on average.
+ * The factors must be fixed by freeze() before measurement steps.
+ */
+class ProposalScheduler {
+ public:
+  ProposalScheduler(double min_factor = 0.2, double max_factor = 5.0, double decay = 0.99)
+      : min_factor_(min_factor), max_factor_(max_factor), decay_(decay), frozen_(false) {}
+
+  /** Register an update. Return its index. */
+  int add_update(const std::string &name, double nominal_calls) {
+    if (index_.find(name) != index_.end()) {
+      throw std::logic_error("Update " + name + " is already registered in ProposalScheduler.");
+    }
+    index_[name] = names_.size();
+    names_.push_back(name);
+    nominal_calls_.push_back(nominal_calls);
+    factors_.push_back(1.0);
+    num_calls_.push_back(0.0);
+    num_accepted_.push_back(0.0);
+    elapsed_.push_back(0.0);
+    return names_.size() - 1;
+  }
+
+  int num_updates() const { return names_.size(); }
+
+  /** Index of a registered update. Return -1 if not registered. */
+  int index(const std::string &name) const {
+    std::map<std::string, int>::const_iterator it = index_.find(name);
+    return it == index_.end() ? -1 : it->second;
+  }
+
+  const std::string &get_name(int update) const { return names_[update]; }
+
+  double factor(int update) const { return factors_[update]; }
+
+  /** Record the number of calls, accepted moves and wall time (in sec) of an update. Ignored after freeze(). */
+  void record(int update, int num_calls, int num_accepted, double elapsed) {
+    if (frozen_) {
+      return;
+    }
+    num_calls_[update] += num_calls;
+    num_accepted_[update] += num_accepted;
+    elapsed_[update] += elapsed;
+  }
+
+  /** Number of calls of an update: nominal_calls * factor is rounded up or down stochastically. */
+  template<typename RNG>
+  int num_calls(int update, double nominal_calls, RNG &rng) const {
+    const double n = nominal_calls * factors_[update];
+    const int n_floor = static_cast<int>(n);
+    return (n > n_floor && rng() < n - n_floor) ? n_floor + 1 : n_floor;
+  }
+
+  void update_factors() {
+    if (frozen_) {
+      throw std::logic_error("ProposalScheduler::update_factors is called after freeze().");
+    }
+
+    //accepted moves per second averaged over all updates
+    double num_accepted_sum = 0.0, elapsed_sum = 0.0;
+    for (int i = 0; i < names_.size(); ++i) {
+      if (has_samples(i)) {
+        num_accepted_sum += num_accepted_[i];
+        elapsed_sum += elapsed_[i];
+      }
+    }
+    if (num_accepted_sum == 0.0 || elapsed_sum == 0.0) {
+      return;
+    }
+    const double efficiency_ref = num_accepted_sum / elapsed_sum;
+
+    //new factors and normalization of the wall time of a sweep
+    std::vector<double> factors_new(factors_);
+    double time_old = 0.0, time_new = 0.0;
+    for (int i = 0; i < names_.size(); ++i) {
+      if (!has_samples(i)) {
+        continue;
+      }
+      const double time_per_call = elapsed_[i] / num_calls_[i];
+      factors_new[i] = bound((num_accepted_[i] / elapsed_[i]) / efficiency_ref);
+      time_old += nominal_calls_[i] * time_per_call;
+      time_new += nominal_calls_[i] * factors_new[i] * time_per_call;
+    }
+    for (int i = 0; i < names_.size(); ++i) {
+      if (has_samples(i)) {
+        factors_[i] = bound(factors_new[i] * time_old / time_new);
+      }
+    }
+
+    for (int i = 0; i < names_.size(); ++i) {
+      num_calls_[i] *= decay_;
+      num_accepted_[i] *= decay_;
+      elapsed_[i] *= decay_;
+    }
+  }
+
+  /** Fix the factors */
+  void freeze() { frozen_ = true; }
+
+  bool frozen() const { return frozen_; }
+
+ private:
+  bool has_samples(int update) const {
+    return num_calls_[update] > 0.0 && elapsed_[update] > 0.0;
+  }
+
+  double bound(double factor) const {
+    return std::min(std::max(factor, min_factor_), max_factor_);
+  }
+
+  double min_factor_, max_factor_, decay_;
+  bool frozen_;
+  std::map<std::string, int> index_;
+  std::vector<std::string> names_;
+  std::vector<double> nominal_calls_, factors_;
+  std::vector<double> num_calls_, num_accepted_, elapsed_;
+};
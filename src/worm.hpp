@@ -1,8 +1,10 @@
 #pragma once
 
 #include <boost/array.hpp>
+#include <boost/container/static_vector.hpp>
 #include <boost/multi_array.hpp>
 #include <boost/operators.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "operator.hpp"
 
@@ -42,6 +44,12 @@ inline std::string get_config_space_name(ConfigSpace config_space) {
 }
 
 
+/** Maximum number of creation and annihilation operators of a worm */
+const int max_num_worm_operators = 4;
+
+/** Fixed-capacity container of the operators of a worm (no heap allocation) */
+typedef boost::container::static_vector<psi, max_num_worm_operators> worm_operators_t;
+
 /**
  * < T_tau e^{-beta H} O1 (tau1) O2 (tau) ... ON(tau)>
  */
@@ -51,10 +59,13 @@ class Worm {
   virtual boost::shared_ptr<Worm> clone() const = 0;
 
   /** Get the number of creation and annihilation operators (not time-ordered)*/
-  virtual int num_operators() const = 0;
+  int num_operators() const { return operators_.size(); }
 
-  /** Get creation and annihilation operators (not time-ordered)*/
-  virtual std::vector<psi> get_operators() const = 0;
+  /**
+   * Get creation and annihilation operators (not time-ordered)
+   * The operators are stored in the worm and kept up to date when a time or a flavor is modified.
+   */
+  const worm_operators_t &get_operators() const { return operators_; }
 
   /** Number of independent time indices*/
   virtual int num_independent_times() const = 0;
@@ -84,6 +95,9 @@ class Worm {
 
   /** Return worm space */
   virtual ConfigSpace get_config_space() const = 0;
+
+ protected:
+  worm_operators_t operators_;
 };
 
 inline bool is_worm_in_range(const Worm &worm, double tau_low, double tau_high) {
@@ -129,27 +143,19 @@ inline bool operator!=(const Worm &worm1, const Worm &worm2) {
 }
 
 /**
- * Measure < N_{i_0 i_1} (tau_0) ... N_{i_{2M-2} i_{2M-1}} (tau_{M-1})>,
- *  where N_{ij} = c^dagger_i c_j and M = NumTimes.
- * For M=1, we measure the single-particle density matrix.
+ * @brief Common part of concrete worms with NumTimes time indices and NumFlavors flavor indices
+ *
+ * The operators of the worm are rebuilt whenever a time or a flavor index is modified.
+ * Derived must implement update_operators(), which sets operators_ from times_ and flavors_.
+ * It is called via static dispatch (CRTP).
  */
-template<unsigned int NumTimes>
-class CorrelationWorm: public Worm, private boost::equality_comparable<CorrelationWorm<NumTimes> > {
+template<typename Derived, unsigned int NumTimes, unsigned int NumFlavors>
+class WormBase: public Worm {
  public:
-  CorrelationWorm() : time_index_(2 * NumTimes) {
-    for (int f = 0; f < 2 * NumTimes; ++f) {
-      time_index_[f].push_back(f / 2);
-    }
-  }
-
   virtual boost::shared_ptr<Worm> clone() const {
-    return boost::shared_ptr<Worm>(new CorrelationWorm<NumTimes>(*this));
+    return boost::shared_ptr<Worm>(new Derived(static_cast<const Derived &>(*this)));
   }
 
-  virtual int num_operators() const { return 2 * NumTimes; };
-
-  virtual std::vector<psi> get_operators() const;//implemented in worm.ipp
-
   virtual int num_independent_times() const { return NumTimes; }
 
   virtual double get_time(int index) const {
@@ -160,18 +166,51 @@ class CorrelationWorm: public Worm, private boost::equality_comparable<Correlati
   virtual void set_time(int index, double new_time) {
     assert(index >= 0 && index < NumTimes);
     times_[index] = new_time;
+    static_cast<Derived *>(this)->update_operators();
   }
 
-  virtual int num_independent_flavors() const { return 2 * NumTimes; }
+  virtual int num_independent_flavors() const { return NumFlavors; }
 
   virtual int get_flavor(int index) const {
-    assert(index >= 0 && index < 2 * NumTimes);
+    assert(index >= 0 && index < NumFlavors);
     return flavors_[index];
   }
 
   virtual void set_flavor(int index, int new_flavor) {
-    assert(index >= 0 && index < 2 * NumTimes);
+    assert(index >= 0 && index < NumFlavors);
     flavors_[index] = new_flavor;
+    static_cast<Derived *>(this)->update_operators();
+  }
+
+  bool operator==(const Derived &other_worm) const {
+    return (times_ == other_worm.times_ && flavors_ == other_worm.flavors_);
+  }
+
+ protected:
+  WormBase() {
+    std::fill(times_.begin(), times_.end(), 0.0);
+    std::fill(flavors_.begin(), flavors_.end(), 0);
+  }
+
+  boost::array<double, NumTimes> times_;
+  boost::array<int, NumFlavors> flavors_;
+};
+
+/**
+ * Measure < N_{i_0 i_1} (tau_0) ... N_{i_{2M-2} i_{2M-1}} (tau_{M-1})>,
+ *  where N_{ij} = c^dagger_i c_j and M = NumTimes.
+ * For M=1, we measure the single-particle density matrix.
+ */
+template<unsigned int NumTimes>
+class CorrelationWorm: public WormBase<CorrelationWorm<NumTimes>, NumTimes, 2 * NumTimes>,
+                       private boost::equality_comparable<CorrelationWorm<NumTimes> > {
+  BOOST_STATIC_ASSERT(2 * NumTimes <= max_num_worm_operators);
+ public:
+  CorrelationWorm() : time_index_(2 * NumTimes) {
+    for (int f = 0; f < 2 * NumTimes; ++f) {
+      time_index_[f].push_back(f / 2);
+    }
+    update_operators();
   }
 
   virtual const std::vector<int> &get_time_index(int flavor_index) const {
@@ -179,10 +218,6 @@ class CorrelationWorm: public Worm, private boost::equality_comparable<Correlati
     return time_index_[flavor_index];
   }
 
-  virtual bool operator==(const CorrelationWorm<NumTimes> &other_worm) const {
-    return (times_ == other_worm.times_ && flavors_ == other_worm.flavors_);
-  }
-
   ConfigSpace get_config_space() const {
     if (NumTimes == 2) {
       return Two_time_G2;
@@ -191,9 +226,9 @@ class CorrelationWorm: public Worm, private boost::equality_comparable<Correlati
     }
   }
 
+  void update_operators();//implemented in worm.ipp
+
  private:
-  boost::array<double, NumTimes> times_;
-  boost::array<int, 2 * NumTimes> flavors_;
   std::vector<std::vector<int> > time_index_;
 };
 
@@ -204,44 +239,14 @@ class CorrelationWorm: public Worm, private boost::equality_comparable<Correlati
  *
  */
 template<unsigned int Rank>
-class GWorm: public Worm, private boost::equality_comparable<GWorm<Rank> > {
+class GWorm: public WormBase<GWorm<Rank>, 2 * Rank, 2 * Rank>, private boost::equality_comparable<GWorm<Rank> > {
+  BOOST_STATIC_ASSERT(2 * Rank <= max_num_worm_operators);
  public:
   GWorm() : time_index_(2 * Rank) {
     for (int f = 0; f < 2 * Rank; ++f) {
       time_index_[f].push_back(f);
     }
-  }
-
-  virtual boost::shared_ptr<Worm> clone() const {
-    return boost::shared_ptr<Worm>(new GWorm<Rank>(*this));
-  }
-
-  virtual int num_operators() const { return 2 * Rank; };
-
-  virtual std::vector<psi> get_operators() const;//implemented in worm.ipp
-
-  virtual int num_independent_times() const { return 2 * Rank; }
-
-  virtual double get_time(int index) const {
-    assert(index >= 0 && index < 2 * Rank);
-    return times_[index];
-  }
-
-  virtual void set_time(int index, double new_time) {
-    assert(index >= 0 && index < 2 * Rank);
-    times_[index] = new_time;
-  }
-
-  virtual int num_independent_flavors() const { return 2 * Rank; }
-
-  virtual int get_flavor(int index) const {
-    assert(index >= 0 && index < 2 * Rank);
-    return flavors_[index];
-  }
-
-  virtual void set_flavor(int index, int new_flavor) {
-    assert(index >= 0 && index < 2 * Rank);
-    flavors_[index] = new_flavor;
+    update_operators();
   }
 
   virtual const std::vector<int> &get_time_index(int flavor_index) const {
@@ -249,10 +254,6 @@ class GWorm: public Worm, private boost::equality_comparable<GWorm<Rank> > {
     return time_index_[flavor_index];
   }
 
-  virtual bool operator==(const GWorm<Rank> &other_worm) const {
-    return (times_ == other_worm.times_ && flavors_ == other_worm.flavors_);
-  }
-
   ConfigSpace get_config_space() const {
     if (Rank == 1) {
       return G1;
@@ -263,9 +264,9 @@ class GWorm: public Worm, private boost::equality_comparable<GWorm<Rank> > {
     }
   }
 
+  void update_operators();//implemented in worm.ipp
+
  private:
-  boost::array<double, 2 * Rank> times_;
-  boost::array<int, 2 * Rank> flavors_;
   std::vector<std::vector<int> > time_index_;
 };
 
@@ -276,42 +277,13 @@ class GWorm: public Worm, private boost::equality_comparable<GWorm<Rank> > {
  *
  */
 template<unsigned int Rank>
-class EqualTimeGWorm: public Worm, private boost::equality_comparable<EqualTimeGWorm<Rank> > {
+class EqualTimeGWorm: public WormBase<EqualTimeGWorm<Rank>, 1, 2 * Rank>,
+                      private boost::equality_comparable<EqualTimeGWorm<Rank> > {
+  BOOST_STATIC_ASSERT(2 * Rank <= max_num_worm_operators);
  public:
   EqualTimeGWorm() {
     time_index_.push_back(0);
-  }
-
-  virtual boost::shared_ptr<Worm> clone() const {
-    return boost::shared_ptr<Worm>(new EqualTimeGWorm<Rank>(*this));
-  }
-
-  virtual int num_operators() const { return 2 * Rank; };
-
-  virtual std::vector<psi> get_operators() const;//implemented in worm.ipp
-
-  virtual int num_independent_times() const { return 1; }
-
-  virtual double get_time(int index) const {
-    assert(index == 0);
-    return time_;
-  }
-
-  virtual void set_time(int index, double new_time) {
-    assert(index == 0);
-    time_ = new_time;
-  }
-
-  virtual int num_independent_flavors() const { return 2 * Rank; }
-
-  virtual int get_flavor(int index) const {
-    assert(index >= 0 && index < 2 * Rank);
-    return flavors_[index];
-  }
-
-  virtual void set_flavor(int index, int new_flavor) {
-    assert(index >= 0 && index < 2 * Rank);
-    flavors_[index] = new_flavor;
+    update_operators();
   }
 
   virtual const std::vector<int> &get_time_index(int flavor_index) const {
@@ -319,10 +291,6 @@ class EqualTimeGWorm: public Worm, private boost::equality_comparable<EqualTimeG
     return time_index_;
   }
 
-  virtual bool operator==(const EqualTimeGWorm<Rank> &other_worm) const {
-    return (time_ == other_worm.time_ && flavors_ == other_worm.flavors_);
-  }
-
   ConfigSpace get_config_space() const {
     if (Rank == 1) {
       return Equal_time_G1;
@@ -333,9 +301,9 @@ class EqualTimeGWorm: public Worm, private boost::equality_comparable<EqualTimeG
     }
   }
 
+  void update_operators();//implemented in worm.ipp
+
  private:
-  double time_;
-  boost::array<int, 2 * Rank> flavors_;
   std::vector<int> time_index_;
 };
 
@@ -1,73 +1,70 @@
 #include "worm.hpp"
 
 template<unsigned int NumTimes>
-std::vector<psi> CorrelationWorm<NumTimes>::get_operators() const {
-  std::vector<psi> ops;
+void CorrelationWorm<NumTimes>::update_operators() {
+  this->operators_.resize(0);
   for (int it = 0; it < NumTimes; ++it) {
     //creation operator
-    ops.push_back(
+    this->operators_.push_back(
         psi(
-            OperatorTime(times_[it], 1), CREATION_OP, flavors_[2 * it]
+            OperatorTime(this->times_[it], 1), CREATION_OP, this->flavors_[2 * it]
         )
     );
     //annihilation operator
-    ops.push_back(
+    this->operators_.push_back(
         psi(
-            OperatorTime(times_[it], 0), ANNIHILATION_OP, flavors_[2 * it + 1]
+            OperatorTime(this->times_[it], 0), ANNIHILATION_OP, this->flavors_[2 * it + 1]
         )
     );
   }
-  return ops;
 }
 
 /**
- * Returns c c^dagger ,..., c c^dagger
+ * Operators are c c^dagger ,..., c c^dagger
  */
 template<unsigned int Rank>
-std::vector<psi> GWorm<Rank>::get_operators() const {
-  std::vector<psi> ops;
+void GWorm<Rank>::update_operators() {
+  this->operators_.resize(0);
   for (int it = 0; it < Rank; ++it) {
     //annihilation operator
-    ops.push_back(
+    this->operators_.push_back(
         psi(
-            OperatorTime(times_[2 * it], 0), ANNIHILATION_OP, flavors_[2 * it]
+            OperatorTime(this->times_[2 * it], 0), ANNIHILATION_OP, this->flavors_[2 * it]
         )
     );
     //creation operator
-    ops.push_back(
+    this->operators_.push_back(
         psi(
-            OperatorTime(times_[2 * it + 1], 0), CREATION_OP, flavors_[2 * it + 1]
+            OperatorTime(this->times_[2 * it + 1], 0), CREATION_OP, this->flavors_[2 * it + 1]
         )
     );
   }
-  return ops;
 }
 
 /**
- * Returns c^dagger c ,..., c^dagger c
+ * Operators are c^dagger c ,..., c^dagger c
  */
 template<unsigned int Rank>
-std::vector<psi> EqualTimeGWorm<Rank>::get_operators() const {
-  std::vector<psi> ops;
+void EqualTimeGWorm<Rank>::update_operators() {
+  this->operators_.resize(0);
   int small_idx = 2 * Rank - 1;
   for (int it = 0; it < Rank; ++it) {
     //creation operator
-    ops.push_back(
+    this->operators_.push_back(
         psi(
-            OperatorTime(time_, small_idx), CREATION_OP, flavors_[2 * it]
+            OperatorTime(this->times_[0], small_idx), CREATION_OP, this->flavors_[2 * it]
         )
     );
     -- small_idx;
 
     //annihilation operator
-    ops.push_back(
+    this->operators_.push_back(
         psi(
-            OperatorTime(time_, small_idx), ANNIHILATION_OP, flavors_[2 * it + 1]
+            OperatorTime(this->times_[0], small_idx), ANNIHILATION_OP, this->flavors_[2 * it + 1]
         )
     );
     -- small_idx;
 
   }
   assert (small_idx == -1);
-  return ops;
 }
@@ -274,6 +274,53 @@ TEST(FastUpdate, BlockMatrixReplaceLastRowsColsWithDifferentSizes) {
   }
 }
 
+TEST(FastUpdate, FlatSet) {
+  namespace bll = boost::lambda;
+  typedef alps::fastupdate::FlatSet<creator> flat_set_t;
+  typedef boost::multi_index::multi_index_container<creator> multi_index_t;
+
+  boost::mt19937 gen(100);
+  boost::uniform_01<> unidist;
+
+  flat_set_t flat_set;
+  multi_index_t ref_set;
+  for (int itest=0; itest<1000; ++itest) {
+    //times on a coarse grid to hit equivalent elements
+    const creator op(static_cast<int>(2*unidist(gen)), static_cast<int>(50*unidist(gen))/50.0);
+    if (unidist(gen) < 0.6) {
+      ASSERT_EQ(flat_set.insert(op).second, ref_set.insert(op).second);
+    } else {
+      ASSERT_EQ(flat_set.erase(op), ref_set.erase(op));
+    }
+    ASSERT_TRUE(std::equal(flat_set.begin(), flat_set.end(), ref_set.begin()));
+    ASSERT_EQ(flat_set.size(), ref_set.size());
+
+    const double t1 = unidist(gen), t2 = unidist(gen);
+    const creator op_low(0, std::min(t1, t2)), op_high(0, std::max(t1, t2));
+    std::pair<flat_set_t::iterator,flat_set_t::iterator> r = flat_set.range(!(bll::_1 < op_low), bll::_1 < op_high);
+    std::pair<multi_index_t::iterator,multi_index_t::iterator> r_ref = ref_set.range(!(bll::_1 < op_low), bll::_1 < op_high);
+    ASSERT_EQ(std::distance(r.first, r.second), std::distance(r_ref.first, r_ref.second));
+    ASSERT_EQ(std::distance(flat_set.begin(), r.first), std::distance(ref_set.begin(), r_ref.first));
+    ASSERT_EQ(std::distance(flat_set.begin(), flat_set.lower_bound(op)), std::distance(ref_set.begin(), ref_set.lower_bound(op)));
+    ASSERT_EQ(std::distance(flat_set.begin(), flat_set.upper_bound(op)), std::distance(ref_set.begin(), ref_set.upper_bound(op)));
+    ASSERT_EQ(flat_set.find(op) == flat_set.end(), ref_set.find(op) == ref_set.end());
+  }
+
+  //insertion of a range with duplicates: the first one survives as in multi_index_container
+  std::vector<creator> ops;
+  for (int i=0; i<100; ++i) {
+    ops.push_back(creator(i%3, static_cast<int>(50*unidist(gen))/50.0));
+  }
+  flat_set.insert(ops.begin(), ops.end());
+  ref_set.insert(ops.begin(), ops.end());
+  ASSERT_EQ(flat_set.size(), ref_set.size());
+  multi_index_t::iterator it_ref = ref_set.begin();
+  for (flat_set_t::iterator it = flat_set.begin(); it != flat_set.end(); ++it, ++it_ref) {
+    ASSERT_EQ(it->time(), it_ref->time());
+    ASSERT_EQ(it->flavor(), it_ref->flavor());
+  }
+}
+
 template<class T>
 class DeterminantMatrixTypedTest : public testing::Test {
 };
@@ -654,3 +701,192 @@ TYPED_TEST(DeterminantMatrixTypedTest, ReplaceRowCol) {
   }
 
 }
+
+TYPED_TEST(DeterminantMatrixTypedTest, TransformOperators) {
+  using namespace alps::fastupdate;
+  typedef std::complex<double> Scalar;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+
+  const int n_flavors = 2;
+  const double beta = 1.0;
+  const int pert_order = 10;
+
+  typedef TypeParam determinant_matrix_t;
+  const int seed = 124;
+  boost::mt19937 gen(seed);
+  boost::uniform_01<> unidist;
+
+  //G0 is invariant under an exchange of flavors and periodic in imaginary time
+  std::vector<double> E(n_flavors, 0.001);
+  boost::multi_array<Scalar,2> phase(boost::extents[n_flavors][n_flavors]);
+  std::fill(phase.origin(), phase.origin() + phase.num_elements(), 1.0);
+
+  std::vector<std::pair<creator,annihilator> > init_ops;
+  for (int i=0; i<pert_order; ++i) {
+    const int f1 = n_flavors*unidist(gen);
+    init_ops.push_back(std::make_pair(creator(f1, unidist(gen)*beta), annihilator(f1, unidist(gen)*beta)));
+  }
+
+  boost::shared_ptr<OffDiagonalG0<Scalar> > p_gf(new OffDiagonalG0<Scalar>(beta, n_flavors, E, phase));
+  determinant_matrix_t det_mat(p_gf, init_ops.begin(), init_ops.end());
+
+  for (int itest=0; itest<10; ++itest) {
+    const Scalar det_old = det_mat.compute_determinant();
+
+    //shift all operators in imaginary time and exchange flavors
+    const double shift = unidist(gen)*beta;
+    std::vector<creator> cdagg_ops_new;
+    std::vector<annihilator> c_ops_new;
+    std::vector<std::pair<creator,annihilator> > ops_new;
+    for (int iop=0; iop<pert_order; ++iop) {
+      const creator& cdagg = det_mat.get_cdagg_ops()[iop];
+      const annihilator& c = det_mat.get_c_ops()[iop];
+      cdagg_ops_new.push_back(creator(1-cdagg.flavor(), std::fmod(cdagg.time()+shift, beta)));
+      c_ops_new.push_back(annihilator(1-c.flavor(), std::fmod(c.time()+shift, beta)));
+      ops_new.push_back(std::make_pair(cdagg_ops_new.back(), c_ops_new.back()));
+    }
+    const std::vector<int> signs(pert_order, 1);
+
+    const Scalar det_rat = det_mat.transform_operators(cdagg_ops_new, c_ops_new, signs, signs);
+
+    determinant_matrix_t det_mat_ref(p_gf, ops_new.begin(), ops_new.end());
+    const Scalar det_new = det_mat_ref.compute_determinant();
+    ASSERT_TRUE(std::abs(det_new/det_old-det_rat) / std::abs(det_rat) < 1E-8);
+    ASSERT_TRUE(std::abs(det_mat.compute_determinant()/det_new-1.0) < 1E-8);
+
+    //check inverse matrix
+    eigen_matrix_t inv_mat = det_mat.compute_inverse_matrix();
+    det_mat.rebuild_inverse_matrix();
+    eigen_matrix_t inv_mat_rebuilt = det_mat.compute_inverse_matrix();
+    ASSERT_TRUE((inv_mat-inv_mat_rebuilt).squaredNorm()/inv_mat_rebuilt.squaredNorm() < 1E-8);
+  }
+}
+
+template<class T>
+class DeterminantMatrixAntiperiodicTypedTest : public testing::Test {
+};
+TYPED_TEST_CASE(DeterminantMatrixAntiperiodicTypedTest, AntiperiodicTestTypes);
+
+//Operators winding around beta change the signs of their rows/cols (see OperatorShift::antiperiodic_sign)
+TYPED_TEST(DeterminantMatrixAntiperiodicTypedTest, TransformOperatorsWithSigns) {
+  using namespace alps::fastupdate;
+  typedef std::complex<double> Scalar;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+
+  const int n_flavors = 2;
+  const double beta = 1.0;
+  const int pert_order = 10;
+
+  typedef TypeParam determinant_matrix_t;
+  const int seed = 124;
+  boost::mt19937 gen(seed);
+  boost::uniform_01<> unidist;
+
+  //G0 is invariant under an exchange of flavors
+  std::vector<double> E;
+  for (int k=0; k<41; ++k) {
+    E.push_back(-10.0+0.5*k);
+  }
+
+  std::vector<std::pair<creator,annihilator> > init_ops;
+  for (int i=0; i<pert_order; ++i) {
+    const int f1 = n_flavors*unidist(gen);
+    init_ops.push_back(std::make_pair(creator(f1, unidist(gen)*beta), annihilator(f1, unidist(gen)*beta)));
+  }
+
+  boost::shared_ptr<AntiperiodicG0<Scalar> > p_gf(new AntiperiodicG0<Scalar>(beta, n_flavors, E));
+  determinant_matrix_t det_mat(p_gf, init_ops.begin(), init_ops.end());
+
+  for (int itest=0; itest<10; ++itest) {
+    const Scalar det_old = det_mat.compute_determinant();
+
+    //shift all operators in imaginary time and exchange flavors
+    const double shift = (0.3 + 0.4*unidist(gen))*beta;
+    std::vector<creator> cdagg_ops_new;
+    std::vector<annihilator> c_ops_new;
+    std::vector<std::pair<creator,annihilator> > ops_new;
+    std::vector<int> sign_cdagg, sign_c;
+    for (int iop=0; iop<pert_order; ++iop) {
+      const creator& cdagg = det_mat.get_cdagg_ops()[iop];
+      const annihilator& c = det_mat.get_c_ops()[iop];
+      cdagg_ops_new.push_back(creator(1-cdagg.flavor(), std::fmod(cdagg.time()+shift, beta)));
+      c_ops_new.push_back(annihilator(1-c.flavor(), std::fmod(c.time()+shift, beta)));
+      sign_cdagg.push_back(cdagg.time()+shift > beta ? -1 : 1);
+      sign_c.push_back(c.time()+shift > beta ? -1 : 1);
+      ops_new.push_back(std::make_pair(cdagg_ops_new.back(), c_ops_new.back()));
+    }
+    ASSERT_TRUE(std::count(sign_cdagg.begin(), sign_cdagg.end(), -1) + std::count(sign_c.begin(), sign_c.end(), -1) > 0);
+
+    const Scalar det_rat = det_mat.transform_operators(cdagg_ops_new, c_ops_new, sign_cdagg, sign_c);
+
+    determinant_matrix_t det_mat_ref(p_gf, ops_new.begin(), ops_new.end());
+    const Scalar det_new = det_mat_ref.compute_determinant();
+    ASSERT_TRUE(std::abs(det_new/det_old-det_rat) / std::abs(det_rat) < 1E-8);
+    ASSERT_TRUE(std::abs(det_mat.compute_determinant()/det_new-1.0) < 1E-8);
+
+    //check inverse matrix against the one rebuilt from scratch
+    eigen_matrix_t inv_mat = det_mat.compute_inverse_matrix();
+    det_mat.rebuild_inverse_matrix();
+    eigen_matrix_t inv_mat_rebuilt = det_mat.compute_inverse_matrix();
+    ASSERT_TRUE((inv_mat-inv_mat_rebuilt).squaredNorm()/inv_mat_rebuilt.squaredNorm() < 1E-8);
+  }
+}
+
+TEST(FastUpdate, PartitionedSetOperators) {
+  using namespace alps::fastupdate;
+  typedef std::complex<double> Scalar;
+  typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> eigen_matrix_t;
+  typedef DeterminantMatrixPartitioned<Scalar, OffDiagonalG0<Scalar>, creator, annihilator> determinant_matrix_t;
+
+  const int n_flavors = 3;
+  const double beta = 1.0;
+  const int pert_order = 6;
+
+  const int seed = 122;
+  boost::mt19937 gen(seed);
+  boost::uniform_01<> unidist;
+
+  std::vector<double> E(n_flavors);
+  boost::multi_array<Scalar,2> phase(boost::extents[n_flavors][n_flavors]);
+  for (int i=0; i<n_flavors; ++i) {
+    E[i] = unidist(gen);
+    for (int j=0; j<n_flavors; ++j) {
+      phase[i][j] = std::exp(Scalar(0.0, 2*unidist(gen)*M_PI));
+    }
+  }
+  boost::shared_ptr<OffDiagonalG0<Scalar> > p_gf(new OffDiagonalG0<Scalar>(beta, n_flavors, E, phase));
+
+  std::vector<std::pair<creator,annihilator> > ops;
+  for (int i=0; i<pert_order; ++i) {
+    const int f = i%n_flavors;
+    ops.push_back(std::make_pair(creator(f, unidist(gen)*beta), annihilator(f, unidist(gen)*beta)));
+  }
+  determinant_matrix_t det_mat_ref(p_gf, ops.begin(), ops.end());
+
+  //operators in an arbitrary order and inverse matrices computed outside
+  determinant_matrix_t det_mat(p_gf);
+  std::vector<std::vector<creator> > cdagg_ops(det_mat.num_blocks());
+  std::vector<std::vector<annihilator> > c_ops(det_mat.num_blocks());
+  for (int i=0; i<pert_order; ++i) {
+    cdagg_ops[det_mat.block_belonging_to(ops[i].first.flavor())].push_back(ops[i].first);
+    c_ops[det_mat.block_belonging_to(ops[i].second.flavor())].push_back(ops[i].second);
+  }
+  std::vector<eigen_matrix_t> inv_matrices(det_mat.num_blocks());
+  for (int ib=0; ib<det_mat.num_blocks(); ++ib) {
+    const int size = cdagg_ops[ib].size();
+    eigen_matrix_t G(size, size);
+    for (int row=0; row<size; ++row) {
+      for (int col=0; col<size; ++col) {
+        G(row, col) = p_gf->operator()(c_ops[ib][row], cdagg_ops[ib][col]);
+      }
+    }
+    inv_matrices[ib] = size > 0 ? eigen_matrix_t(G.inverse()) : eigen_matrix_t(0, 0);
+  }
+  det_mat.set_operators(cdagg_ops, c_ops, inv_matrices);
+
+  ASSERT_EQ(det_mat.size(), pert_order);
+  ASSERT_TRUE(std::abs(det_mat.compute_determinant()/det_mat_ref.compute_determinant()-1.0) < 1E-8);
+  const eigen_matrix_t inv_mat = det_mat.compute_inverse_matrix();
+  const eigen_matrix_t inv_mat_ref = det_mat_ref.compute_inverse_matrix();
+  ASSERT_TRUE((inv_mat-inv_mat_ref).squaredNorm()/inv_mat_ref.squaredNorm() < 1E-8);
+}
@@ -8,6 +8,10 @@
 #include <boost/random.hpp>
 #include <boost/multi_array.hpp>
 #include <boost/range/irange.hpp>
+#include <boost/lambda/lambda.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/identity.hpp>
 
 //To avoid compiler errors for intel compiler on a cray machine
 #define GTEST_USE_OWN_TR1_TUPLE 1
@@ -142,6 +146,53 @@ struct OffDiagonalG0 {
 };
 
 
+//Antiperiodic G0 diagonal in flavor: F(tau-beta) = -F(tau)
+//Each flavor is coupled to bath levels E (with equal weights) so that the determinant does not vanish.
+template<typename T>
+struct AntiperiodicG0 {
+  AntiperiodicG0 (double beta, int n_flavor, const std::vector<double>& E) : beta_(beta), n_flavor_(n_flavor), E_(E) {}
+
+  int nflavor() const {return n_flavor_;}
+  int num_flavors() const {return n_flavor_;}
+  bool is_connected(int flavor, int flavor2) const {
+    return flavor==flavor2;
+  }
+
+  T operator() (const annihilator& c_op, const creator& cdagg_op) const {
+    if (!is_connected(operator_flavor(c_op), operator_flavor(cdagg_op))) {
+      return 0.0;
+    }
+    double dt = c_op.time()-cdagg_op.time();
+    double sign = 1.0;
+    if (dt < 0) {
+      dt += beta_;
+      sign = -1.0;
+    }
+    double val = 0.0;
+    for (int k=0; k<E_.size(); ++k) {
+      val += std::exp(-E_[k]*dt)/(1+std::exp(-beta_*E_[k]));
+    }
+    return -sign*val/E_.size();
+  }
+
+  double beta_;
+  int n_flavor_;
+  std::vector<double> E_;
+};
+
+typedef ::testing::Types<
+  alps::fastupdate::DeterminantMatrix<
+    std::complex<double>,
+    AntiperiodicG0<std::complex<double> >,
+    creator,
+    annihilator>,
+  alps::fastupdate::DeterminantMatrixPartitioned<
+    std::complex<double>,
+    AntiperiodicG0<std::complex<double> >,
+    creator,
+    annihilator
+  >
+>AntiperiodicTestTypes;
 
 typedef ::testing::Types<
   alps::fastupdate::DeterminantMatrix<
@@ -100,6 +100,397 @@ TEST(ModelLibrary, AutoPartioning) {
 
   ImpurityModelEigenBasis<SCALAR>::define_parameters(par);
   ImpurityModelEigenBasis<SCALAR> model(par, t_list, Uval_list);
+
+  //spin flip is a symmetry, while exchanging up spin of site 0 and down spin of site 1 is not.
+  std::vector<int> spin_flip(2 * sites), exchange(2 * sites);
+  for (int flavor = 0; flavor < 2 * sites; ++flavor) {
+    spin_flip[flavor] = (flavor + sites) % (2 * sites);
+    exchange[flavor] = flavor;
+  }
+  std::swap(exchange[0], exchange[1 + sites]);
+  ASSERT_TRUE(model.is_invariant_under_flavor_exchange(&spin_flip[0]));
+  ASSERT_FALSE(model.is_invariant_under_flavor_exchange(&exchange[0]));
+
+  //the number of up-spin electrons is conserved, while that in a single orbital is not because of spin flip.
+  std::vector<int> up_flavors;
+  for (int site = 0; site < sites; ++site) {
+    up_flavors.push_back(site);
+  }
+  ASSERT_TRUE(model.conserves_num_electrons(up_flavors));
+  ASSERT_FALSE(model.conserves_num_electrons(std::vector<int>(1, 0)));
+}
+
+TEST(SlidingWindow, LazyTraceEvaluation) {
+  typedef double SCALAR;
+  typedef ImpurityModelEigenBasis<SCALAR> MODEL;
+  typedef SlidingWindowManager<MODEL>::EXTENDED_SCALAR EXTENDED_SCALAR;
+  alps::params par;
+  const int sites = 2;
+  const int flavors = 2 * sites;
+  const double beta = 5.0, onsite_U = 2.0, JH = 0.3;
+  par["model.sites"] = sites;
+  par["model.spins"] = 2;
+  par["model.n_tau_hyb"] = 100;
+  par["model.onsite_U"] = onsite_U;
+  par["model.beta"] = beta;
+
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > Uval_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int isp2 = 0; isp2 < 2; ++isp2) {
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, isp, isp2, onsite_U, sites));
+      }
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        for (int beta = 0; beta < sites; ++beta) {
+          if (alpha == beta) continue;
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, alpha, beta, isp, isp2, onsite_U - 2 * JH, sites));
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, beta, alpha, isp, isp2, JH, sites));
+        }
+      }
+    }
+  }
+  std::vector<boost::tuple<int, int, SCALAR> > t_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int alpha = 0; alpha < sites; ++alpha) {
+      for (int beta = 0; beta < sites; ++beta) {
+        t_list.push_back(boost::make_tuple(alpha + isp * sites, beta + isp * sites, alpha == beta ? -0.5 * onsite_U : -0.3));
+      }
+    }
+  }
+  MODEL::define_parameters(par);
+  MODEL model(par, t_list, Uval_list);
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+  for (int trial = 0; trial < 20; ++trial) {
+    //alternating creation and annihilation operators for each flavor
+    operator_container_t operators;
+    for (int flavor = 0; flavor < flavors; ++flavor) {
+      std::vector<double> times(2 * static_cast<int>(3 * uni_dist(gen)));
+      for (int i = 0; i < times.size(); ++i) {
+        times[i] = beta * uni_dist(gen);
+      }
+      std::sort(times.begin(), times.end());
+      for (int i = 0; i < times.size(); ++i) {
+        operators.insert(psi(OperatorTime(times[i]), i % 2 == 0 ? CREATION_OP : ANNIHILATION_OP, flavor));
+      }
+    }
+
+    SlidingWindowManager<MODEL> sliding_window(&model, beta);
+    sliding_window.set_use_op_norms_in_trace_bound(trial % 2 == 0);
+    sliding_window.init_stacks(1 + trial % 4, operators);
+    for (int move = 0; move < trial % 5; ++move) {
+      sliding_window.move_window_to_next_position(operators);
+    }
+    const double trace = convert_to_scalar(sliding_window.compute_trace(operators));
+
+    std::vector<EXTENDED_REAL> trace_bound(sliding_window.get_num_brakets());
+    ASSERT_TRUE(std::abs(trace) <= sliding_window.compute_trace_bound(operators, trace_bound));
+    std::pair<bool, EXTENDED_SCALAR> r = sliding_window.lazy_eval_trace(operators, 0.5 * std::abs(trace), trace_bound);
+    ASSERT_TRUE(r.first);
+    ASSERT_NEAR(convert_to_scalar(r.second), trace, 1E-8 * std::abs(trace));
+
+    sliding_window.compute_trace_bound(operators, trace_bound);
+    ASSERT_FALSE(sliding_window.lazy_eval_trace(operators, 1.5 * std::abs(trace), trace_bound).first);
+  }
+}
+
+TEST(SlidingWindow, CommutatorReplacement) {
+  typedef double SCALAR;
+  typedef ImpurityModelEigenBasis<SCALAR> MODEL;
+  typedef SlidingWindowManager<MODEL>::EXTENDED_SCALAR EXTENDED_SCALAR;
+  alps::params par;
+  const int sites = 2;
+  const int flavors = 2 * sites;
+  const double beta = 5.0, onsite_U = 2.0, JH = 0.3;
+  par["model.sites"] = sites;
+  par["model.spins"] = 2;
+  par["model.n_tau_hyb"] = 100;
+  par["model.onsite_U"] = onsite_U;
+  par["model.beta"] = beta;
+
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > Uval_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int isp2 = 0; isp2 < 2; ++isp2) {
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, isp, isp2, onsite_U, sites));
+      }
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        for (int beta = 0; beta < sites; ++beta) {
+          if (alpha == beta) continue;
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, alpha, beta, isp, isp2, onsite_U - 2 * JH, sites));
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, beta, alpha, isp, isp2, JH, sites));
+        }
+      }
+    }
+  }
+  boost::multi_array<SCALAR, 2> hopping(boost::extents[flavors][flavors]);
+  std::fill(hopping.origin(), hopping.origin() + hopping.num_elements(), 0.0);
+  std::vector<boost::tuple<int, int, SCALAR> > t_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int alpha = 0; alpha < sites; ++alpha) {
+      for (int beta = 0; beta < sites; ++beta) {
+        hopping[alpha + isp * sites][beta + isp * sites] = alpha == beta ? -0.5 * onsite_U - 0.2 * alpha : -0.3;
+        t_list.push_back(
+            boost::make_tuple(alpha + isp * sites, beta + isp * sites, hopping[alpha + isp * sites][beta + isp * sites]));
+      }
+    }
+  }
+  MODEL::define_parameters(par);
+  MODEL model(par, t_list, Uval_list);
+
+  //d/dtau Tr[... d_a(tau) ...] = -Tr[... [d_a, H_loc](tau) ...] and [d_a, H_loc] = [d_a, H_U] + sum_j t_aj d_j
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+  const double h = 1E-5;
+  for (int trial = 0; trial < 20; ++trial) {
+    operator_container_t operators;
+    for (int flavor = 0; flavor < flavors; ++flavor) {
+      std::vector<double> times(2 * static_cast<int>(3 * uni_dist(gen)));
+      for (int i = 0; i < times.size(); ++i) {
+        times[i] = h + (beta - 2 * h) * uni_dist(gen);
+      }
+      std::sort(times.begin(), times.end());
+      for (int i = 0; i < times.size(); ++i) {
+        operators.insert(psi(OperatorTime(times[i]), i % 2 == 0 ? CREATION_OP : ANNIHILATION_OP, flavor));
+      }
+    }
+
+    SlidingWindowManager<MODEL> sliding_window(&model, beta);
+    sliding_window.init_stacks(1, operators);
+    std::vector<EXTENDED_SCALAR> traces;
+    sliding_window.scan_trace_commutator_replacement(operators, traces);
+    ASSERT_EQ(traces.size(), operators.size());
+
+    const std::vector<psi> ops(operators.begin(), operators.end());
+    std::vector<double> traces_ref(ops.size(), 0.0);
+    double scale = std::abs(convert_to_scalar(sliding_window.compute_trace(operators)));
+    for (int iop = 0; iop < ops.size(); ++iop) {
+      if (ops[iop].type() == CREATION_OP) {
+        continue;
+      }
+      operator_container_t ops_replaced(operators);
+      ops_replaced.erase(ops[iop]);
+      for (int sign = -1; sign <= 1; sign += 2) {
+        operator_container_t ops_shifted(ops_replaced);
+        ops_shifted.insert(psi(OperatorTime(ops[iop].time().time() + sign * h), ANNIHILATION_OP, ops[iop].flavor()));
+        traces_ref[iop] -= sign * convert_to_scalar(sliding_window.compute_trace(ops_shifted)) / (2 * h);
+      }
+      for (int flavor = 0; flavor < flavors; ++flavor) {
+        operator_container_t ops_flavor(ops_replaced);
+        ops_flavor.insert(psi(ops[iop].time(), ANNIHILATION_OP, flavor));
+        traces_ref[iop] -=
+            hopping[ops[iop].flavor()][flavor] * convert_to_scalar(sliding_window.compute_trace(ops_flavor));
+      }
+      scale = std::max(scale, std::abs(traces_ref[iop]));
+    }
+    for (int iop = 0; iop < ops.size(); ++iop) {
+      ASSERT_NEAR(convert_to_scalar(traces[iop]), traces_ref[iop], 1E-5 * scale);
+    }
+  }
+}
+
+TEST(SlidingWindow, TraceBound) {
+  typedef double SCALAR;
+  typedef ImpurityModelEigenBasis<SCALAR> MODEL;
+  typedef SlidingWindowManager<MODEL>::EXTENDED_SCALAR EXTENDED_SCALAR;
+  typedef MODEL::BRAKET_T BRAKET_TYPE;
+  alps::params par;
+  const int sites = 2;
+  const int flavors = 2 * sites;
+  const double beta = 5.0, onsite_U = 2.0, JH = 0.3;
+  par["model.sites"] = sites;
+  par["model.spins"] = 2;
+  par["model.n_tau_hyb"] = 100;
+  par["model.onsite_U"] = onsite_U;
+  par["model.beta"] = beta;
+
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > Uval_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int isp2 = 0; isp2 < 2; ++isp2) {
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, isp, isp2, onsite_U, sites));
+      }
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        for (int beta = 0; beta < sites; ++beta) {
+          if (alpha == beta) continue;
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, alpha, beta, isp, isp2, onsite_U - 2 * JH, sites));
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, beta, alpha, isp, isp2, JH, sites));
+        }
+      }
+    }
+  }
+  std::vector<boost::tuple<int, int, SCALAR> > t_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int alpha = 0; alpha < sites; ++alpha) {
+      for (int beta = 0; beta < sites; ++beta) {
+        t_list.push_back(boost::make_tuple(alpha + isp * sites, beta + isp * sites, alpha == beta ? -0.5 * onsite_U : -0.3));
+      }
+    }
+  }
+  MODEL::define_parameters(par);
+  MODEL model(par, t_list, Uval_list);
+
+  //the bound of each braket must not be smaller than the absolute value of its contribution to the trace
+  boost::random::mt19937 gen(200);
+  boost::uniform_real<> uni_dist(0, 1);
+  for (int trial = 0; trial < 40; ++trial) {
+    operator_container_t operators;
+    for (int flavor = 0; flavor < flavors; ++flavor) {
+      std::vector<double> times(2 * static_cast<int>(4 * uni_dist(gen)));
+      for (int i = 0; i < times.size(); ++i) {
+        times[i] = beta * uni_dist(gen);
+      }
+      std::sort(times.begin(), times.end());
+      for (int i = 0; i < times.size(); ++i) {
+        operators.insert(psi(OperatorTime(times[i]), i % 2 == 0 ? CREATION_OP : ANNIHILATION_OP, flavor));
+      }
+    }
+
+    for (int use_op_norms = 0; use_op_norms < 2; ++use_op_norms) {
+      SlidingWindowManager<MODEL> sliding_window(&model, beta);
+      sliding_window.set_use_op_norms_in_trace_bound(use_op_norms == 1);
+      sliding_window.init_stacks(1 + trial % 4, operators);
+      for (int move = 0; move < trial % 7; ++move) {
+        sliding_window.move_window_to_next_position(operators);
+      }
+
+      std::vector<EXTENDED_REAL> trace_bound(sliding_window.get_num_brakets());
+      const EXTENDED_REAL trace_bound_sum = sliding_window.compute_trace_bound(operators, trace_bound);
+
+      std::vector<psi> ops_window;
+      for (operator_container_t::const_iterator it = operators.begin(); it != operators.end(); ++it) {
+        if (sliding_window.get_tau_low() <= it->time().time() && it->time().time() <= sliding_window.get_tau_high()) {
+          ops_window.push_back(*it);
+        }
+      }
+      OperatorSequence ops_seq;
+      ops_seq.assign(ops_window.begin(), ops_window.end());
+
+      EXTENDED_REAL abs_trace_sum = 0.0;
+      for (int braket = 0; braket < sliding_window.get_num_brakets(); ++braket) {
+        const BRAKET_TYPE &bra = sliding_window.get_bra(braket);
+        BRAKET_TYPE ket = sliding_window.get_ket(braket);
+        EXTENDED_SCALAR trace_braket = 0.0;
+        if (!bra.invalid() && !ket.invalid()) {
+          SlidingWindowManager<MODEL>::evolve_ket(model, ket, ops_seq,
+                                                  sliding_window.get_tau_low(), sliding_window.get_tau_high());
+          if (!ket.invalid() && bra.sector() == ket.sector()) {
+            trace_braket = model.product(bra, ket);
+          }
+        }
+        const EXTENDED_REAL abs_trace_braket = myabs(trace_braket);
+        ASSERT_TRUE(abs_trace_braket <= trace_bound[braket] * (1 + 1E-8));
+        abs_trace_sum += abs_trace_braket;
+      }
+      ASSERT_TRUE(abs_trace_sum <= trace_bound_sum * (1 + 1E-8));
+      ASSERT_TRUE(myabs(sliding_window.compute_trace(operators)) <= trace_bound_sum * (1 + 1E-8));
+    }
+  }
+}
+
+TEST(SlidingWindow, PairInsertionScan) {
+  typedef double SCALAR;
+  typedef ImpurityModelEigenBasis<SCALAR> MODEL;
+  typedef SlidingWindowManager<MODEL>::EXTENDED_SCALAR EXTENDED_SCALAR;
+  alps::params par;
+  const int sites = 2;
+  const int flavors = 2 * sites;
+  const double beta = 5.0, onsite_U = 2.0, JH = 0.3;
+  par["model.sites"] = sites;
+  par["model.spins"] = 2;
+  par["model.n_tau_hyb"] = 100;
+  par["model.onsite_U"] = onsite_U;
+  par["model.beta"] = beta;
+
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > Uval_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int isp2 = 0; isp2 < 2; ++isp2) {
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, isp, isp2, onsite_U, sites));
+      }
+      for (int alpha = 0; alpha < sites; ++alpha) {
+        for (int beta = 0; beta < sites; ++beta) {
+          if (alpha == beta) continue;
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, alpha, beta, isp, isp2, onsite_U - 2 * JH, sites));
+          Uval_list.push_back(get_tuple<SCALAR>(alpha, beta, beta, alpha, isp, isp2, JH, sites));
+        }
+      }
+    }
+  }
+  std::vector<boost::tuple<int, int, SCALAR> > t_list;
+  for (int isp = 0; isp < 2; ++isp) {
+    for (int alpha = 0; alpha < sites; ++alpha) {
+      for (int beta = 0; beta < sites; ++beta) {
+        t_list.push_back(boost::make_tuple(alpha + isp * sites, beta + isp * sites, alpha == beta ? -0.5 * onsite_U : -0.3));
+      }
+    }
+  }
+  MODEL::define_parameters(par);
+  MODEL model(par, t_list, Uval_list);
+
+  int num_nonzero_traces = 0;
+  boost::random::mt19937 gen(300);
+  boost::uniform_real<> uni_dist(0, 1);
+  for (int trial = 0; trial < 20; ++trial) {
+    operator_container_t operators;
+    for (int flavor = 0; flavor < flavors; ++flavor) {
+      std::vector<double> times(2 * static_cast<int>(3 * uni_dist(gen)));
+      for (int i = 0; i < times.size(); ++i) {
+        times[i] = beta * uni_dist(gen);
+      }
+      std::sort(times.begin(), times.end());
+      for (int i = 0; i < times.size(); ++i) {
+        operators.insert(psi(OperatorTime(times[i]), i % 2 == 0 ? CREATION_OP : ANNIHILATION_OP, flavor));
+      }
+    }
+    //an equal-time pair already in the configuration, as for the worm operators which are not shifted
+    const double t_fixed = beta * uni_dist(gen);
+    const int flavor_fixed = static_cast<int>(flavors * uni_dist(gen));
+    operators.insert(psi(OperatorTime(t_fixed, 0), ANNIHILATION_OP, flavor_fixed));
+    operators.insert(psi(OperatorTime(t_fixed, 1), CREATION_OP, flavor_fixed));
+
+    //times in the first and last intervals between operators and random times in between
+    std::vector<double> times;
+    times.push_back(0.5 * operators.begin()->time().time());
+    times.push_back(0.5 * (operators.rbegin()->time().time() + beta));
+    for (int i = 0; i < 10; ++i) {
+      times.push_back(beta * uni_dist(gen));
+    }
+    std::sort(times.begin(), times.end());
+
+    //the pair is of the same flavor in even trials, so that the order at equal time matters
+    const OPERATOR_TYPE type_earlier = trial % 4 < 2 ? ANNIHILATION_OP : CREATION_OP;
+    const OPERATOR_TYPE type_later = type_earlier == CREATION_OP ? ANNIHILATION_OP : CREATION_OP;
+    const int flavor_earlier = static_cast<int>(flavors * uni_dist(gen));
+    const int flavor_later = trial % 2 == 0 ? flavor_earlier : static_cast<int>(flavors * uni_dist(gen));
+    const psi op_earlier(OperatorTime(0.0, 0), type_earlier, flavor_earlier);
+    const psi op_later(OperatorTime(0.0, 1), type_later, flavor_later);
+
+    SlidingWindowManager<MODEL> sliding_window(&model, beta);
+    sliding_window.init_stacks(1, operators);
+    std::vector<EXTENDED_SCALAR> traces;
+    sliding_window.scan_trace_pair_insertion(operators, op_earlier, op_later, times, traces);
+    ASSERT_EQ(traces.size(), times.size());
+
+    //op_earlier is placed at (t, 0) and op_later at (t, 1)
+    std::vector<double> traces_ref(times.size());
+    double scale = 0.0;
+    for (int i = 0; i < times.size(); ++i) {
+      operator_container_t ops_pair(operators);
+      ops_pair.insert(psi(OperatorTime(times[i], 0), type_earlier, flavor_earlier));
+      ops_pair.insert(psi(OperatorTime(times[i], 1), type_later, flavor_later));
+      traces_ref[i] = convert_to_scalar(sliding_window.compute_trace(ops_pair));
+      scale = std::max(scale, std::abs(traces_ref[i]));
+      if (traces_ref[i] != 0.0) {
+        ++num_nonzero_traces;
+      }
+    }
+    for (int i = 0; i < times.size(); ++i) {
+      ASSERT_NEAR(convert_to_scalar(traces[i]), traces_ref[i], 1E-8 * scale);
+    }
+  }
+  ASSERT_TRUE(num_nonzero_traces > 0);
 }
 
 TEST(SpectralNorm, SVDvsDiagonalization) {
@@ -155,6 +546,803 @@ TEST(FastUpdate, CombSort) {
   }
 }
 
+TEST(MonteCarloConfiguration, PermutationSignChange) {
+  const int pert_order = 20, num_updates = 100;
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  std::vector<psi> cdagg_ops, c_ops;
+  for (int i = 0; i < pert_order; ++i) {
+    cdagg_ops.push_back(psi(OperatorTime(uni_dist(gen)), CREATION_OP, 0));
+    c_ops.push_back(psi(OperatorTime(uni_dist(gen)), ANNIHILATION_OP, 0));
+  }
+  worm_operators_t worm_ops;
+  worm_ops.push_back(psi(OperatorTime(uni_dist(gen)), ANNIHILATION_OP, 0));
+  worm_ops.push_back(psi(OperatorTime(uni_dist(gen)), CREATION_OP, 0));
+  int perm_sign = compute_permutation_sign_impl(cdagg_ops, c_ops, worm_ops);
+
+  for (int update = 0; update < num_updates; ++update) {
+    //remove a pair of operators and insert two pairs, or the other way around
+    std::vector<psi> cdagg_ops_rem, c_ops_rem, cdagg_ops_add, c_ops_add;
+    const int num_rem = update % 2 == 0 ? 1 : 2;
+    for (int i = 0; i < num_rem; ++i) {
+      cdagg_ops_rem.push_back(cdagg_ops.back());
+      c_ops_rem.push_back(c_ops[i]);
+      cdagg_ops.pop_back();
+      c_ops.erase(c_ops.begin() + i);
+    }
+    for (int i = 0; i < 3 - num_rem; ++i) {
+      cdagg_ops_add.push_back(psi(OperatorTime(uni_dist(gen)), CREATION_OP, 0));
+      c_ops_add.push_back(psi(OperatorTime(uni_dist(gen)), ANNIHILATION_OP, 0));
+      cdagg_ops.push_back(cdagg_ops_add.back());
+      c_ops.push_back(c_ops_add.back());
+    }
+    worm_operators_t worm_ops_new(worm_ops);
+    worm_ops_new[update % 2].set_time(OperatorTime(uni_dist(gen)));
+
+    const operator_container_t cdagg_ops_set(cdagg_ops.begin(), cdagg_ops.end());
+    const operator_container_t c_ops_set(c_ops.begin(), c_ops.end());
+    const int perm_sign_new = perm_sign * compute_permutation_sign_change(cdagg_ops_set, c_ops_set,
+                                                                          cdagg_ops_rem, c_ops_rem,
+                                                                          cdagg_ops_add, c_ops_add,
+                                                                          worm_ops, worm_ops_new);
+    ASSERT_EQ(compute_permutation_sign_impl(cdagg_ops, c_ops, worm_ops_new), perm_sign_new);
+
+    perm_sign = perm_sign_new;
+    worm_ops = worm_ops_new;
+  }
+}
+
+TEST(HybridizationFunction, BatchEvaluation) {
+  const int n_flavors = 2, n_tau = 50, n_ops = 7;
+  const double beta = 5.0;
+
+  //F(tau) is a cubic polynomial of tau, which is reproduced exactly by cubic interpolation
+  boost::multi_array<double, 3> F(boost::extents[n_flavors][n_flavors][n_tau + 1]);
+  for (int f1 = 0; f1 < n_flavors; ++f1) {
+    for (int f2 = 0; f2 < n_flavors; ++f2) {
+      for (int itau = 0; itau < n_tau + 1; ++itau) {
+        const double tau = beta * itau / n_tau;
+        F[f1][f2][itau] = -0.3 * (f1 + 1) * tau * tau * tau + 0.2 * tau * tau + (f2 + 1) * tau - 0.5;
+      }
+    }
+  }
+  HybridizationFunction<double> F_linear(beta, n_tau, n_flavors, F);
+  HybridizationFunction<double> F_cubic(beta, n_tau, n_flavors, F, 1e-10, true);
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+  std::vector<psi> c_ops, cdagg_ops;
+  for (int i = 0; i < n_ops; ++i) {
+    c_ops.push_back(psi(OperatorTime(beta * uni_dist(gen)), ANNIHILATION_OP, i % n_flavors));
+    cdagg_ops.push_back(psi(OperatorTime(beta * uni_dist(gen)), CREATION_OP, (i + 1) % n_flavors));
+  }
+
+  Eigen::MatrixXd mat_linear(n_ops, n_ops), mat_cubic(n_ops, n_ops);
+  F_linear.fill_block(c_ops.begin(), c_ops.end(), cdagg_ops.begin(), cdagg_ops.end(), mat_linear);
+  F_cubic.fill_block(c_ops.begin(), c_ops.end(), cdagg_ops.begin(), cdagg_ops.end(), mat_cubic);
+  for (int i = 0; i < n_ops; ++i) {
+    for (int j = 0; j < n_ops; ++j) {
+      ASSERT_NEAR(mat_linear(i, j), F_linear(c_ops[i], cdagg_ops[j]), 1e-12);
+      ASSERT_NEAR(mat_cubic(i, j), F_cubic(c_ops[i], cdagg_ops[j]), 1e-12);
+
+      double tau = c_ops[i].time() - cdagg_ops[j].time();
+      const double sign = tau < 0 ? -1.0 : 1.0;
+      if (tau < 0) {
+        tau += beta;
+      }
+      const int f1 = c_ops[i].flavor(), f2 = cdagg_ops[j].flavor();
+      const double exact = sign * (-0.3 * (f1 + 1) * tau * tau * tau + 0.2 * tau * tau + (f2 + 1) * tau - 0.5);
+      ASSERT_NEAR(mat_cubic(i, j), exact, 1e-10);
+    }
+  }
+
+  Eigen::VectorXd col(n_ops), row(n_ops);
+  F_linear.fill_column(c_ops.begin(), c_ops.end(), cdagg_ops[3], col);
+  F_linear.fill_row(c_ops[2], cdagg_ops.begin(), cdagg_ops.end(), row);
+  for (int i = 0; i < n_ops; ++i) {
+    ASSERT_NEAR(col[i], F_linear(c_ops[i], cdagg_ops[3]), 1e-12);
+    ASSERT_NEAR(row[i], F_linear(c_ops[2], cdagg_ops[i]), 1e-12);
+  }
+}
+
+TEST(NFFT, FermionicMatsubara) {
+  const int n_matsubara = 101, n_terms = 500;
+  const double beta = 10.0;
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  FermionicNFFT nfft(beta, n_matsubara, 2);
+  std::vector<double> taus;
+  std::vector<std::complex<double> > coeffs;
+  for (int j = 0; j < n_terms; ++j) {
+    taus.push_back(beta * (2 * uni_dist(gen) - 1));
+    coeffs.push_back(std::complex<double>(uni_dist(gen) - 0.5, uni_dist(gen) - 0.5));
+    nfft.add(1, taus.back(), coeffs.back());
+  }
+
+  std::vector<std::complex<double> > result0, result1;
+  nfft.transform(0, result0);
+  nfft.transform(1, result1);
+  for (int n = 0; n < n_matsubara; ++n) {
+    const double omega = (2 * n + 1) * M_PI / beta;
+    std::complex<double> exact = 0.0;
+    for (int j = 0; j < n_terms; ++j) {
+      exact += coeffs[j] * std::exp(std::complex<double>(0.0, omega * taus[j]));
+    }
+    ASSERT_NEAR(std::abs(result1[n] - exact), 0.0, 1e-8);
+    ASSERT_NEAR(std::abs(result0[n]), 0.0, 1e-12);
+  }
+}
+
+TEST(G2Measurement, FlavorIndexMap) {
+  const int num_flavors = 4;
+
+  //spin up: 0, 1, spin down: 2, 3
+  std::vector<std::vector<int> > groups(2);
+  groups[0].push_back(0);
+  groups[0].push_back(1);
+  groups[1].push_back(2);
+  groups[1].push_back(3);
+  G2FlavorIndexMap flavor_map(num_flavors, groups);
+
+  //(a, b, c, d) = (up, up, up, up), (up, up, dn, dn), (dn, dn, up, up), (up, dn, dn, up), ...
+  ASSERT_EQ(flavor_map.num_combinations(), 6 * 16);
+  for (int idx = 0; idx < flavor_map.num_combinations(); ++idx) {
+    const boost::array<int, 4> &f = flavor_map.flavors(idx);
+    ASSERT_EQ(flavor_map.index(f[0], f[1], f[2], f[3]), idx);
+  }
+  ASSERT_TRUE(flavor_map.index(0, 1, 2, 3) >= 0);
+  ASSERT_TRUE(flavor_map.index(0, 3, 2, 1) >= 0);
+  ASSERT_EQ(flavor_map.index(0, 2, 0, 2), -1);
+  ASSERT_EQ(flavor_map.index(0, 0, 0, 2), -1);
+
+  //all the combinations are stored without conserved groups
+  G2FlavorIndexMap flavor_map_full(num_flavors, std::vector<std::vector<int> >());
+  ASSERT_EQ(flavor_map_full.num_combinations(), num_flavors * num_flavors * num_flavors * num_flavors);
+  ASSERT_EQ(flavor_map_full.index(1, 2, 3, 0), ((1 * num_flavors + 2) * num_flavors + 3) * num_flavors + 0);
+}
+
+//Accumulate G2 by removal directly from the 4x4 determinants of M (rows b, d, aux and cols a, c, aux)
+void accumulate_G2_by_direct_determinants(double beta, LegendreTransformer &legendre_trans, int n_freq,
+                                          double sign,
+                                          const std::vector<psi> &creation_ops,
+                                          const std::vector<psi> &annihilation_ops,
+                                          const alps::fastupdate::ResizableMatrix<double> &M,
+                                          const std::vector<double> &comm_trace_ratios,
+                                          boost::multi_array<std::complex<double>, 7> &result) {
+  const int n = creation_ops.size();
+  const int num_legendre = legendre_trans.num_legendre();
+  const std::vector<double> &sqrt_2l_1 = legendre_trans.get_sqrt_2l_1();
+  std::vector<double> Pl(num_legendre);
+
+  //(sign)sqrt(2l+1)P_l(x) for a pair of annihilator k and creator l
+  boost::multi_array<double, 3> Pl_kl(boost::extents[n][n][num_legendre]);
+  for (int k = 0; k < n; ++k) {
+    for (int l = 0; l < n; ++l) {
+      double tau = annihilation_ops[k].time() - creation_ops[l].time();
+      const double tau_sign = tau < 0 ? -1.0 : 1.0;
+      if (tau < 0) {
+        tau += beta;
+      }
+      legendre_trans.compute_legendre(2 * tau / beta - 1.0, Pl);
+      for (int il = 0; il < num_legendre; ++il) {
+        Pl_kl[k][l][il] = tau_sign * sqrt_2l_1[il] * Pl[il];
+      }
+    }
+  }
+
+  boost::multi_array<double, 4> weight(boost::extents[n][n][n][n]);
+  std::fill(weight.origin(), weight.origin() + weight.num_elements(), 0.0);
+  double norm = 0.0;
+  Eigen::Matrix4d sub_mat;
+  for (int a = 0; a < n; ++a) {
+    for (int b = 0; b < n; ++b) {
+      for (int c = 0; c < n; ++c) {
+        for (int d = 0; d < n; ++d) {
+          if (a == c || b == d) {
+            continue;
+          }
+          const int rows[] = {b, d, n, n + 1}, cols[] = {a, c, n, n + 1};
+          for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+              sub_mat(i, j) = M(rows[i], cols[j]);
+            }
+          }
+          weight[a][b][c][d] = sign * sub_mat.determinant();
+          norm += std::abs(weight[a][b][c][d]);
+        }
+      }
+    }
+  }
+
+  for (int a = 0; a < n; ++a) {
+    for (int b = 0; b < n; ++b) {
+      for (int c = 0; c < n; ++c) {
+        for (int d = 0; d < n; ++d) {
+          if (a == c || b == d) {
+            continue;
+          }
+          const double coeff = weight[a][b][c][d] * comm_trace_ratios[a] / (norm * beta);
+          const std::complex<double> phase =
+              std::exp(std::complex<double>(0.0, 2 * M_PI * (annihilation_ops[a].time() - creation_ops[d].time()) / beta));
+          for (int il = 0; il < num_legendre; ++il) {
+            for (int il_p = 0; il_p < num_legendre; ++il_p) {
+              //(-1)^{l'+1} for the second pair
+              const double coeff2 = coeff * Pl_kl[a][b][il] * Pl_kl[c][d][il_p] * (il_p % 2 == 0 ? -1.0 : 1.0);
+              std::complex<double> phase_m = 1.0;
+              for (int im = 0; im < n_freq; ++im) {
+                result[annihilation_ops[a].flavor()][creation_ops[b].flavor()]
+                [annihilation_ops[c].flavor()][creation_ops[d].flavor()][il][il_p][im] += coeff2 * phase_m;
+                phase_m *= phase;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(G2Measurement, RemovalByMatrixProducts) {
+  const double beta = 2.0;
+  const int n = 7, num_flavors = 2, num_legendre = 4, n_freq = 3;
+  const double sign = -1.0;
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  std::vector<psi> creation_ops, annihilation_ops;
+  for (int i = 0; i < n; ++i) {
+    creation_ops.push_back(psi(OperatorTime(beta * uni_dist(gen)), CREATION_OP, num_flavors * uni_dist(gen)));
+    annihilation_ops.push_back(psi(OperatorTime(beta * uni_dist(gen)), ANNIHILATION_OP, num_flavors * uni_dist(gen)));
+  }
+  //physical rows/cols followed by two auxiliary lines
+  alps::fastupdate::ResizableMatrix<double> M(n + 2, n + 2, 0.0);
+  for (int i = 0; i < n + 2; ++i) {
+    for (int j = 0; j < n + 2; ++j) {
+      M(i, j) = uni_dist(gen) - 0.5;
+    }
+  }
+  std::vector<double> comm_trace_ratios(n), no_ratios(n, 1.0);
+  for (int i = 0; i < n; ++i) {
+    comm_trace_ratios[i] = uni_dist(gen) - 0.5;
+  }
+
+  LegendreTransformer legendre_trans(1, num_legendre);
+  boost::multi_array<std::complex<double>, 7>
+      ref(boost::extents[num_flavors][num_flavors][num_flavors][num_flavors][num_legendre][num_legendre][n_freq]),
+      ref_improved(ref);
+  std::fill(ref.origin(), ref.origin() + ref.num_elements(), 0.0);
+  std::fill(ref_improved.origin(), ref_improved.origin() + ref_improved.num_elements(), 0.0);
+  accumulate_G2_by_direct_determinants(beta, legendre_trans, n_freq, sign, creation_ops, annihilation_ops, M,
+                                       no_ratios, ref);
+  accumulate_G2_by_direct_determinants(beta, legendre_trans, n_freq, sign, creation_ops, annihilation_ops, M,
+                                       comm_trace_ratios, ref_improved);
+
+  G2FlavorIndexMap flavor_map(num_flavors, std::vector<std::vector<int> >());
+  boost::multi_array<std::complex<double>, 4> result, result_improved;
+  init_work_space(result, num_flavors, num_legendre, n_freq, flavor_map);
+  init_work_space(result_improved, num_flavors, num_legendre, n_freq, flavor_map);
+  std::fill(result.origin(), result.origin() + result.num_elements(), 0.0);
+  std::fill(result_improved.origin(), result_improved.origin() + result_improved.num_elements(), 0.0);
+  MeasureGHelper<double, 2>::perform(beta, legendre_trans, n_freq, sign, 1.0, creation_ops, annihilation_ops, M,
+                                     result, comm_trace_ratios, result_improved, flavor_map);
+
+  double max_abs = 0.0;
+  for (int idx = 0; idx < flavor_map.num_combinations(); ++idx) {
+    const boost::array<int, 4> &f = flavor_map.flavors(idx);
+    for (int il = 0; il < num_legendre; ++il) {
+      for (int il_p = 0; il_p < num_legendre; ++il_p) {
+        for (int im = 0; im < n_freq; ++im) {
+          const std::complex<double> &r = ref[f[0]][f[1]][f[2]][f[3]][il][il_p][im];
+          const std::complex<double> &r_imp = ref_improved[f[0]][f[1]][f[2]][f[3]][il][il_p][im];
+          ASSERT_NEAR(std::abs(result[idx][il][il_p][im] - r), 0.0, 1e-12);
+          ASSERT_NEAR(std::abs(result_improved[idx][il][il_p][im] - r_imp), 0.0, 1e-12);
+          max_abs = std::max(max_abs, std::abs(r));
+        }
+      }
+    }
+  }
+  ASSERT_TRUE(max_abs > 1e-3);
+}
+
+TEST(G2Measurement, TransformFlavorIndex) {
+  typedef std::complex<double> complex_t;
+  typedef Eigen::Matrix<complex_t, Eigen::Dynamic, Eigen::Dynamic> complex_matrix_t;
+  //n_flavors^3 * inner_size exceeds the chunk size of the column loop
+  const int n_flavors = 3, inner_size = 160;
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  //random unitary matrix
+  complex_matrix_t rand_mat(n_flavors, n_flavors);
+  for (int i = 0; i < n_flavors; ++i) {
+    for (int j = 0; j < n_flavors; ++j) {
+      rand_mat(i, j) = complex_t(uni_dist(gen) - 0.5, uni_dist(gen) - 0.5);
+    }
+  }
+  const complex_matrix_t rotmat = Eigen::HouseholderQR<complex_matrix_t>(rand_mat).householderQ();
+  ASSERT_TRUE((rotmat.adjoint() * rotmat - complex_matrix_t::Identity(n_flavors, n_flavors)).norm() < 1e-12);
+
+  boost::multi_array<complex_t, 5>
+      data(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors][inner_size]), data_org(data), ref(data);
+  for (int i = 0; i < data_org.num_elements(); ++i) {
+    *(data_org.origin() + i) = complex_t(uni_dist(gen) - 0.5, uni_dist(gen) - 0.5);
+  }
+
+  //conjugated on odd indices as in compute_G2, and on even indices as in compute_two_time_G2
+  for (int conj_parity = 0; conj_parity < 2; ++conj_parity) {
+    std::vector<complex_matrix_t> U(4);
+    for (int index = 0; index < 4; ++index) {
+      U[index] = index % 2 == conj_parity ? complex_matrix_t(rotmat.conjugate()) : rotmat;
+    }
+
+    //direct O(n_flavors^8) rotation
+    std::fill(ref.origin(), ref.origin() + ref.num_elements(), 0.0);
+    for (int f0 = 0; f0 < n_flavors; ++f0) {
+      for (int f1 = 0; f1 < n_flavors; ++f1) {
+        for (int f2 = 0; f2 < n_flavors; ++f2) {
+          for (int f3 = 0; f3 < n_flavors; ++f3) {
+            for (int g0 = 0; g0 < n_flavors; ++g0) {
+              for (int g1 = 0; g1 < n_flavors; ++g1) {
+                for (int g2 = 0; g2 < n_flavors; ++g2) {
+                  for (int g3 = 0; g3 < n_flavors; ++g3) {
+                    const complex_t coeff = U[0](f0, g0) * U[1](f1, g1) * U[2](f2, g2) * U[3](f3, g3);
+                    for (int i = 0; i < inner_size; ++i) {
+                      ref[f0][f1][f2][f3][i] += coeff * data_org[g0][g1][g2][g3][i];
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+
+    data = data_org;
+    for (int index = 0; index < 4; ++index) {
+      transform_flavor_index(n_flavors, 4, index, inner_size, index % 2 == conj_parity, rotmat, data.origin());
+    }
+    for (int i = 0; i < data.num_elements(); ++i) {
+      ASSERT_NEAR(std::abs(*(data.origin() + i) - *(ref.origin() + i)), 0.0, 1e-12);
+    }
+  }
+}
+
+//MPI is initialized once for the tests of collective operations (run on a single process)
+class MPIEnvironment : public ::testing::Environment {
+ public:
+  virtual void SetUp() {
+    int initialized;
+    MPI_Initialized(&initialized);
+    if (!initialized) {
+      MPI_Init(NULL, NULL);
+    }
+  }
+  virtual void TearDown() {
+    int finalized;
+    MPI_Finalized(&finalized);
+    if (!finalized) {
+      MPI_Finalize();
+    }
+  }
+};
+static ::testing::Environment *const mpi_environment = ::testing::AddGlobalTestEnvironment(new MPIEnvironment);
+
+//Stand-ins for the Monte Carlo results and the simulation type passed to postprocessing (only scalar means are read)
+struct MockObservable {
+  double value;
+  template<typename T>
+  T mean() const { return T(); }
+};
+template<>
+inline double MockObservable::mean<double>() const { return value; }
+
+struct MockResults {
+  std::map<std::string, double> values;
+  MockObservable operator[](const std::string &name) const {
+    MockObservable obs;
+    obs.value = values.at(name);
+    return obs;
+  }
+};
+
+struct MockSimulation {
+  typedef double SCALAR;
+  typedef MockResults results_type;
+  typedef alps::params parameters_type;
+};
+
+TEST(G2Measurement, StreamedOutput) {
+  typedef std::complex<double> complex_t;
+  const int n_flavors = 3, n_legendre = 3, n_freq = 2;
+  const std::string file_name("unittest_streamed_G2.h5");
+
+  alps::params par;
+  par["model.sites"] = n_flavors;
+  par["model.spins"] = 1;
+  par["measurement.G2.n_legendre"] = n_legendre;
+  par["measurement.G2.n_bosonic_freq"] = n_freq;
+  par["measurement.G2.improved_estimator"] = 1;
+
+  MockResults results;
+  results.values["Sign"] = 0.8;
+  results.values["worm_space_volume_G2"] = 2.0;
+  results.values["Z_function_space_volume"] = 3.0;
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  //flavors 0 and 1 are mixed by the rotation, 2 is not
+  std::vector<std::vector<int> > groups(2);
+  groups[0].push_back(0);
+  groups[0].push_back(1);
+  groups[1].push_back(2);
+  Eigen::MatrixXd rand_mat(2, 2);
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 2; ++j) {
+      rand_mat(i, j) = uni_dist(gen) - 0.5;
+    }
+  }
+  Eigen::MatrixXd rotmat = Eigen::MatrixXd::Identity(n_flavors, n_flavors);
+  rotmat.topLeftCorner(2, 2) = Eigen::HouseholderQR<Eigen::MatrixXd>(rand_mat).householderQ();
+
+  //sums and numbers of data on this process
+  StreamedG2<double> G2;
+  G2.flavor_map = G2FlavorIndexMap(n_flavors, groups);
+  G2.rotmat_Delta = rotmat;
+  G2.coeff = 2.0 / (0.8 * 3.0);
+  G2.keys.push_back("G2_LEGENDRE");
+  G2.keys.push_back("G2_IMPROVED_LEGENDRE");
+  const char *names[] = {"G2", "G2_improved"};
+  const long counts[] = {5, 4};
+  reduced_observables_t reduced_obs;
+  for (int i = 0; i < 2; ++i) {
+    std::vector<complex_t> sum(G2.flavor_map.num_combinations() * n_legendre * n_legendre * n_freq);
+    for (int j = 0; j < sum.size(); ++j) {
+      sum[j] = complex_t(uni_dist(gen) - 0.5, uni_dist(gen) - 0.5);
+    }
+    G2.local_sums.push_back(sum);
+    G2.local_counts.push_back(counts[i]);
+    std::vector<complex_t> &mean = reduced_obs[names[i]];
+    for (int j = 0; j < sum.size(); ++j) {
+      mean.push_back(sum[j] / static_cast<double>(counts[i]));
+    }
+  }
+
+  std::map<std::string, boost::any> ar;
+  compute_G2<MockSimulation>(results, par, rotmat, G2.flavor_map, reduced_obs, ar);
+  {
+    alps::hdf5::archive archive(file_name, "w");
+    write_streamed_G2(alps::mpi::communicator(), n_flavors, n_legendre, n_freq, G2, &archive);
+  }
+
+  alps::hdf5::archive archive(file_name, "r");
+  for (int i = 0; i < 2; ++i) {
+    const boost::multi_array<complex_t, 7> &ref = boost::any_cast<const boost::multi_array<complex_t, 7> &>(ar[G2.keys[i]]);
+    boost::multi_array<complex_t, 7>
+        streamed(boost::extents[n_flavors][n_flavors][n_flavors][n_flavors][n_legendre][n_legendre][n_freq]);
+    archive["/" + G2.keys[i]] >> streamed;
+    double max_abs = 0.0;
+    for (int j = 0; j < ref.num_elements(); ++j) {
+      ASSERT_NEAR(std::abs(*(streamed.origin() + j) - *(ref.origin() + j)), 0.0, 1e-12);
+      max_abs = std::max(max_abs, std::abs(*(ref.origin() + j)));
+    }
+    ASSERT_TRUE(max_abs > 1e-3);
+  }
+  std::remove(file_name.c_str());
+}
+
+TEST(AsyncObservableSink, PackedReduction) {
+  typedef std::complex<double> complex_t;
+  const int num_obs = 3, sizes[] = {3, 2, 2}, num_pushes[] = {4, 3, 0};
+  const double scales[] = {0.5, 1.0, 1.0};
+  const std::string names_array[] = {"A", "B", "C"};
+  const std::vector<std::string> names(names_array, names_array + num_obs);
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  observableset_t measurements;
+  AsyncObservableSink sink(measurements);
+  std::vector<std::vector<complex_t> > sums(num_obs);
+  for (int obs = 0; obs < num_obs; ++obs) {
+    sink.create_local_observable(names[obs], sizes[obs]);
+    sums[obs].resize(sizes[obs], 0.0);
+  }
+  for (int obs = 0; obs < num_obs; ++obs) {
+    for (int push = 0; push < num_pushes[obs]; ++push) {
+      std::vector<complex_t> data(sizes[obs]);
+      for (int i = 0; i < sizes[obs]; ++i) {
+        data[i] = complex_t(uni_dist(gen) - 0.5, uni_dist(gen) - 0.5);
+        sums[obs][i] += scales[obs] * data[i];
+      }
+      sink.push(names[obs], &data[0], data.size(), scales[obs]);
+    }
+  }
+  sink.flush();
+
+  //a single MPI_Reduce and reductions split into chunks of a few doubles
+  const int max_counts[] = {std::numeric_limits<int>::max(), 3, 1};
+  for (int i_count = 0; i_count < 3; ++i_count) {
+    std::map<std::string, std::vector<complex_t> > means =
+        sink.reduce_local_observables(alps::mpi::communicator(), names, 0, max_counts[i_count]);
+    ASSERT_EQ(means.size(), num_obs);
+    for (int obs = 0; obs < num_obs; ++obs) {
+      ASSERT_EQ(means[names[obs]].size(), sizes[obs]);
+      for (int i = 0; i < sizes[obs]; ++i) {
+        //no division for an observable without data
+        const complex_t ref = num_pushes[obs] > 0 ? sums[obs][i] / static_cast<double>(num_pushes[obs]) : 0.0;
+        ASSERT_NEAR(std::abs(means[names[obs]][i] - ref), 0.0, 1e-12);
+      }
+    }
+  }
+}
+
+TEST(AsyncObservableSink, Flush) {
+  typedef std::complex<double> complex_t;
+  //more pushes than buffers per observable, so that push() has to wait for the background thread
+  const int size_alps = 3, size_local = 2, num_pushes_alps = 7, num_pushes_local = 5;
+
+  boost::random::mt19937 gen(100);
+  boost::uniform_real<> uni_dist(0, 1);
+
+  observableset_t measurements;
+  create_observable<complex_t, SimpleRealVectorObservable>(measurements, "A");
+  AsyncObservableSink sink(measurements);
+  sink.create_local_observable("L", size_local);
+
+  std::vector<complex_t> sum_alps(size_alps, 0.0), sum_local(size_local, 0.0);
+  std::vector<complex_t> data_alps(size_alps), data_local(size_local);
+  for (int push = 0; push < std::max(num_pushes_alps, num_pushes_local); ++push) {
+    //data are copied by push(), so the same arrays are overwritten right after it
+    const double scale = 1.0 / (1 + push);
+    if (push < num_pushes_alps) {
+      for (int i = 0; i < size_alps; ++i) {
+        data_alps[i] = complex_t(uni_dist(gen) - 0.5, uni_dist(gen) - 0.5);
+        sum_alps[i] += scale * data_alps[i];
+      }
+      sink.push("A", &data_alps[0], data_alps.size(), scale);
+    }
+    if (push < num_pushes_local) {
+      for (int i = 0; i < size_local; ++i) {
+        data_local[i] = complex_t(uni_dist(gen) - 0.5, uni_dist(gen) - 0.5);
+        sum_local[i] += scale * data_local[i];
+      }
+      sink.push("L", &data_local[0], data_local.size(), scale);
+    }
+  }
+  sink.flush();
+
+  ASSERT_EQ(measurements["A_Re"].count(), num_pushes_alps);
+  ASSERT_EQ(measurements["A_Im"].count(), num_pushes_alps);
+  const std::vector<double> mean_re = measurements["A_Re"].mean<std::vector<double> >();
+  const std::vector<double> mean_im = measurements["A_Im"].mean<std::vector<double> >();
+  ASSERT_EQ(mean_re.size(), size_alps);
+  ASSERT_EQ(mean_im.size(), size_alps);
+  for (int i = 0; i < size_alps; ++i) {
+    ASSERT_NEAR(mean_re[i], sum_alps[i].real() / num_pushes_alps, 1e-12);
+    ASSERT_NEAR(mean_im[i], sum_alps[i].imag() / num_pushes_alps, 1e-12);
+  }
+
+  ASSERT_EQ(sink.get_local_count("L"), num_pushes_local);
+  const std::vector<complex_t> &local_sum = sink.get_local_sum("L");
+  ASSERT_EQ(local_sum.size(), size_local);
+  for (int i = 0; i < size_local; ++i) {
+    ASSERT_NEAR(std::abs(local_sum[i] - sum_local[i]), 0.0, 1e-12);
+  }
+}
+
+TEST(ProposalScheduler, AdaptiveFactors) {
+  //normalization: factors are proportional to accepted moves per second, keeping the wall time of a sweep
+  {
+    ProposalScheduler scheduler;
+    const int a = scheduler.add_update("a", 2.0), b = scheduler.add_update("b", 1.0);
+    scheduler.record(a, 100, 50, 1.0);
+    scheduler.record(b, 100, 10, 1.5);
+    scheduler.update_factors();
+
+    const double efficiency_ref = 60.0 / 2.5;
+    const double f_a = (50.0 / 1.0) / efficiency_ref, f_b = (10.0 / 1.5) / efficiency_ref;
+    const double time_old = 2.0 * 0.01 + 1.0 * 0.015;
+    const double time_new = 2.0 * f_a * 0.01 + 1.0 * f_b * 0.015;
+    ASSERT_NEAR(scheduler.factor(a), f_a * time_old / time_new, 1e-12);
+    ASSERT_NEAR(scheduler.factor(b), f_b * time_old / time_new, 1e-12);
+    ASSERT_NEAR(2.0 * scheduler.factor(a) * 0.01 + 1.0 * scheduler.factor(b) * 0.015, time_old, 1e-12);
+  }
+
+  //factors are bounded by [0.2, 5]
+  {
+    ProposalScheduler scheduler;
+    const int a = scheduler.add_update("a", 1.0), b = scheduler.add_update("b", 1.0),
+        c = scheduler.add_update("c", 1.0);
+    scheduler.record(a, 100, 1000, 0.01);
+    scheduler.record(b, 100, 1000, 10.0);
+    scheduler.record(c, 100, 1, 10.0);
+    scheduler.update_factors();
+    ASSERT_EQ(scheduler.factor(a), 5.0);
+    for (int update = 0; update < scheduler.num_updates(); ++update) {
+      ASSERT_TRUE(scheduler.factor(update) >= 0.2 && scheduler.factor(update) <= 5.0);
+    }
+  }
+  {
+    ProposalScheduler scheduler;
+    const int a = scheduler.add_update("a", 1.0), b = scheduler.add_update("b", 1.0),
+        c = scheduler.add_update("c", 1.0);
+    scheduler.record(a, 100, 1000, 10.0);
+    scheduler.record(b, 100, 10, 10.0);
+    scheduler.record(c, 100, 0, 0.001);
+    scheduler.update_factors();
+    ASSERT_EQ(scheduler.factor(b), 0.2);
+    ASSERT_EQ(scheduler.factor(c), 0.2);
+    ASSERT_TRUE(scheduler.factor(a) > 0.2 && scheduler.factor(a) < 5.0);
+  }
+
+  //factors are fixed after freeze() (called in prepare_for_measurement())
+  {
+    ProposalScheduler scheduler;
+    const int a = scheduler.add_update("a", 1.0), b = scheduler.add_update("b", 1.0);
+    scheduler.record(a, 100, 50, 1.0);
+    scheduler.record(b, 100, 10, 1.0);
+    scheduler.update_factors();
+    const double f_a = scheduler.factor(a), f_b = scheduler.factor(b);
+
+    scheduler.freeze();
+    ASSERT_TRUE(scheduler.frozen());
+    scheduler.record(a, 100, 0, 100.0);
+    scheduler.record(b, 100, 100, 0.01);
+    ASSERT_THROW(scheduler.update_factors(), std::logic_error);
+    ASSERT_EQ(scheduler.factor(a), f_a);
+    ASSERT_EQ(scheduler.factor(b), f_b);
+  }
+}
+
+TEST(FlavorProposer, DisconnectedHybridizationBlocks) {
+  alps::params par;
+  const int sites = 3;
+  par["model.sites"] = sites;
+  par["model.spins"] = 2;
+  par["model.n_tau_hyb"] = 1000;
+  typedef double SCALAR;
+  const double onsite_U = 2.0;
+  par["model.onsite_U"] = onsite_U;
+  par["model.beta"] = 1.0;
+
+  std::vector<boost::tuple<int, int, int, int, SCALAR> > Uval_list;
+  for (int alpha = 0; alpha < sites; ++alpha) {
+    Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, 0, 1, onsite_U, sites));
+    Uval_list.push_back(get_tuple<SCALAR>(alpha, alpha, alpha, alpha, 1, 0, onsite_U, sites));
+  }
+  std::vector<boost::tuple<int, int, SCALAR> > t_list;
+
+  ImpurityModelEigenBasis<SCALAR>::define_parameters(par);
+  ImpurityModelEigenBasis<SCALAR> model(par, t_list, Uval_list);
+  const int num_flavors = model.num_flavors();
+  ASSERT_EQ(num_flavors, 6);
+
+  //two blocks {0, 1, 2, 3} and {4, 5}.
+  //The first block is connected only through a chain of one-directional elements.
+  const int n_tau = 10;
+  boost::multi_array<double, 3> F(boost::extents[num_flavors][num_flavors][n_tau + 1]);
+  std::fill(F.origin(), F.origin() + F.num_elements(), 0.0);
+  const int connected[][2] = {{0, 1}, {2, 1}, {2, 3}, {5, 4}};
+  for (int flavor = 0; flavor < num_flavors; ++flavor) {
+    for (int itau = 0; itau < n_tau + 1; ++itau) {
+      F[flavor][flavor][itau] = -0.5;
+    }
+  }
+  for (int pair = 0; pair < 4; ++pair) {
+    for (int itau = 0; itau < n_tau + 1; ++itau) {
+      F[connected[pair][0]][connected[pair][1]][itau] = 0.1;
+    }
+  }
+  HybridizationFunction<SCALAR> gf(1.0, n_tau, num_flavors, F);
+  std::vector<int> block(num_flavors, 0);
+  block[4] = block[5] = 1;
+
+  FlavorProposer proposer(model, gf);
+  alps::random01 rng(100);
+  for (int op = 0; op < 2; ++op) {
+    const OPERATOR_TYPE op_type = static_cast<OPERATOR_TYPE>(op);
+    for (int f1 = 0; f1 < num_flavors; ++f1) {
+      ASSERT_EQ(proposer.num_candidates(op_type, f1), block[f1] == 0 ? 3 : 1);
+
+      //only flavors other than f1 in the same block are proposed, and the relation is symmetric.
+      std::vector<int> num_proposed(num_flavors, 0);
+      for (int i = 0; i < 1000; ++i) {
+        const int f2 = proposer.propose(op_type, f1, rng);
+        ASSERT_TRUE(f2 >= 0 && f2 < num_flavors);
+        ASSERT_NE(f2, f1);
+        ASSERT_EQ(block[f2], block[f1]);
+        ++num_proposed[f2];
+
+        bool reverse_found = false;
+        for (int j = 0; j < 1000 && !reverse_found; ++j) {
+          reverse_found = (proposer.propose(op_type, f2, rng) == f1);
+        }
+        ASSERT_TRUE(reverse_found);
+
+        ASSERT_NEAR(proposer.proposal_ratio(op_type, f1, f2),
+                    (1.0 * proposer.num_candidates(op_type, f1)) / proposer.num_candidates(op_type, f2), 1e-12);
+        ASSERT_NEAR(proposer.proposal_ratio(op_type, f1, f2) * proposer.proposal_ratio(op_type, f2, f1), 1.0, 1e-12);
+      }
+      for (int f2 = 0; f2 < num_flavors; ++f2) {
+        ASSERT_EQ(num_proposed[f2] > 0, f2 != f1 && block[f2] == block[f1]);
+      }
+    }
+  }
+}
+
+TEST(PairTimeProposer, DensityAndNormalization) {
+  const double tau_high = 1.0;
+  PairTimeProposer::intervals_t intervals_cdagg, intervals_c;
+  intervals_cdagg.push_back(std::make_pair(0.1, 0.3));
+  intervals_cdagg.push_back(std::make_pair(0.5, 0.6));
+  intervals_c.push_back(std::make_pair(0.0, 0.2));
+  intervals_c.push_back(std::make_pair(0.7, 0.9));
+
+  PairTimeProposer proposer;
+  proposer.set_intervals(tau_high, intervals_cdagg, intervals_c);
+  ASSERT_NEAR(proposer.normalization(), 0.16 + 0.045 + 0.18 + 0.04, 1e-12);
+
+  //mass of density() in each bin of [0, tau_high]^2 by the midpoint rule on a fine grid
+  const int num_bins = 10, num_sub = 200;
+  const double dt_bin = tau_high / num_bins, dt_sub = dt_bin / num_sub;
+  boost::multi_array<double, 2> mass(boost::extents[num_bins][num_bins]);
+  std::fill(mass.origin(), mass.origin() + mass.num_elements(), 0.0);
+  for (int i = 0; i < num_bins * num_sub; ++i) {
+    for (int j = 0; j < num_bins * num_sub; ++j) {
+      mass[i / num_sub][j / num_sub] += proposer.density((i + 0.5) * dt_sub, (j + 0.5) * dt_sub) * dt_sub * dt_sub;
+    }
+  }
+  double total_mass = 0.0;
+  for (int i = 0; i < num_bins; ++i) {
+    for (int j = 0; j < num_bins; ++j) {
+      total_mass += mass[i][j];
+    }
+  }
+  ASSERT_NEAR(total_mass, 1.0, 1e-3);
+
+  //histogram of sampled pairs. The density of every sampled pair must be 1/Z,
+  //which is used as the proposal probability of the reverse (removal) move.
+  const int num_samples = 1000000;
+  alps::random01 rng(100);
+  boost::multi_array<double, 2> hist(boost::extents[num_bins][num_bins]);
+  std::fill(hist.origin(), hist.origin() + hist.num_elements(), 0.0);
+  for (int sample = 0; sample < num_samples; ++sample) {
+    const std::pair<double, double> times = proposer.propose(rng);
+    ASSERT_TRUE(times.first >= 0.0 && times.first <= tau_high);
+    ASSERT_TRUE(times.second >= 0.0 && times.second <= tau_high);
+    ASSERT_EQ(proposer.density(times.first, times.second), 1.0 / proposer.normalization());
+    hist[static_cast<int>(times.first / dt_bin)][static_cast<int>(times.second / dt_bin)] += 1.0 / num_samples;
+  }
+  for (int i = 0; i < num_bins; ++i) {
+    for (int j = 0; j < num_bins; ++j) {
+      ASSERT_NEAR(hist[i][j], mass[i][j], 5 * std::sqrt(mass[i][j] / num_samples) + 1e-4);
+    }
+  }
+
+  //pairs whose earlier operator is outside its allowed intervals are never proposed
+  ASSERT_EQ(proposer.density(0.4, 0.95), 0.0);
+  ASSERT_EQ(proposer.density(0.45, 0.3), 0.0);
+
+  //the whole window is allowed: same as the uniform proposal
+  const double tau_low = 0.2;
+  PairTimeProposer::intervals_t whole_window(1, std::make_pair(tau_low, tau_high));
+  proposer.set_intervals(tau_high, whole_window, whole_window);
+  ASSERT_NEAR(proposer.normalization(), (tau_high - tau_low) * (tau_high - tau_low), 1e-12);
+
+  //no allowed interval
+  proposer.set_intervals(tau_high, PairTimeProposer::intervals_t(), PairTimeProposer::intervals_t());
+  ASSERT_EQ(proposer.normalization(), 0.0);
+  ASSERT_EQ(proposer.density(0.3, 0.5), 0.0);
+}
+
 /*
 TEST(Util, IteratorOverTwoSets) {
   boost::random::mt19937 gen(100);
@@ -11,8 +11,15 @@
 #include "gtest.h"
 
 #include <alps/fastupdate/detail/util.hpp>
+#include <alps/hdf5.hpp>
 #include "../src/model/model.hpp"
+#include "../src/mc_config.hpp"
 #include "../src/util.hpp"
+#include "../src/nfft.hpp"
+#include "../src/measurement/measurement.hpp"
+#include "../src/update_histogram.hpp"
+#include "../src/moves/moves.hpp"
+#include "../src/postprocess.hpp"
 
 template<typename T>
 boost::tuple<int,int,int,int,T>